@@ -2,4 +2,4 @@
 
 set -xe
 
-cc -o ie-debug-build *.c -Iinclude/ -O0 -ggdb -lforge
+cc -o ie-debug-build main.c listing.c trace.c -Iinclude/ -O0 -ggdb -lforge -lpthread
@@ -0,0 +1,487 @@
+/**
+ * Benchmarks for the directory listing of ie.
+ *
+ * Build and run with `make bench` from the src directory. This is not
+ * built by default.
+ *
+ * Trees of several shapes (flat directories up to a million entries,
+ * long names, symlinks, deep paths) are generated and every phase of
+ * showing a directory runs against them through the same listing.c
+ * code that display() uses, with the rows going to /dev/null instead
+ * of a terminal:
+ *
+ *   scan    reading the names
+ *   sort    ordering them
+ *   stat    fstatat() of every entry
+ *   owner   user and group names
+ *   format  formatting every row
+ *   search  a query that matches nothing, so every name is tried
+ *   frame   a whole refresh: reading the listing and drawing a screen
+ *
+ * Every phase is repeated and reported as its p50 and p99 time together
+ * with the peak RSS of the process. Results are printed as a table and,
+ * if a path is given as the first argument, written there as JSON so
+ * runs can be compared:
+ *
+ *   ./ie-bench results.json
+ *
+ * Trees are generated in a temporary directory that is removed again,
+ * or in $IE_BENCH_DIR where they are kept for the next run. The largest
+ * flat directory can be capped with $IE_BENCH_MAX.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include "listing.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+#define BENCH_MAX_RESULTS 128
+#define BENCH_ENTRIES_PER_PHASE 500000  // decides the number of runs
+#define BENCH_MIN_RUNS 5
+#define BENCH_MAX_RUNS 101
+#define BENCH_ROWS 50                   // of the screen in the frame phase
+#define BENCH_QUERY "^no-such-entry$"
+
+enum {
+        PHASE_SCAN,
+        PHASE_SORT,
+        PHASE_STAT,
+        PHASE_OWNER,
+        PHASE_FORMAT,
+        PHASE_SEARCH,
+        PHASE_FRAME,
+        PHASE_COUNT,
+};
+
+static const char *g_phases[PHASE_COUNT] = {
+        "scan", "sort", "stat", "owner", "format", "search", "frame",
+};
+
+typedef struct {
+        const char *shape;
+        size_t      n;          // shape parameter
+        size_t      entries;    // in the directory, "." and ".." included
+        const char *phase;
+        size_t      runs;
+        double      p50;
+        double      p99;
+        long        maxrss_kb;  // of the process when the shape was done
+} bench_result;
+
+static bench_result g_results[BENCH_MAX_RESULTS];
+static size_t       g_results_n = 0;
+static FILE        *g_null      = NULL;
+
+static double
+now_sec(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long
+maxrss_kb(void)
+{
+        struct rusage ru;
+        return getrusage(RUSAGE_SELF, &ru) == 0 ? ru.ru_maxrss : 0;
+}
+
+static int
+double_compar(const void *a,
+              const void *b)
+{
+        double x = *(const double *)a;
+        double y = *(const double *)b;
+        return (x > y) - (x < y);
+}
+
+// Nearest rank of sorted `v`.
+static double
+percentile(const double *v,
+           size_t        n,
+           int           p)
+{
+        size_t rank = (n * p + 99) / 100;
+        return v[rank ? rank-1 : 0];
+}
+
+static void
+report(const char *shape,
+       size_t      n,
+       size_t      entries,
+       const char *phase,
+       double     *secs,
+       size_t      runs,
+       long        rss)
+{
+        qsort(secs, runs, sizeof(*secs), double_compar);
+
+        double p50 = percentile(secs, runs, 50);
+        double p99 = percentile(secs, runs, 99);
+
+        printf("%-6s %8zu %-7s %4zu runs %10.3f ms p50 %10.3f ms p99 %8.1f ns/entry %8ld KB peak\n",
+               shape, n, phase, runs, p50 * 1e3, p99 * 1e3, p50 * 1e9 / entries, rss);
+
+        if (g_results_n < BENCH_MAX_RESULTS) {
+                g_results[g_results_n++] = (bench_result) {
+                        .shape     = shape,
+                        .n         = n,
+                        .entries   = entries,
+                        .phase     = phase,
+                        .runs      = runs,
+                        .p50       = p50,
+                        .p99       = p99,
+                        .maxrss_kb = rss,
+                };
+        }
+}
+
+static int
+write_json(const char *path)
+{
+        FILE *f = fopen(path, "w");
+        if (!f) {
+                perror(path);
+                return 0;
+        }
+
+        fprintf(f, "[\n");
+        for (size_t i = 0; i < g_results_n; ++i) {
+                const bench_result *r = &g_results[i];
+                fprintf(f, "  {\"shape\": \"%s\", \"n\": %zu, \"entries\": %zu, \"phase\": \"%s\", \"runs\": %zu, "
+                        "\"p50_ns\": %.0f, \"p99_ns\": %.0f, \"ns_per_entry\": %.2f, \"maxrss_kb\": %ld}%s\n",
+                        r->shape, r->n, r->entries, r->phase, r->runs, r->p50 * 1e9, r->p99 * 1e9,
+                        r->p50 * 1e9 / r->entries, r->maxrss_kb, i+1 < g_results_n ? "," : "");
+        }
+        fprintf(f, "]\n");
+
+        return fclose(f) == 0;
+}
+
+/////////////////////////////////////////
+// Trees
+
+static void
+touch(const char *path,
+      mode_t      mode)
+{
+        int fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, mode);
+        if (fd == -1) {
+                perror(path);
+                exit(1);
+        }
+        close(fd);
+}
+
+static void
+mkdir_or_die(const char *path)
+{
+        if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+                perror(path);
+                exit(1);
+        }
+}
+
+// Mostly plain files, with some directories and executables so that
+// every kind of row is formatted.
+static void
+gen_flat(const char *dir,
+         size_t      n)
+{
+        char path[PATH_MAX];
+
+        for (size_t i = 0; i < n; ++i) {
+                if (i % 16 == 0) {
+                        snprintf(path, sizeof(path), "%s/dir%07zu", dir, i);
+                        mkdir_or_die(path);
+                } else {
+                        snprintf(path, sizeof(path), "%s/file%07zu.txt", dir, i);
+                        touch(path, i % 8 == 1 ? 0755 : 0644);
+                }
+        }
+}
+
+static void
+gen_long(const char *dir,
+         size_t      n)
+{
+        char path[PATH_MAX];
+        char pad[201];
+
+        memset(pad, 'x', sizeof(pad)-1);
+        pad[sizeof(pad)-1] = '\0';
+
+        for (size_t i = 0; i < n; ++i) {
+                snprintf(path, sizeof(path), "%s/%s-%07zu.txt", dir, pad, i);
+                touch(path, 0644);
+        }
+}
+
+// Every other entry is a symlink, half of them dangling.
+static void
+gen_links(const char *dir,
+          size_t      n)
+{
+        char path[PATH_MAX];
+        char target[64];
+
+        for (size_t i = 0; i < n; ++i) {
+                if (i % 2 == 0) {
+                        snprintf(path, sizeof(path), "%s/file%07zu", dir, i);
+                        touch(path, 0644);
+                } else {
+                        snprintf(path, sizeof(path), "%s/link%07zu", dir, i);
+                        snprintf(target, sizeof(target), "%s%07zu", i % 4 == 1 ? "file" : "gone", i-1);
+                        if (symlink(target, path) != 0 && errno != EEXIST) {
+                                perror(path);
+                                exit(1);
+                        }
+                }
+        }
+}
+
+#define DEEP_ENTRIES 1000
+
+// A chain of `depth` directories, the last one holds the entries. The
+// listing is of the last one. Only opening it, once per tree, walks
+// the whole path. Entries are looked up relative to it, so no phase
+// should take longer than in a flat directory of DEEP_ENTRIES. A gap
+// means a path walk per entry came back.
+static void
+deep_path(char       *path,
+          size_t      sz,
+          const char *dir,
+          size_t      depth)
+{
+        size_t len = snprintf(path, sz, "%s", dir);
+        for (size_t i = 0; i < depth && len < sz; ++i) {
+                len += snprintf(path + len, sz - len, "/level%03zu", i);
+        }
+}
+
+static void
+gen_deep(const char *dir,
+         size_t      depth)
+{
+        char path[PATH_MAX + 32];
+        char bottom[PATH_MAX];
+
+        for (size_t d = 1; d <= depth; ++d) {
+                deep_path(path, sizeof(path), dir, d);
+                mkdir_or_die(path);
+        }
+
+        deep_path(bottom, sizeof(bottom), dir, depth);
+        for (size_t i = 0; i < DEEP_ENTRIES; ++i) {
+                snprintf(path, sizeof(path), "%s/file%07zu.txt", bottom, i);
+                touch(path, 0644);
+        }
+}
+
+typedef void (*gen_fn)(const char *dir, size_t n);
+
+// The tree of `shape` with parameter `n` in `root`, generated unless a
+// previous run left it there.
+static void
+tree(char       *dir,
+     size_t      sz,
+     const char *root,
+     const char *shape,
+     gen_fn      gen,
+     size_t      n)
+{
+        char done[PATH_MAX];
+
+        snprintf(dir, sz, "%s/%s-%zu", root, shape, n);
+        snprintf(done, sizeof(done), "%s.done", dir);
+
+        if (access(done, F_OK) == 0) return;
+
+        double t0 = now_sec();
+        mkdir_or_die(dir);
+        gen(dir, n);
+        touch(done, 0644);
+        fprintf(stderr, "generated %s in %.1f s\n", dir, now_sec() - t0);
+}
+
+static int
+rm_entry(const char        *path,
+         const struct stat *st,
+         int                flag,
+         struct FTW        *ftw)
+{
+        (void)st, (void)flag, (void)ftw;
+        return remove(path);
+}
+
+/////////////////////////////////////////
+// Phases
+
+static size_t
+count(char **names)
+{
+        size_t n = 0;
+        while (names[n]) ++n;
+        return n;
+}
+
+static void
+bench_dir(const char *shape,
+          size_t      param,
+          const char *dir)
+{
+        FE_array fes   = dyn_array_empty(FE_array);
+        double  *secs[PHASE_COUNT];
+        size_t   n     = 0;
+        size_t   runs  = 0;
+        size_t   found = 0;
+        double   t0;
+        int      dirfd = open(dir, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+
+        // One run to learn the size.
+        char **names = dirfd == -1 ? NULL : listing_scan(dirfd);
+        if (!names) {
+                fprintf(stderr, "could not list %s\n", dir);
+                exit(1);
+        }
+        n = count(names);
+        for (size_t i = 0; i < n; ++i) free(names[i]);
+        free(names);
+
+        runs = BENCH_ENTRIES_PER_PHASE / n;
+        if (runs < BENCH_MIN_RUNS) runs = BENCH_MIN_RUNS;
+        if (runs > BENCH_MAX_RUNS) runs = BENCH_MAX_RUNS;
+
+        for (size_t p = 0; p < PHASE_COUNT; ++p) {
+                secs[p] = (double *)malloc(sizeof(double) * runs);
+        }
+
+        for (size_t r = 0; r < runs; ++r) {
+                t0 = now_sec();
+                names = listing_scan(dirfd);
+                secs[PHASE_SCAN][r] = now_sec() - t0;
+
+                t0 = now_sec();
+                listing_sort(names, n);
+                secs[PHASE_SORT][r] = now_sec() - t0;
+
+                t0 = now_sec();
+                listing_stat(&fes, dirfd, names, n);
+                secs[PHASE_STAT][r] = now_sec() - t0;
+                free(names);
+
+                t0 = now_sec();
+                listing_owners(&fes);
+                secs[PHASE_OWNER][r] = now_sec() - t0;
+
+                t0 = now_sec();
+                for (size_t i = 0; i < fes.len; ++i) {
+                        (void)listing_row(g_null, dirfd, dir, fes.data[i], i == 0, 0, 0);
+                        fputc('\n', g_null);
+                }
+                fflush(g_null);
+                secs[PHASE_FORMAT][r] = now_sec() - t0;
+
+                t0 = now_sec();
+                found += listing_search(&fes, 0, BENCH_QUERY, 0) != 0;
+                secs[PHASE_SEARCH][r] = now_sec() - t0;
+
+                listing_free(&fes);
+
+                t0 = now_sec();
+                if (!listing_read(&fes, dirfd)) {
+                        fprintf(stderr, "could not list %s\n", dir);
+                        exit(1);
+                }
+                for (size_t i = 0; i < fes.len && i < BENCH_ROWS; ++i) {
+                        (void)listing_row(g_null, dirfd, dir, fes.data[i], i == 0, 0, 0);
+                        fputc('\n', g_null);
+                }
+                fflush(g_null);
+                secs[PHASE_FRAME][r] = now_sec() - t0;
+
+                listing_free(&fes);
+        }
+
+        if (found) {
+                fprintf(stderr, "%s: query %s matched\n", dir, BENCH_QUERY);
+                exit(1);
+        }
+
+        long rss = maxrss_kb();
+        for (size_t p = 0; p < PHASE_COUNT; ++p) {
+                report(shape, param, n, g_phases[p], secs[p], runs, rss);
+                free(secs[p]);
+        }
+
+        dyn_array_free(fes);
+        close(dirfd);
+}
+
+int
+main(int argc, char **argv)
+{
+        static const size_t flat[]  = {10000, 100000, 1000000};
+        static const size_t deep[]  = {16, 256};
+        const char         *env     = getenv("IE_BENCH_DIR");
+        const char         *max_env = getenv("IE_BENCH_MAX");
+        size_t              max     = max_env ? strtoul(max_env, NULL, 10) : (size_t)-1;
+        const char         *tmpdir  = getenv("TMPDIR");
+        const char         *root    = env;
+        char                tmpl[PATH_MAX];
+        char                dir[PATH_MAX];
+
+        if (!root) {
+                snprintf(tmpl, sizeof(tmpl), "%s/ie-bench.XXXXXX", tmpdir && *tmpdir ? tmpdir : "/tmp");
+                if (!(root = mkdtemp(tmpl))) {
+                        perror("mkdtemp");
+                        return 1;
+                }
+        } else {
+                mkdir_or_die(root);
+        }
+
+        if (!(g_null = fopen("/dev/null", "w"))) {
+                perror("/dev/null");
+                return 1;
+        }
+
+        for (size_t i = 0; i < sizeof(flat)/sizeof(*flat); ++i) {
+                if (flat[i] > max) break;
+                tree(dir, sizeof(dir), root, "flat", gen_flat, flat[i]);
+                bench_dir("flat", flat[i], dir);
+        }
+
+        tree(dir, sizeof(dir), root, "long", gen_long, 10000);
+        bench_dir("long", 10000, dir);
+
+        tree(dir, sizeof(dir), root, "links", gen_links, 10000);
+        bench_dir("links", 10000, dir);
+
+        for (size_t i = 0; i < sizeof(deep)/sizeof(*deep); ++i) {
+                char bottom[PATH_MAX];
+                tree(dir, sizeof(dir), root, "deep", gen_deep, deep[i]);
+                deep_path(bottom, sizeof(bottom), dir, deep[i]);
+                bench_dir("deep", deep[i], bottom);
+        }
+
+        fclose(g_null);
+
+        if (!env) (void)nftw(root, rm_entry, 64, FTW_DEPTH|FTW_PHYS);
+
+        if (argc > 1 && !write_json(argv[1])) return 1;
+
+        return 0;
+}
@@ -0,0 +1,126 @@
+#ifndef LISTING_H_INCLUDED
+#define LISTING_H_INCLUDED
+
+#include <forge/array.h>
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+/**
+ * The listing of a directory as display() shows it. Every step of
+ * producing it is a separate function so that the benchmark can time
+ * them one by one against the same code the UI runs:
+ *
+ *   names = listing_scan(dirfd)         // readdir, "." and ".." included
+ *   listing_sort(names, n)              // "." and ".." first, then by name
+ *   listing_stat(&fes, dirfd, names, n) // one FE per name, takes the names
+ *   listing_owners(&fes)                // user and group names
+ *
+ * The directory is an open fd and entries are looked up relative to it,
+ * so a listing is of the directory the caller holds even if its path
+ * has been renamed or replaced since.
+ *
+ * listing_read() does all of them, listing_read_bg() too but it can be
+ * cancelled from another thread. Rows are written to any FILE, the UI
+ * passes stdout. User and group names are looked up once per id and
+ * shared by every entry.
+ *
+ * listing_export() is the listing without a terminal, for `ie --list`.
+ * It reads the directory by itself and writes a record per entry.
+ * Unsorted records are written while the directory is still being read.
+ */
+
+typedef struct {
+        char        *name;
+        struct stat  st;
+        const char  *owner; // from listing_user(), not owned
+        const char  *group; // from listing_group(), not owned
+        int          stat_failed; // the errno in listing_export()
+} FE;
+
+DYN_ARRAY_TYPE(FE *, FE_array);
+
+void        mode_string(mode_t mode, char buf[11]);
+const char *listing_user(uid_t uid);
+const char *listing_group(gid_t gid);
+const char *human_size(off_t size);
+const char *format_time(time_t mtime);
+
+char  **listing_scan(int dirfd);
+void    listing_sort(char **names, size_t n);
+void    listing_stat(FE_array *fes, int dirfd, char **names, size_t n);
+void    listing_owners(FE_array *fes);
+
+// Appends the entries of `dirfd` to `fes`. Returns 0 if it cannot be
+// read.
+int     listing_read(FE_array *fes, int dirfd);
+void    listing_free(FE_array *fes);
+
+// As listing_read() of the directory at the path `dir`, for reading in
+// the background. Gives up and returns 0 with `fes` empty once `*gen`
+// is not `want` anymore, or if the listing would take more than
+// `budget` bytes.
+int     listing_read_bg(FE_array          *fes,
+                        const char        *dir,
+                        const atomic_uint *gen,
+                        unsigned           want,
+                        size_t             budget);
+
+// The memory taken by the entries of `fes`, as listing_read_bg()
+// counts it.
+size_t  listing_bytes(const FE_array *fes);
+
+// The index of `name` in a listing from listing_read(), or `fes->len`.
+size_t  listing_index(const FE_array *fes, const char *name);
+
+// Writes the row of `e` in `dirfd`, without the newline. `dir` is the
+// absolute path of `dirfd`, for the ghost path. Returns whether the row
+// counts as a directory in the status line.
+int     listing_row(FILE       *out,
+                    int         dirfd,
+                    const char *dir,
+                    const FE   *e,
+                    int         selected,
+                    int         marked,
+                    int         ghost);
+
+// The next entry after `from` (before it if `rev`) whose name matches
+// the regex `query`, or `from` if there is none. "." is never a match.
+size_t  listing_search(const FE_array *fes,
+                       size_t          from,
+                       const char     *query,
+                       int             rev);
+
+enum {
+        LISTING_SORT_NONE,  // in the order of the directory
+        LISTING_SORT_NAME,
+        LISTING_SORT_SIZE,  // largest first
+        LISTING_SORT_MTIME, // newest first
+};
+
+enum {
+        LISTING_FORMAT_TSV,  // mode nlink owner group size mtime name target
+        LISTING_FORMAT_JSON, // an object per line
+        LISTING_FORMAT_NUL,  // names only, each followed by a NUL byte
+};
+
+typedef struct {
+        int         sort;
+        int         reverse; // not with LISTING_SORT_NONE, which is streamed
+        int         format;
+        mode_t      type;  // S_IFMT bits of the entries to keep, 0 for all
+        const char *match; // extended regex on the name, NULL for all
+} listing_export_opts;
+
+// Writes a record for every entry of `dir` but "." and ".." to `out`.
+// Returns 0 and sets errno if `dir` cannot be read or `out` cannot be
+// written.
+int     listing_export(FILE                      *out,
+                       const char                *dir,
+                       const listing_export_opts *opts);
+
+#endif // LISTING_H_INCLUDED
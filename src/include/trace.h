@@ -0,0 +1,77 @@
+#ifndef TRACE_H_INCLUDED
+#define TRACE_H_INCLUDED
+
+#include <stdint.h>
+
+/**
+ * Timers around the phases of a frame and around file operations.
+ *
+ * Nothing is measured unless g_trace is set, TRACE_BEGIN() is a load
+ * and a branch then and TRACE_END() a branch. With TRACE_HUD the spans
+ * of the UI thread are summed per frame for the HUD line. With
+ * TRACE_FILE every span is also appended to a Chrome trace, the JSON
+ * array format that chrome://tracing and ui.perfetto.dev open.
+ *
+ * The kernel has no cheap per-process syscall counter, so the count of
+ * a frame is of the file system calls ie makes itself: directory
+ * reads, lstat, readlink, realpath, user and group lookups and file
+ * operations.
+ */
+
+enum {
+        TRACE_HUD  = 1 << 0,
+        TRACE_FILE = 1 << 1,
+};
+
+typedef enum {
+        TRACE_FRAME,
+        TRACE_SCAN,
+        TRACE_SORT,
+        TRACE_STAT,
+        TRACE_OWNER,
+        TRACE_RENDER,
+        TRACE_FILEOP,
+        TRACE_RELOAD,
+        TRACE_PHASES,
+} trace_phase;
+
+typedef struct {
+        uint64_t ns[TRACE_PHASES];
+        uint64_t syscalls;
+        uint64_t latency_ns; // from reading a key to the end of the frame, 0 without one
+} trace_frame;
+
+extern int         g_trace;
+extern trace_frame g_trace_last; // the last finished frame
+
+extern const char *g_trace_phases[TRACE_PHASES];
+
+#define TRACE_BEGIN()                   (g_trace ? trace_now() : 0)
+#define TRACE_END(phase, t0)            do { if (t0) trace_span((phase), NULL, NULL, (t0)); } while (0)
+#define TRACE_END_OP(name, arg, t0)     do { if (t0) trace_span(TRACE_FILEOP, (name), (arg), (t0)); } while (0)
+#define TRACE_SYSCALLS(n)               do { if (g_trace) trace_syscalls(n); } while (0)
+
+// Never 0, so that a started span can be told from a disabled one.
+uint64_t trace_now(void);
+
+// A span of `phase` from `t0` to now. `name` defaults to the name of
+// the phase, `arg` is shown with it in the trace.
+void     trace_span(trace_phase phase, const char *name, const char *arg, uint64_t t0);
+void     trace_syscalls(uint64_t n);
+
+// The calling thread is the UI thread, its spans make up the frames.
+void     trace_init(void);
+
+// Writes spans to `path` from now on. Returns 0 if it cannot be opened.
+int      trace_open(const char *path);
+void     trace_close(void);
+
+void     trace_hud(int on);
+
+// A key was read, the end of the next frame is its latency.
+void     trace_key(void);
+
+// Ends the frame that started at `t0` and makes it g_trace_last.
+void     trace_frame_end(uint64_t t0);
+
+#endif // TRACE_H_INCLUDED
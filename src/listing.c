@@ -0,0 +1,723 @@
+#include "listing.h"
+#include "trace.h"
+
+#include <forge/colors.h>
+#include <forge/io.h>
+#include <forge/utils.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <regex.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pwd.h>
+#include <grp.h>
+
+// Names of user and group ids. The entries of a directory are mostly
+// owned by a handful of ids, so the passwd and group databases are
+// asked once per id instead of once per entry. Names are never freed.
+// The prefetcher reads listings too, so the caches are locked.
+typedef struct {
+        unsigned  id;
+        char     *name; // NULL if the slot is free
+} owner_slot;
+
+typedef struct {
+        owner_slot *slots;
+        size_t      cap; // a power of two
+        size_t      len;
+} owner_cache;
+
+static owner_cache     g_users     = {0};
+static owner_cache     g_groups    = {0};
+static pthread_mutex_t g_owners_mu = PTHREAD_MUTEX_INITIALIZER;
+
+void
+mode_string(mode_t mode, char buf[11])
+{
+        strcpy(buf, "----------");
+
+        if (S_ISDIR(mode))  buf[0] = 'd';
+        else if (S_ISLNK(mode)) buf[0] = 'l';
+        else if (S_ISBLK(mode)) buf[0] = 'b';
+        else if (S_ISCHR(mode)) buf[0] = 'c';
+        else if (S_ISFIFO(mode)) buf[0] = 'p';
+        else if (S_ISSOCK(mode)) buf[0] = 's';
+
+        if (mode & S_IRUSR) buf[1] = 'r';
+        if (mode & S_IWUSR) buf[2] = 'w';
+        if (mode & S_IXUSR) buf[3] = 'x';
+        if (mode & S_IRGRP) buf[4] = 'r';
+        if (mode & S_IWGRP) buf[5] = 'w';
+        if (mode & S_IXGRP) buf[6] = 'x';
+        if (mode & S_IROTH) buf[7] = 'r';
+        if (mode & S_IWOTH) buf[8] = 'w';
+        if (mode & S_IXOTH) buf[9] = 'x';
+
+        // Sticky bit, setuid, setgid
+        if (mode & S_ISUID) buf[3] = (mode & S_IXUSR) ? 's' : 'S';
+        if (mode & S_ISGID) buf[6] = (mode & S_IXGRP) ? 's' : 'S';
+        if (mode & S_ISVTX) buf[9] = (mode & S_IXOTH) ? 't' : 'T';
+}
+
+const char *
+human_size(off_t size)
+{
+        static char buf[32];
+        if (size < 1024) snprintf(buf, sizeof(buf), "%4ld ", (long)size);
+        else if (size < 1024*1024) snprintf(buf, sizeof(buf), "%4ldK", (long)(size/1024));
+        else if (size < 1024LL*1024*1024) snprintf(buf, sizeof(buf), "%4ldM", (long)(size/(1024*1024)));
+        else snprintf(buf, sizeof(buf), "%4ldG", (long)(size/(1024*1024*1024)));
+        return buf;
+}
+
+const char *
+format_time(time_t mtime)
+{
+        static char buf[32];
+        struct tm *tm = localtime(&mtime);
+        if (!tm) return "?\?\?\?-?\?-?\? ?\?:?\?";
+        // Show year if older than 6 months, otherwise show time
+        time_t now = time(NULL);
+        if (now - mtime > 180*24*3600 || now < mtime) {
+                strftime(buf, sizeof(buf), "%b %d  %Y", tm);
+        } else {
+                strftime(buf, sizeof(buf), "%b %d %H:%M", tm);
+        }
+        return buf;
+}
+
+static owner_slot *
+owner_find(owner_cache *c,
+           unsigned     id)
+{
+        size_t i = (id * 2654435761u) & (c->cap - 1);
+        while (c->slots[i].name && c->slots[i].id != id) {
+                i = (i + 1) & (c->cap - 1);
+        }
+        return &c->slots[i];
+}
+
+static void
+owner_grow(owner_cache *c)
+{
+        owner_cache old = *c;
+
+        c->cap   = old.cap ? old.cap * 2 : 16;
+        c->slots = (owner_slot *)calloc(c->cap, sizeof(owner_slot));
+
+        for (size_t i = 0; i < old.cap; ++i) {
+                if (old.slots[i].name) *owner_find(c, old.slots[i].id) = old.slots[i];
+        }
+        free(old.slots);
+}
+
+static const char *
+owner_get(owner_cache *c,
+          unsigned     id,
+          int          group)
+{
+        pthread_mutex_lock(&g_owners_mu);
+
+        if ((c->len + 1) * 2 > c->cap) owner_grow(c);
+
+        owner_slot *slot = owner_find(c, id);
+        if (slot->name) {
+                const char *name = slot->name;
+                pthread_mutex_unlock(&g_owners_mu);
+                return name;
+        }
+
+        const char *name = NULL;
+        TRACE_SYSCALLS(1);
+        if (group) {
+                struct group *gr = getgrgid((gid_t)id);
+                if (gr) name = gr->gr_name;
+        } else {
+                struct passwd *pw = getpwuid((uid_t)id);
+                if (pw) name = pw->pw_name;
+        }
+
+        slot->id   = id;
+        slot->name = strdup(name ? name : "?");
+        ++c->len;
+        name = slot->name;
+
+        pthread_mutex_unlock(&g_owners_mu);
+
+        return name;
+}
+
+const char *
+listing_user(uid_t uid)
+{
+        return owner_get(&g_users, (unsigned)uid, /*group=*/0);
+}
+
+const char *
+listing_group(gid_t gid)
+{
+        return owner_get(&g_groups, (unsigned)gid, /*group=*/1);
+}
+
+static int
+is_like_compar(const void *a,
+               const void *b)
+{
+        const char *const *pa = a;
+        const char *const *pb = b;
+        const char *na = *pa;
+        const char *nb = *pb;
+
+        if (strcmp(na, ".") == 0)  return -1;
+        if (strcmp(nb, ".") == 0)  return  1;
+
+        if (strcmp(na, "..") == 0) return -1;
+        if (strcmp(nb, "..") == 0) return  1;
+
+        return strcmp(na, nb);
+}
+
+char **
+listing_scan(int dirfd)
+{
+        uint64_t       t0    = TRACE_BEGIN();
+        int            fd    = openat(dirfd, ".", O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+        DIR           *d     = fd == -1 ? NULL : fdopendir(fd);
+        char         **names = NULL;
+        size_t         n     = 0;
+        size_t         cap   = 0;
+        struct dirent *ent;
+
+        if (!d) {
+                if (fd != -1) close(fd);
+                return NULL;
+        }
+
+        while ((ent = readdir(d))) {
+                if (n+1 >= cap) {
+                        cap   = cap ? cap*2 : 64;
+                        names = (char **)realloc(names, sizeof(*names) * cap);
+                }
+                names[n++] = strdup(ent->d_name);
+        }
+        closedir(d);
+
+        if (!names) names = (char **)malloc(sizeof(*names));
+        names[n] = NULL;
+
+        TRACE_SYSCALLS(1);
+        TRACE_END(TRACE_SCAN, t0);
+
+        return names;
+}
+
+void
+listing_sort(char   **names,
+             size_t   n)
+{
+        uint64_t t0 = TRACE_BEGIN();
+        qsort(names, n, sizeof(*names), is_like_compar);
+        TRACE_END(TRACE_SORT, t0);
+}
+
+void
+listing_stat(FE_array  *fes,
+             int        dirfd,
+             char     **names,
+             size_t     n)
+{
+        uint64_t t0 = TRACE_BEGIN();
+
+        for (size_t i = 0; i < n; ++i) {
+                FE *fe = (FE *)malloc(sizeof(FE));
+                fe->name  = names[i];
+                fe->owner = NULL;
+                fe->group = NULL;
+
+                fe->stat_failed = fstatat(dirfd, names[i], &fe->st, AT_SYMLINK_NOFOLLOW) == -1;
+                if (fe->stat_failed) memset(&fe->st, 0, sizeof(fe->st));
+
+                dyn_array_append(*fes, fe);
+        }
+
+        TRACE_SYSCALLS(n);
+        TRACE_END(TRACE_STAT, t0);
+}
+
+void
+listing_owners(FE_array *fes)
+{
+        uint64_t t0 = TRACE_BEGIN();
+
+        for (size_t i = 0; i < fes->len; ++i) {
+                FE *fe = fes->data[i];
+
+                if (fe->owner) continue;
+
+                if (!fe->stat_failed) {
+                        fe->owner = listing_user(fe->st.st_uid);
+                        fe->group = listing_group(fe->st.st_gid);
+                } else {
+                        fe->owner = "?";
+                        fe->group = "?";
+                }
+        }
+
+        TRACE_END(TRACE_OWNER, t0);
+}
+
+int
+listing_read(FE_array *fes,
+             int       dirfd)
+{
+        char **names = listing_scan(dirfd);
+        if (!names) return 0;
+
+        size_t n = 0;
+        while (names[n]) ++n;
+
+        listing_sort(names, n);
+        listing_stat(fes, dirfd, names, n);
+        listing_owners(fes);
+
+        // The names now belong to the entries.
+        free(names);
+
+        return 1;
+}
+
+#define LISTING_BG_CHUNK 512
+
+int
+listing_read_bg(FE_array          *fes,
+                const char        *dir,
+                const atomic_uint *gen,
+                unsigned           want,
+                size_t             budget)
+{
+        int dirfd = open(dir, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+        if (dirfd == -1) return 0;
+
+        char **names = listing_scan(dirfd);
+        if (!names) {
+                close(dirfd);
+                return 0;
+        }
+
+        size_t n     = 0;
+        size_t bytes = 0;
+        for (; names[n]; ++n) bytes += sizeof(FE) + sizeof(FE *) + strlen(names[n]) + 1;
+
+        size_t done = 0;
+        if (bytes > budget || atomic_load(gen) != want) goto cancel;
+
+        listing_sort(names, n);
+
+        // lstat() is most of the time, give up between chunks of it.
+        while (done < n) {
+                size_t k = n - done < LISTING_BG_CHUNK ? n - done : LISTING_BG_CHUNK;
+                listing_stat(fes, dirfd, names + done, k);
+                done += k;
+                if (done < n && atomic_load(gen) != want) goto cancel;
+        }
+
+        listing_owners(fes);
+        free(names);
+        close(dirfd);
+
+        return 1;
+
+ cancel:
+        for (size_t i = done; i < n; ++i) free(names[i]);
+        free(names);
+        close(dirfd);
+        listing_free(fes);
+        return 0;
+}
+
+size_t
+listing_bytes(const FE_array *fes)
+{
+        size_t bytes = 0;
+        for (size_t i = 0; i < fes->len; ++i) {
+                bytes += sizeof(FE) + sizeof(FE *) + strlen(fes->data[i]->name) + 1;
+        }
+        return bytes;
+}
+
+size_t
+listing_index(const FE_array *fes,
+              const char     *name)
+{
+        size_t lo = 0;
+        size_t hi = fes->len;
+
+        while (lo < hi) {
+                size_t      mid = lo + (hi - lo) / 2;
+                const char *cur = fes->data[mid]->name;
+
+                if (!strcmp(cur, name)) return mid;
+                if (is_like_compar(&cur, &name) < 0) lo = mid + 1;
+                else                                 hi = mid;
+        }
+
+        return fes->len;
+}
+
+void
+listing_free(FE_array *fes)
+{
+        for (size_t i = 0; i < fes->len; ++i) {
+                free(fes->data[i]->name);
+                free(fes->data[i]);
+        }
+        dyn_array_clear(*fes);
+}
+
+int
+listing_row(FILE       *out,
+            int         dirfd,
+            const char *dir,
+            const FE   *e,
+            int         selected,
+            int         marked,
+            int         ghost)
+{
+        int is_dir  = !e->stat_failed && S_ISDIR(e->st.st_mode);
+        int counted = 0;
+
+        if (!strcmp(e->name, "..") || !strcmp(e->name, ".")) {
+                fputs(GRAY, out);
+                counted = 1;
+        }
+        else if (is_dir) {
+                fputs(BOLD CYAN, out);
+                counted = 1;
+        } else if (!e->stat_failed && (e->st.st_mode & (S_IXUSR|S_IXGRP|S_IXOTH))) {
+                fputs(GREEN, out);  // executable
+        } else {
+                fputs(WHITE, out);
+        }
+
+        if (selected) fputs(INVERT, out);
+        if (marked)   fputs(PINK "<M> ", out);
+
+        char modebuf[11] = "??????????";
+        if (!e->stat_failed) mode_string(e->st.st_mode, modebuf);
+
+        const char *size_str = e->stat_failed ? "     ? " : human_size(e->st.st_size);
+        const char *time_str = e->stat_failed ? "?????????????" : format_time(e->st.st_mtime);
+
+        fprintf(out, "%s %3ld %-8s %-8s %s %s %s",
+                modebuf,
+                e->stat_failed ? 0L : (long)e->st.st_nlink,
+                e->owner ? e->owner : "?",
+                e->group ? e->group : "?",
+                size_str,
+                time_str,
+                e->name);
+
+        // Symlink target
+        if (!e->stat_failed && S_ISLNK(e->st.st_mode)) {
+                char target[PATH_MAX];
+                ssize_t len = readlinkat(dirfd, e->name, target, sizeof(target)-1);
+                TRACE_SYSCALLS(1);
+                if (len != -1) {
+                        target[len] = '\0';
+                        fprintf(out, " -> " CYAN "%s" RESET, target);
+                }
+        }
+
+        // Show ghosted full path on selected line
+        if (selected && ghost) {
+                fprintf(out, RESET "  " ITALIC GRAY "%s%s%s" RESET, dir, strcmp(dir, "/") ? "/" : "", e->name);
+        }
+
+        return counted;
+}
+
+size_t
+listing_search(const FE_array *fes,
+               size_t          from,
+               const char     *query,
+               int             rev)
+{
+        if (!rev) {
+                for (size_t i = from+1; i < fes->len; ++i) {
+                        if (forge_utils_regex(query, fes->data[i]->name)) return i;
+                }
+        } else {
+                for (size_t i = from; i-- > 1;) {
+                        if (forge_utils_regex(query, fes->data[i]->name)) return i;
+                }
+        }
+        return from;
+}
+
+/////////////////////////////////////////
+// Export
+
+static void
+put_int(FILE      *out,
+        long long  v)
+{
+        char               buf[24];
+        char              *p = buf + sizeof(buf);
+        unsigned long long u = v < 0 ? -(unsigned long long)v : (unsigned long long)v;
+
+        do *--p = '0' + u % 10; while (u /= 10);
+        if (v < 0) *--p = '-';
+        fwrite(p, 1, buf + sizeof(buf) - p, out);
+}
+
+// Tabs, newlines and backslashes would break the columns.
+static void
+put_tsv(FILE       *out,
+        const char *s)
+{
+        for (; *s; ++s) {
+                switch (*s) {
+                case '\t': fputs("\\t", out);  break;
+                case '\n': fputs("\\n", out);  break;
+                case '\\': fputs("\\\\", out); break;
+                default:   putc_unlocked(*s, out);
+                }
+        }
+}
+
+// Names are bytes, anything that is not a control character is
+// written as it is.
+static void
+put_json(FILE       *out,
+         const char *s)
+{
+        static const char hex[] = "0123456789abcdef";
+
+        putc_unlocked('"', out);
+        for (; *s; ++s) {
+                unsigned char c = (unsigned char)*s;
+                if (c == '"' || c == '\\') {
+                        putc_unlocked('\\', out);
+                        putc_unlocked(c, out);
+                } else if (c == '\n') {
+                        fputs("\\n", out);
+                } else if (c == '\t') {
+                        fputs("\\t", out);
+                } else if (c < 0x20) {
+                        fputs("\\u00", out);
+                        putc_unlocked(hex[c >> 4], out);
+                        putc_unlocked(hex[c & 0xf], out);
+                } else {
+                        putc_unlocked(c, out);
+                }
+        }
+        putc_unlocked('"', out);
+}
+
+static const char *
+type_name(mode_t mode)
+{
+        switch (mode & S_IFMT) {
+        case S_IFREG:  return "file";
+        case S_IFDIR:  return "dir";
+        case S_IFLNK:  return "link";
+        case S_IFBLK:  return "block";
+        case S_IFCHR:  return "char";
+        case S_IFIFO:  return "fifo";
+        case S_IFSOCK: return "socket";
+        default:       return "unknown";
+        }
+}
+
+static void
+export_record(FILE     *out,
+              int       dfd,
+              const FE *e,
+              int       format)
+{
+        char    modebuf[11];
+        char    target[PATH_MAX];
+        ssize_t target_n = -1;
+
+        if (format == LISTING_FORMAT_NUL) {
+                fputs(e->name, out);
+                putc_unlocked('\0', out);
+                return;
+        }
+
+        if (!e->stat_failed) {
+                mode_string(e->st.st_mode, modebuf);
+                if (S_ISLNK(e->st.st_mode)) {
+                        target_n = readlinkat(dfd, e->name, target, sizeof(target)-1);
+                        if (target_n != -1) target[target_n] = '\0';
+                }
+        }
+
+        if (format == LISTING_FORMAT_TSV) {
+                if (e->stat_failed) {
+                        fputs("??????????\t?\t?\t?\t?\t?\t", out);
+                } else {
+                        fputs(modebuf, out), putc_unlocked('\t', out);
+                        put_int(out, e->st.st_nlink), putc_unlocked('\t', out);
+                        fputs(listing_user(e->st.st_uid), out), putc_unlocked('\t', out);
+                        fputs(listing_group(e->st.st_gid), out), putc_unlocked('\t', out);
+                        put_int(out, e->st.st_size), putc_unlocked('\t', out);
+                        put_int(out, e->st.st_mtime), putc_unlocked('\t', out);
+                }
+                put_tsv(out, e->name);
+                putc_unlocked('\t', out);
+                if (target_n != -1) put_tsv(out, target);
+                putc_unlocked('\n', out);
+                return;
+        }
+
+        fputs("{\"name\":", out);
+        put_json(out, e->name);
+        if (e->stat_failed) {
+                fputs(",\"error\":", out);
+                put_json(out, strerror(e->stat_failed));
+                fputs("}\n", out);
+                return;
+        }
+        fputs(",\"type\":\"", out), fputs(type_name(e->st.st_mode), out);
+        fputs("\",\"mode\":\"", out), fputs(modebuf, out);
+        fputs("\",\"nlink\":", out), put_int(out, e->st.st_nlink);
+        fputs(",\"uid\":", out), put_int(out, e->st.st_uid);
+        fputs(",\"gid\":", out), put_int(out, e->st.st_gid);
+        fputs(",\"owner\":", out), put_json(out, listing_user(e->st.st_uid));
+        fputs(",\"group\":", out), put_json(out, listing_group(e->st.st_gid));
+        fputs(",\"size\":", out), put_int(out, e->st.st_size);
+        fputs(",\"mtime\":", out), put_int(out, e->st.st_mtime);
+        if (target_n != -1) {
+                fputs(",\"target\":", out);
+                put_json(out, target);
+        }
+        fputs("}\n", out);
+}
+
+static int
+export_by_name(const void *a,
+               const void *b)
+{
+        return strcmp((*(const FE *const *)a)->name, (*(const FE *const *)b)->name);
+}
+
+static int
+export_by_size(const void *a,
+               const void *b)
+{
+        const FE *x = *(const FE *const *)a;
+        const FE *y = *(const FE *const *)b;
+
+        if (x->st.st_size != y->st.st_size) return x->st.st_size < y->st.st_size ? 1 : -1;
+        return strcmp(x->name, y->name);
+}
+
+static int
+export_by_mtime(const void *a,
+                const void *b)
+{
+        const FE *x = *(const FE *const *)a;
+        const FE *y = *(const FE *const *)b;
+
+        if (x->st.st_mtim.tv_sec != y->st.st_mtim.tv_sec) {
+                return x->st.st_mtim.tv_sec < y->st.st_mtim.tv_sec ? 1 : -1;
+        }
+        if (x->st.st_mtim.tv_nsec != y->st.st_mtim.tv_nsec) {
+                return x->st.st_mtim.tv_nsec < y->st.st_mtim.tv_nsec ? 1 : -1;
+        }
+        return strcmp(x->name, y->name);
+}
+
+// Names only need a stat() if something is shown or sorted by it, or
+// to filter by type when readdir() does not know the type.
+int
+listing_export(FILE                      *out,
+               const char                *dir,
+               const listing_export_opts *opts)
+{
+        FE_array       fes       = dyn_array_empty(FE_array);
+        int            need_stat = opts->format != LISTING_FORMAT_NUL
+                                   || opts->sort == LISTING_SORT_SIZE
+                                   || opts->sort == LISTING_SORT_MTIME;
+        int            ok        = 1;
+        regex_t        re;
+        int            dfd;
+        DIR           *d;
+        struct dirent *ent;
+
+        if (opts->match && regcomp(&re, opts->match, REG_EXTENDED|REG_NOSUB) != 0) {
+                errno = EINVAL;
+                return 0;
+        }
+
+        if ((dfd = open(dir, O_RDONLY|O_DIRECTORY|O_CLOEXEC)) == -1 || !(d = fdopendir(dfd))) {
+                int err = errno;
+                if (dfd != -1) close(dfd);
+                if (opts->match) regfree(&re);
+                errno = err;
+                return 0;
+        }
+
+        flockfile(out);
+
+        while ((ent = readdir(d))) {
+                const char *name = ent->d_name;
+                mode_t      type = ent->d_type != DT_UNKNOWN ? DTTOIF(ent->d_type) : 0;
+                FE          e    = {
+                        .name        = (char *)name,
+                        .owner       = NULL,
+                        .group       = NULL,
+                        .stat_failed = 0,
+                };
+
+                if (name[0] == '.' && (!name[1] || (name[1] == '.' && !name[2]))) continue;
+                if (opts->match && regexec(&re, name, 0, NULL, 0) != 0) continue;
+
+                if (need_stat || (opts->type && !type)) {
+                        e.stat_failed = fstatat(dfd, name, &e.st, AT_SYMLINK_NOFOLLOW) == -1 ? errno : 0;
+                        if (e.stat_failed) memset(&e.st, 0, sizeof(e.st));
+                        else               type = e.st.st_mode & S_IFMT;
+                }
+                if (opts->type && type != opts->type) continue;
+
+                if (opts->sort == LISTING_SORT_NONE) {
+                        export_record(out, dfd, &e, opts->format);
+                        continue;
+                }
+
+                FE *fe = (FE *)malloc(sizeof(FE));
+                *fe = e;
+                fe->name = strdup(name);
+                dyn_array_append(fes, fe);
+        }
+
+        if (opts->sort != LISTING_SORT_NONE) {
+                int (*compar)(const void *, const void *) = opts->sort == LISTING_SORT_SIZE  ? export_by_size
+                                                          : opts->sort == LISTING_SORT_MTIME ? export_by_mtime
+                                                          : export_by_name;
+                qsort(fes.data, fes.len, sizeof(*fes.data), compar);
+
+                for (size_t i = 0; i < fes.len; ++i) {
+                        const FE *e = fes.data[opts->reverse ? fes.len-1-i : i];
+                        export_record(out, dfd, e, opts->format);
+                }
+        }
+
+        if (fflush(out) != 0 || ferror(out)) ok = 0;
+        funlockfile(out);
+
+        int err = errno;
+        listing_free(&fes);
+        dyn_array_free(fes);
+        closedir(d);
+        if (opts->match) regfree(&re);
+        errno = err;
+
+        return ok;
+}
@@ -1,6 +1,9 @@
+#define _GNU_SOURCE
 #define QCL_IMPL
 #include "qcl.h"
 #include "config.h"
+#include "listing.h"
+#include "trace.h"
 
 #include <forge/colors.h>
 #include <forge/ctrl.h>
@@ -30,6 +33,18 @@
 #include <grp.h>
 #include <time.h>
 #include <errno.h>
+#include <signal.h>
+#include <dirent.h>
+#include <poll.h>
+#include <regex.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <spawn.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 
 #define CMD_SEARCH "search"
 #define CMD_HELP   "help"
@@ -52,24 +67,32 @@ static char *g_help_buffer[] = {
         "",
         "File Manipulation:",
         "  C-x C-q,    r              - rename file",
+        "  R                          - rename marked (or all) in $EDITOR",
         "  M                          - move file (or marked)",
         "  d                          - delete file (or marked)",
         "  +           %              - new directory",
         "",
         "Misc:",
         "  \\                          - toggle ghost path",
+        "  T                          - toggle performance HUD",
         "  q                          - quit",
-        "  m                          - mark",
-        "  u                          - unmark",
+        "  m                          - mark (all on .)",
+        "  u                          - unmark (all on .)",
+        "  i                          - invert marks",
+        "  V                          - mark from the last (un)marked file",
         "  C-x b                      - open all instances",
         "  :                          - command",
-        "  !                          - SHELL command",
+        "  !                          - SHELL command, in the background",
+        "  o                          - output of the SHELL command",
+        "  P                          - programs started by ie",
 };
 
 #define CONFIG_FILENAME ".ie-config"
+#define CONFIG_CACHE_DIR "ie"
+#define CONFIG_CACHE_FILENAME "config.cache"
 static char g_config_filepath[1024] = {0};
-
-FORGE_SET_TYPE(size_t, sizet_set)
+static char g_config_cachepath[1024] = {0};
+static const char *g_config_cache = NULL; // NULL if the cache is disabled
 
 struct {
         uint32_t flags;
@@ -78,7 +101,9 @@ struct {
                 size_t w;
                 size_t h;
         } term;
-        qcl_config written_config;
+        qcl_writer writer;
+        size_t     appended;
+        char       reload_err[256]; // last failed reload, shown until the next one
 } g_config = {
         .flags = 0x0000,
         .term = {
@@ -86,20 +111,24 @@ struct {
                 .w = 0,
                 .h = 0,
         },
-        .written_config = {0},
+        .writer = {0},
+        .appended = 0,
+        .reload_err = {0},
 };
 
-typedef struct {
-        char        *name;
-        struct stat  st;
-        char        *owner;
-        char        *group;
-        int          stat_failed;
-} FE;
-
 enum { FT_SHOWGHOST = 1 << 0 };
 
-DYN_ARRAY_TYPE(FE *, FE_array);
+// Marks. A bit per row of the listing, so a row is tested with a load,
+// and marking all, none or a range of rows takes a word per 64 rows.
+// Rows move when the directory changes, context_refresh() carries the
+// marks over to the new rows by the identity of their files.
+typedef struct {
+        uint64_t *bits;
+        size_t    words;
+        size_t    anchor; // the row last marked or unmarked, 0 for none
+} mark_bits;
+
+enum { MARK_SET, MARK_CLEAR, MARK_FLIP };
 
 typedef struct {
         int uid;
@@ -110,9 +139,12 @@ typedef struct {
         struct {
                 size_t i;
                 FE_array fes;
+                struct stat dir; // of filepath when fes was read
         } entries;
-        char *filepath;
-        sizet_set marked;
+        char *filepath; // absolute, resolved once per navigation
+        int dirfd;      // of filepath, file operations are relative to it
+        int stale;      // relist on the next refresh even if mtime is the same
+        mark_bits marked;
         const char *last_query;
         size_t hoffset;
         int_array stack;
@@ -120,7 +152,6 @@ typedef struct {
 
 DYN_ARRAY_TYPE(ie_context *, ie_context_array);
 
-static void rm_file(const char *fp);
 static void display(void);
 
 struct {
@@ -131,10 +162,190 @@ struct {
         .ctxs = dyn_array_empty(ie_context_array),
 };
 
-static unsigned sizet_hash(size_t *i)           { return *i; }
-static int      sizet_cmp(size_t *x, size_t *y) { return *x - *y; }
+// Self-pipe for SIGWINCH. The handler only writes a byte, the
+// display loop drains the pipe and reflows all contexts once, so a
+// burst of resize events collapses into a single redraw.
+static int g_winch_pipe[2] = {-1, -1};
+
+// Time budget for draining queued keystrokes before a frame is
+// rendered. Keeps a flood of input (key repeat, pastes) from starving
+// the renderer while still collapsing held-down keys into one frame.
+#define FRAME_BUDGET_NS (16L*1000*1000)
+
+typedef struct {
+        forge_ctrl_input_type ty;
+        char                  ch;
+} ie_key;
+
+// A key that was read while coalescing a batch but that ended it.
+// It is handled on the next iteration of the display loop.
+struct {
+        int    pending;
+        ie_key key;
+} g_input = {
+        .pending = 0,
+        .key = {0},
+};
+
 static void     minisleep(void)                 { usleep(800000/2); }
 
+// Unmarks everything and makes room for `rows` rows.
+static void
+marks_reset(mark_bits *m,
+            size_t     rows)
+{
+        size_t words = (rows + 63) / 64;
+
+        if (words > m->words) {
+                free(m->bits);
+                m->bits  = (uint64_t *)malloc(words * sizeof(uint64_t));
+                m->words = words;
+        }
+        memset(m->bits, 0, m->words * sizeof(uint64_t));
+        m->anchor = 0;
+}
+
+static int
+marks_test(const mark_bits *m,
+           size_t           i)
+{
+        return (m->bits[i / 64] >> (i % 64)) & 1;
+}
+
+// Applies `op` to the rows in [from, to).
+static void
+marks_range(mark_bits *m,
+            size_t     from,
+            size_t     to,
+            int        op)
+{
+        if (from >= to) return;
+
+        size_t   first = from / 64;
+        size_t   last  = (to - 1) / 64;
+        uint64_t head  = ~0ull << (from % 64);
+        uint64_t tail  = ~0ull >> (63 - (to - 1) % 64);
+
+        for (size_t w = first; w <= last; ++w) {
+                uint64_t mask = ~0ull;
+                if (w == first) mask &= head;
+                if (w == last)  mask &= tail;
+
+                switch (op) {
+                case MARK_SET:   m->bits[w] |= mask;  break;
+                case MARK_CLEAR: m->bits[w] &= ~mask; break;
+                case MARK_FLIP:  m->bits[w] ^= mask;  break;
+                }
+        }
+}
+
+static void
+marks_set(mark_bits *m,
+          size_t     i,
+          int        on)
+{
+        marks_range(m, i, i+1, on ? MARK_SET : MARK_CLEAR);
+}
+
+static size_t
+marks_count(const mark_bits *m)
+{
+        size_t n = 0;
+        for (size_t w = 0; w < m->words; ++w) n += __builtin_popcountll(m->bits[w]);
+        return n;
+}
+
+// The first marked row at or after `i`, or SIZE_MAX.
+static size_t
+marks_next(const mark_bits *m,
+           size_t           i)
+{
+        size_t w = i / 64;
+        if (w >= m->words) return SIZE_MAX;
+
+        uint64_t bits = m->bits[w] & (~0ull << (i % 64));
+        while (!bits) {
+                if (++w == m->words) return SIZE_MAX;
+                bits = m->bits[w];
+        }
+        return w * 64 + __builtin_ctzll(bits);
+}
+
+// What a mark sticks to. Device and inode survive renames, but files
+// with more than one link share them, so those and entries that could
+// not be stat()ed are known by name instead.
+typedef struct {
+        dev_t       dev;
+        ino_t       ino;
+        const char *name; // NULL for device and inode
+} mark_key;
+
+static mark_key
+mark_key_of(const FE *fe)
+{
+        mark_key key = {0};
+
+        if (fe->stat_failed || (!S_ISDIR(fe->st.st_mode) && fe->st.st_nlink > 1)) {
+                key.name = fe->name;
+        } else {
+                key.dev = fe->st.st_dev;
+                key.ino = fe->st.st_ino;
+        }
+        return key;
+}
+
+static int
+mark_key_cmp(const void *a,
+             const void *b)
+{
+        const mark_key *ka = (const mark_key *)a;
+        const mark_key *kb = (const mark_key *)b;
+
+        if (!ka->name != !kb->name) return ka->name ? 1 : -1;
+        if (ka->name)               return strcmp(ka->name, kb->name);
+        if (ka->dev != kb->dev)     return ka->dev < kb->dev ? -1 : 1;
+        if (ka->ino != kb->ino)     return ka->ino < kb->ino ? -1 : 1;
+        return 0;
+}
+
+// The sorted keys of the marked rows of `fes`. The names point into
+// `fes`. Returns NULL if nothing is marked.
+static mark_key *
+marks_keys(const mark_bits *m,
+           const FE_array  *fes,
+           size_t          *n)
+{
+        *n = marks_count(m);
+        if (!*n) return NULL;
+
+        mark_key *keys = (mark_key *)malloc(*n * sizeof(mark_key));
+        size_t    k    = 0;
+        for (size_t i = marks_next(m, 0); i < fes->len; i = marks_next(m, i+1)) {
+                keys[k++] = mark_key_of(fes->data[i]);
+        }
+        *n = k;
+        qsort(keys, k, sizeof(*keys), mark_key_cmp);
+
+        return keys;
+}
+
+// Marks the rows of `fes` whose files have one of the `n` keys. "."
+// and ".." are never marked.
+static void
+marks_remap(mark_bits      *m,
+            const FE_array *fes,
+            const mark_key *keys,
+            size_t          n)
+{
+        marks_reset(m, fes->len);
+        if (!n) return;
+
+        for (size_t i = 2; i < fes->len; ++i) {
+                mark_key key = mark_key_of(fes->data[i]);
+                if (bsearch(&key, keys, n, sizeof(*keys), mark_key_cmp)) marks_set(m, i, 1);
+        }
+}
+
 static ie_context *
 ie_context_alloc(const char *filepath)
 {
@@ -143,8 +354,11 @@ ie_context_alloc(const char *filepath)
         ctx->term.h      = g_config.term.h;
         ctx->entries.i   = 0;
         ctx->entries.fes = dyn_array_empty(FE_array);
+        memset(&ctx->entries.dir, 0, sizeof(ctx->entries.dir));
         ctx->filepath    = strdup(filepath);
-        ctx->marked      = sizet_set_create(sizet_hash, sizet_cmp, NULL);
+        ctx->dirfd       = open(filepath, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+        ctx->stale       = 0;
+        ctx->marked      = (mark_bits){0};
         ctx->last_query  = NULL;
         ctx->hoffset     = 0;
         ctx->stack       = dyn_array_empty(int_array);
@@ -152,70 +366,34 @@ ie_context_alloc(const char *filepath)
         static int uid = 0;
         ctx->uid = uid++;
 
-        return ctx;
-}
-
-static void
-mode_string(mode_t mode, char buf[11])
-{
-        strcpy(buf, "----------");
-
-        if (S_ISDIR(mode))  buf[0] = 'd';
-        else if (S_ISLNK(mode)) buf[0] = 'l';
-        else if (S_ISBLK(mode)) buf[0] = 'b';
-        else if (S_ISCHR(mode)) buf[0] = 'c';
-        else if (S_ISFIFO(mode)) buf[0] = 'p';
-        else if (S_ISSOCK(mode)) buf[0] = 's';
-
-        if (mode & S_IRUSR) buf[1] = 'r';
-        if (mode & S_IWUSR) buf[2] = 'w';
-        if (mode & S_IXUSR) buf[3] = 'x';
-        if (mode & S_IRGRP) buf[4] = 'r';
-        if (mode & S_IWGRP) buf[5] = 'w';
-        if (mode & S_IXGRP) buf[6] = 'x';
-        if (mode & S_IROTH) buf[7] = 'r';
-        if (mode & S_IWOTH) buf[8] = 'w';
-        if (mode & S_IXOTH) buf[9] = 'x';
+        if (ctx->dirfd == -1) forge_err_wargs("could not open %s", filepath);
 
-        // Sticky bit, setuid, setgid
-        if (mode & S_ISUID) buf[3] = (mode & S_IXUSR) ? 's' : 'S';
-        if (mode & S_ISGID) buf[6] = (mode & S_IXGRP) ? 's' : 'S';
-        if (mode & S_ISVTX) buf[9] = (mode & S_IXOTH) ? 't' : 'T';
+        return ctx;
 }
 
-static const char *
-human_size(off_t size)
+// Moves `ctx` to `path`, absolute or relative to its directory.
+// Returns 0 if `path` is not a directory that can be opened.
+static int
+context_enter(ie_context *ctx,
+              const char *path)
 {
-        static char buf[32];
-        if (size < 1024) snprintf(buf, sizeof(buf), "%4ld ", (long)size);
-        else if (size < 1024*1024) snprintf(buf, sizeof(buf), "%4ldK", (long)(size/1024));
-        else if (size < 1024LL*1024*1024) snprintf(buf, sizeof(buf), "%4ldM", (long)(size/(1024*1024)));
-        else snprintf(buf, sizeof(buf), "%4ldG", (long)(size/(1024*1024*1024)));
-        return buf;
-}
-
-static const char *
-format_time(time_t mtime)
-{
-        static char buf[32];
-        struct tm *tm = localtime(&mtime);
-        if (!tm) return "?\?\?\?-?\?-?\? ?\?:?\?";
-        // Show year if older than 6 months, otherwise show time
-        time_t now = time(NULL);
-        if (now - mtime > 180*24*3600 || now < mtime) {
-                strftime(buf, sizeof(buf), "%b %d  %Y", tm);
-        } else {
-                strftime(buf, sizeof(buf), "%b %d %H:%M", tm);
+        char *joined = path[0] == '/' ? strdup(path) : forge_cstr_builder(ctx->filepath, "/", path, NULL);
+        char *abs    = realpath(joined, NULL);
+        int   fd     = abs ? open(abs, O_RDONLY|O_DIRECTORY|O_CLOEXEC) : -1;
+
+        TRACE_SYSCALLS(2);
+        free(joined);
+        if (fd == -1) {
+                free(abs);
+                return 0;
         }
-        return buf;
-}
 
-static void
-selection_up(ie_context *ctx)
-{
-        if (ctx->entries.i > 0) {
-                --ctx->entries.i;
-        }
+        close(ctx->dirfd);
+        free(ctx->filepath);
+        ctx->dirfd    = fd;
+        ctx->filepath = abs;
+
+        return 1;
 }
 
 static void
@@ -227,40 +405,53 @@ selection_down(ie_context *ctx)
 }
 
 static void
-rm_dir(const char *fp)
+selection_move(ie_context *ctx, long delta)
 {
-        char **files = ls(fp);
+        if (ctx->entries.fes.len == 0) return;
 
-        for (size_t i = 0; files && files[i]; ++i) {
-                if (!strcmp(files[i], "..")) continue;
-                if (!strcmp(files[i], "."))  continue;
-                char *path = forge_cstr_builder(fp, "/", files[i], NULL);
-                if (forge_io_is_dir(path)) {
-                        rm_dir(path);
-                } else {
-                        rm_file(path);
-                }
-                free(path);
-                free(files[i]);
-        }
+        long i    = (long)ctx->entries.i + delta;
+        long last = (long)ctx->entries.fes.len-1;
 
-        if (remove(fp) != 0) {
-                perror("remove");
-                exit(1);
-        }
+        if (i < 0)    i = 0;
+        if (i > last) i = last;
+
+        ctx->entries.i = (size_t)i;
 }
 
+// Removes `name` in `dirfd`, directories with everything in them.
+// Symbolic links are removed, never followed.
 static void
-rm_file(const char *fp)
+rm_at(int         dirfd,
+      const char *name)
 {
-        if (forge_io_is_dir(fp)) {
-                rm_dir(fp);
-        } else {
-                if (remove(fp) != 0) {
+        struct stat st;
+        int         is_dir = fstatat(dirfd, name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode);
+        TRACE_SYSCALLS(1);
+
+        if (is_dir) {
+                int  fd = openat(dirfd, name, O_RDONLY|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC);
+                DIR *d  = fd == -1 ? NULL : fdopendir(fd);
+                if (!d) {
                         perror("remove");
                         exit(1);
                 }
+
+                struct dirent *de;
+                while ((de = readdir(d))) {
+                        if (!strcmp(de->d_name, "..")) continue;
+                        if (!strcmp(de->d_name, "."))  continue;
+                        rm_at(fd, de->d_name);
+                }
+                closedir(d);
+        }
+
+        uint64_t t0 = TRACE_BEGIN();
+        if (unlinkat(dirfd, name, is_dir ? AT_REMOVEDIR : 0) != 0) {
+                perror("remove");
+                exit(1);
         }
+        TRACE_SYSCALLS(1);
+        TRACE_END_OP("remove", name, t0);
 }
 
 static void
@@ -281,205 +472,2215 @@ endswith(const char *s)
         return NULL;
 }
 
+// Children. Programs are started with posix_spawn(), which glibc does
+// with vfork semantics: the child borrows the memory of ie until it
+// execs, so starting a program does not copy the page tables of a
+// large listing as fork() does, and takes as long however much ie
+// holds.
+//
+// SIGCHLD is blocked in every thread and read from a signalfd in
+// wait_for_input(), which reaps whatever exited. Children start with
+// an empty signal mask. Programs ie waits for, like the editor, are
+// waited for directly with proc_wait(). g_procs keeps the running
+// children and the last PROC_MAX that ended with how they ended.
+//
+
+#define PROC_MAX 32
+
+typedef struct {
+        pid_t           pid;
+        int             running;
+        int             status; // from waitpid() once it ended
+        char            name[64];
+        struct timespec started;
+        struct timespec ended;
+} ie_proc;
+
+DYN_ARRAY_TYPE(ie_proc, ie_proc_array);
+
+struct {
+        int           sigfd; // -1 if SIGCHLD could not be routed to one
+        ie_proc_array list;  // oldest first
+} g_procs = {
+        .sigfd = -1,
+        .list  = dyn_array_empty(ie_proc_array),
+};
+
+// Before any thread is started, they inherit the mask.
 static void
-exec_cmd(const char *cmd,
-         const char *arg)
+proc_init(void)
 {
-        pid_t pid = fork();
+        sigset_t set;
+        sigemptyset(&set);
+        sigaddset(&set, SIGCHLD);
 
-        if (pid == 0) {
-                char *const argv[] = {
-                        (char *)cmd,
-                        (char *)arg,
-                        NULL
-                };
+        if (pthread_sigmask(SIG_BLOCK, &set, NULL) != 0) return;
+        if ((g_procs.sigfd = signalfd(-1, &set, SFD_NONBLOCK|SFD_CLOEXEC)) == -1) {
+                pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+        }
+}
 
-                execvp(cmd, argv);
-                exit(EXIT_FAILURE);
+static ie_proc *
+proc_find(pid_t pid)
+{
+        for (size_t i = g_procs.list.len; i-- > 0;) {
+                if (g_procs.list.data[i].pid == pid) return &g_procs.list.data[i];
         }
+        return NULL;
 }
 
-static int
-clicked(ie_context *ctx,
-        const char  *to)
+static void
+proc_ended(pid_t pid,
+           int   status)
 {
-        const FE *fe = ctx->entries.fes.data[ctx->entries.i];
+        ie_proc *p = proc_find(pid);
+        if (!p) return;
 
-        if (forge_io_is_dir(to)) {
-                free(ctx->filepath);
-                ctx->filepath = forge_io_resolve_absolute_path(to);
-                CD(ctx->filepath, forge_err_wargs("could not cd() to %s", ctx->filepath));
-                if (!strcmp(to, "..") && ctx->stack.len > 0) {
-                        ctx->entries.i = ctx->stack.data[ctx->stack.len-1];
-                        --ctx->stack.len;
-                }
-                else
-                        dyn_array_append(ctx->stack, ctx->entries.i);
-                return 1;
-        } else if (!fe->stat_failed
-                   && (fe->st.st_mode & (S_IXUSR|S_IXGRP|S_IXOTH))
-                   && endswith(fe->name) == NULL) {
-                str_array args = dyn_array_empty(str_array);
-                dyn_array_append(args, fe->name);
+        p->running = 0;
+        p->status  = status;
+        clock_gettime(CLOCK_MONOTONIC, &p->ended);
+}
 
-                char *prompt = forge_rdln("Arguments: ");
+// Starts `path` with `argv`, searching $PATH if `search`, in the
+// directory `dirfd` if it is not -1. The child changes directory
+// itself, ie never does. Returns the pid, or -1 with errno set.
+static pid_t
+proc_spawn(const char                 *path,
+           char *const                 argv[],
+           int                         search,
+           posix_spawn_file_actions_t *actions,
+           int                         pgroup,
+           int                         dirfd)
+{
+        posix_spawn_file_actions_t own;
+        posix_spawnattr_t          attr;
+        sigset_t                   none;
+        pid_t                      pid;
+
+        if (dirfd != -1 && !actions) {
+                posix_spawn_file_actions_init(&own);
+                actions = &own;
+        }
+        if (dirfd != -1) posix_spawn_file_actions_addfchdir_np(actions, dirfd);
+
+        sigemptyset(&none);
+        posix_spawnattr_init(&attr);
+        posix_spawnattr_setsigmask(&attr, &none);
+        posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | (pgroup ? POSIX_SPAWN_SETPGROUP : 0));
+        if (pgroup) posix_spawnattr_setpgroup(&attr, 0);
+
+        uint64_t t0 = TRACE_BEGIN();
+        int      rc = search ? posix_spawnp(&pid, path, actions, &attr, argv, environ)
+                             : posix_spawn(&pid, path, actions, &attr, argv, environ);
+        TRACE_SYSCALLS(1);
+        TRACE_END_OP("spawn", path, t0);
+
+        posix_spawnattr_destroy(&attr);
+        if (actions == &own) posix_spawn_file_actions_destroy(&own);
+        if (rc != 0) {
+                errno = rc;
+                return -1;
+        }
 
-                char *tok = strtok(prompt, " ");
-                while (tok) {
-                        dyn_array_append(args, strdup(tok));
-                        tok = strtok(prompt, tok);
+        // Forget the oldest of the children that ended.
+        if (g_procs.list.len >= PROC_MAX) {
+                for (size_t i = 0; i < g_procs.list.len; ++i) {
+                        if (g_procs.list.data[i].running) continue;
+                        memmove(&g_procs.list.data[i], &g_procs.list.data[i+1],
+                                (g_procs.list.len - i - 1) * sizeof(ie_proc));
+                        --g_procs.list.len;
+                        break;
                 }
-                dyn_array_append(args, NULL);
+        }
 
-                pid_t pid = fork();
+        ie_proc p = {0};
+        p.pid     = pid;
+        p.running = 1;
+        snprintf(p.name, sizeof(p.name), "%s", argv[0]);
+        clock_gettime(CLOCK_MONOTONIC, &p.started);
+        dyn_array_append(g_procs.list, p);
 
-                if (pid == -1) {
-                        perror("fork");
-                        _exit(1);
-                }
+        return pid;
+}
 
-                if (pid == 0) {
-                        execv(fe->name, args.data);
-                        perror("execv");
-                        exit(1);
-                }
+// Reaps every child that ended. Returns how many did.
+static int
+proc_reap(void)
+{
+        struct signalfd_siginfo info[8];
+        int                     n = 0;
+        int                     status;
+        pid_t                   pid;
+
+        if (g_procs.sigfd != -1) {
+                while (read(g_procs.sigfd, info, sizeof(info)) > 0);
+        }
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+                proc_ended(pid, status);
+                ++n;
+        }
+        return n;
+}
+
+// Waits for `pid` to end and returns its status, -1 if it cannot.
+static int
+proc_wait(pid_t pid)
+{
+        int status;
 
-                // Parent process, wait for child
-                int status;
-                if (waitpid(pid, &status, 0) == -1) {
-                        perror("waitpid");
-                        return -1;
+        while (waitpid(pid, &status, 0) == -1) {
+                if (errno != EINTR) return -1;
+        }
+        proc_ended(pid, status);
+        return status;
+}
+
+// The process list, newest first.
+static void
+proc_view(void)
+{
+        size_t  n     = g_procs.list.len + 1;
+        char  **lines = (char **)malloc(n * sizeof(char *));
+
+        lines[0] = strdup("    PID  TIME      STATE            PROGRAM");
+        for (size_t i = 0; i < g_procs.list.len; ++i) {
+                const ie_proc  *p = &g_procs.list.data[g_procs.list.len - 1 - i];
+                char            state[32];
+                struct timespec end = p->ended;
+
+                if (p->running) {
+                        clock_gettime(CLOCK_MONOTONIC, &end);
+                        snprintf(state, sizeof(state), "running");
+                } else if (WIFEXITED(p->status)) {
+                        snprintf(state, sizeof(state), "exit %d", WEXITSTATUS(p->status));
+                } else {
+                        snprintf(state, sizeof(state), "signal %d", WTERMSIG(p->status));
                 }
 
+                double secs = (end.tv_sec - p->started.tv_sec) + (end.tv_nsec - p->started.tv_nsec) / 1e9;
+                lines[i+1]  = (char *)malloc(128);
+                snprintf(lines[i+1], 128, "%7ld  %7.1fs  %-15s  %s", (long)p->pid, secs, state, p->name);
+        }
+
+        forge_viewer *v = forge_viewer_alloc(lines, n, 0);
+        forge_viewer_display(v);
+        forge_viewer_free(v);
+
+        for (size_t i = 0; i < n; ++i) free(lines[i]);
+        free(lines);
+}
+
+static void
+exec_cmd(const char *cmd,
+         const char *arg,
+         int         dirfd)
+{
+        char *const argv[] = {
+                (char *)cmd,
+                (char *)arg,
+                NULL
+        };
+
+        if (proc_spawn(cmd, argv, /*search=*/1, NULL, /*pgroup=*/0, dirfd) == -1) {
+                printf(RED "could not start %s: %s" RESET "\n", cmd, strerror(errno));
                 any_key();
+        }
+}
 
-                dyn_array_free(args);
+// Opener index. Rules come from `ie-openers`, a list of
+// [pattern, command] pairs, and are compiled once when the config is
+// loaded:
+//
+//   ie-openers = [['*.tar.gz', 'file-roller'],
+//                 ['*.[ch]',   'vim'],
+//                 ['Makefile', 'vim'],
+//                 ['image/*',  'feh']];
+//
+// `*.ext` patterns are hashed on the extension and `*.a.b` patterns
+// go into a trie of reversed suffixes, where the longest one wins.
+// Patterns with a '/' are MIME types that are matched against the
+// sniffed contents of the file. Anything else is a glob. All globs
+// are compiled into one NFA that is run as a lazily built DFA, so a
+// lookup is a single pass over the name however many rules there are.
+//
+// Lookup order is suffix, extension, the `ext = 'cmd';` variables
+// learned through the "Open file with" prompt, glob, then MIME. The
+// first rule for a pattern wins.
+
+#define GLOB_DFA_MAX_STATES 1024
+#define SNIFF_BYTES 512
+
+QCL_MAP_TYPE(const char *, const char *, opener_strmap);
 
-                return 1;
-        } else {
-                const char *ext       = endswith(to);
-                qcl_value *openwith_v = NULL;
-                const char *openwith  = NULL;
+typedef struct {
+        uint32_t key; // (node << 8 | byte) + 1, 0 if the slot is empty
+        int      child;
+} suffix_edge;
 
-                if (ext && (openwith_v = qcl_value_get(&g_config.written_config, ext))) {
-                        assert(openwith_v->kind == QCL_VALUE_KIND_STRING);
-                        openwith = ((qcl_value_string *)openwith_v)->s;
-                        goto do_cmd;
-                }
+DYN_ARRAY_TYPE(suffix_edge, suffix_edge_array);
 
-                openwith = forge_rdln("Open file with (leave empty to view txt): ");
+typedef struct {
+        uint64_t cls[4]; // bytes that move this state to the next
+        int      loop;   // preceded by a '*', stays here on any byte
+        int      rule;   // index into glob_cmds if final, else -1
+} glob_state;
 
-                if (!openwith || strlen(openwith) == 0) {
-                        char **lns = forge_io_read_file_to_lines(to);
-                        size_t lns_n;
-                        for (lns_n = 0; lns[lns_n]; ++lns_n);
-                        forge_viewer *v = forge_viewer_alloc(lns, lns_n, 1);
-                        forge_viewer_display(v);
-                        forge_viewer_free(v);
-                        for (size_t i = 0; i < lns_n; ++i) free(lns[i]);
-                        free(lns);
-                        return 0;
-                }
-                if (ext) {
-                        // Save 'openwith' for future uses
-                        size_t lns_n;
-                        char **lns = forge_io_read_file_to_lines(g_config_filepath);
-                        (void)forge_io_truncate_file(g_config_filepath);
+DYN_ARRAY_TYPE(glob_state, glob_state_array);
 
-                        for (lns_n = 0; lns[lns_n]; ++lns_n);
-                        lns = (char **)realloc(lns, sizeof(char *)*(lns_n+1));
+typedef struct {
+        uint64_t *set;       // NFA states
+        int       accept;    // lowest rule in `set`, or -1
+        int       next[256]; // -1 if not computed yet
+} glob_dstate;
 
-                        char cmd_buf[256] = {0};
-                        sprintf(cmd_buf, "%s = '%s';", ext, openwith);
-                        lns[lns_n++] = strdup(cmd_buf);
+DYN_ARRAY_TYPE(glob_dstate, glob_dstate_array);
 
-                        // Adding new variable in-memory (to not re-parse config file).
-                        qcl_add_value(&g_config.written_config, ext,
-                                      (qcl_value *)qcl_value_string_alloc(openwith));
-                        (void)forge_io_write_lines(g_config_filepath, (const char **)lns, lns_n);
+typedef struct {
+        opener_strmap     exts;
+        opener_strmap     mimes;
+        struct {
+                int_array         cmd;   // per node, index into cmds or -1
+                suffix_edge_array edges; // open addressing, power of two
+                size_t            nedges;
+        } suffix;
+        struct {
+                glob_state_array  nfa;
+                glob_dstate_array dfa;   // 0 is the dead state, 1 the start
+                size_t            nwords;
+                uint64_t         *scratch;
+        } glob;
+        str_array cmds;
+} opener_index;
+
+// Associations picked at the "Open file with" prompt in this session.
+// They are appended to the config as well, this makes them effective
+// before the config has been reloaded. UI thread only.
+static opener_strmap g_learned = {0};
+
+// The config variables ie reads, resolved once in main() before the
+// first config is loaded. Read-only afterwards, so the watcher thread
+// uses them too.
+static struct {
+        qcl_key openers;
+        qcl_key showghost;
+} g_keys = {0};
+
+static unsigned
+suffix_edge_hash(uint32_t key)
+{
+        key ^= key >> 16;
+        key *= 0x45d9f3bu;
+        key ^= key >> 16;
+        return key;
+}
 
-                        for (size_t i = 0; i < lns_n; ++i) free(lns[i]);
-                        free(lns);
+static int *
+suffix_edge_find(opener_index *ix,
+                 int           node,
+                 uint8_t       c,
+                 int           insert)
+{
+        uint32_t key  = ((uint32_t)node << 8 | c) + 1;
+        size_t   mask = ix->suffix.edges.len-1;
+
+        for (size_t i = suffix_edge_hash(key) & mask;; i = (i+1) & mask) {
+                suffix_edge *e = &ix->suffix.edges.data[i];
+                if (e->key == key) return &e->child;
+                if (e->key == 0) {
+                        if (!insert) return NULL;
+                        e->key   = key;
+                        e->child = -1;
+                        ++ix->suffix.nedges;
+                        return &e->child;
                 }
-do_cmd:
-                assert(openwith);
-                exec_cmd(openwith, to);
         }
-        return 0;
 }
 
 static void
-remove_selection(ie_context *ctx)
+suffix_edges_grow(opener_index *ix)
 {
-        str_array confirm = dyn_array_empty(str_array);
-        size_t_array indices = dyn_array_empty(size_t_array);
+        suffix_edge_array old = ix->suffix.edges;
+        size_t            cap = old.len ? old.len*2 : 64;
+
+        ix->suffix.edges.data = (suffix_edge *)calloc(cap, sizeof(suffix_edge));
+        ix->suffix.edges.len  = cap;
+        ix->suffix.edges.cap  = cap;
+        ix->suffix.nedges     = 0;
+
+        for (size_t i = 0; i < old.len; ++i) {
+                if (!old.data[i].key) continue;
+                uint32_t key = old.data[i].key-1;
+                *suffix_edge_find(ix, key >> 8, key & 0xff, 1) = old.data[i].child;
+        }
 
-        if (sizet_set_size(&ctx->marked) > 0) {
-                size_t **ar = sizet_set_iter(&ctx->marked);
-                for (size_t i = 0; ar[i]; ++i) {
-                        char *path = ctx->entries.fes.data[*ar[i]]->name;
-                        if (!strcmp(path, "..") || !strcmp(path, ".")) {
-                                continue;
-                        }
-                        dyn_array_append(confirm, path);
-                        dyn_array_append(indices, *ar[i]);
-                }
-                free(ar);
-        } else {
-                char *path = ctx->entries.fes.data[ctx->entries.i]->name;
-                if (!strcmp(path, "..") || !strcmp(path, ".")) {
-                        return;
+        free(old.data);
+}
+
+// `suffix` includes the leading dot.
+static void
+suffix_add(opener_index *ix,
+           const char   *suffix,
+           int           cmd)
+{
+        int node = 0;
+
+        for (size_t i = strlen(suffix); i-- > 0;) {
+                if ((ix->suffix.nedges+1)*2 > ix->suffix.edges.len) suffix_edges_grow(ix);
+                int *child = suffix_edge_find(ix, node, (uint8_t)suffix[i], 1);
+                if (*child == -1) {
+                        *child = ix->suffix.cmd.len;
+                        dyn_array_append(ix->suffix.cmd, -1);
                 }
-                dyn_array_append(confirm, path);
+                node = *child;
         }
 
-        forge_ctrl_clear_terminal();
-        for (size_t i = 0; i < confirm.len; ++i) {
-                printf(RED BOLD "--- %s" RESET "\n", confirm.data[i]);
-        }
+        if (ix->suffix.cmd.data[node] == -1) ix->suffix.cmd.data[node] = cmd;
+}
 
-        int choice = forge_chooser_yesno("Remove these files?", NULL, 1);
-        if (choice) {
-                for (size_t i = 0; i < confirm.len; ++i) {
-                        rm_file(confirm.data[i]);
-                        if (indices.len > 0) {
-                                sizet_set_remove(&ctx->marked, indices.data[i]);
-                        }
+static const char *
+suffix_lookup(opener_index *ix,
+              const char   *name)
+{
+        int node = 0;
+        int best = -1;
+
+        if (!ix->suffix.edges.len) return NULL;
+
+        // Stop before the first byte, dotfiles have no suffix.
+        for (size_t i = strlen(name); i-- > 1;) {
+                int *child = suffix_edge_find(ix, node, (uint8_t)name[i], 0);
+                if (!child) break;
+                node = *child;
+                if (name[i] == '.' && ix->suffix.cmd.data[node] != -1) {
+                        best = ix->suffix.cmd.data[node];
                 }
         }
 
-        dyn_array_free(confirm);
+        return best == -1 ? NULL : ix->cmds.data[best];
 }
 
 static void
-clearln(ie_context *ctx)
+cls_set(uint64_t cls[4], uint8_t c)
 {
-        for (size_t i = 0; i < ctx->term.w; ++i) putchar(' ');
-        forge_ctrl_cursor_to_col(1);
+        cls[c >> 6] |= 1ull << (c & 63);
 }
 
 static int
-rename_selection(ie_context *ctx)
+cls_has(const uint64_t cls[4], uint8_t c)
 {
-        CURSOR_UP(1);
-        clearln(ctx);
+        return (cls[c >> 6] >> (c & 63)) & 1;
+}
 
-        const char *path = ctx->entries.fes.data[ctx->entries.i]->name;
-        printf(BOLD WHITE "Rename [" YELLOW "%s" RESET "]" RESET, path);
+// Parse a `[...]` class starting at `p` (after the '['). Returns the
+// position after the closing ']' or NULL if it is unterminated.
+static const char *
+glob_parse_class(const char *p,
+                 uint64_t    cls[4])
+{
+        int neg = *p == '!' || *p == '^';
+        if (neg) ++p;
+
+        for (int first = 1; *p && (first || *p != ']'); first = 0) {
+                uint8_t lo = (uint8_t)*p++;
+                uint8_t hi = lo;
+                if (*p == '-' && p[1] && p[1] != ']') {
+                        hi = (uint8_t)p[1];
+                        p += 2;
+                }
+                for (unsigned c = lo; c <= hi; ++c) cls_set(cls, c);
+        }
 
-        forge_ctrl_cursor_to_first_line();
-        CURSOR_DOWN(ctx->entries.i + 1);
-        forge_ctrl_cursor_to_col(strlen(path)+1);
+        if (*p != ']') return NULL;
 
-        char *s = forge_rdln(NULL);
+        if (neg) for (int i = 0; i < 4; ++i) cls[i] = ~cls[i];
+        cls[0] &= ~1ull; // never match NUL
+
+        return p+1;
+}
+
+static int
+glob_add(opener_index *ix,
+         const char   *pattern,
+         int           cmd)
+{
+        size_t start = ix->glob.nfa.len;
+        int    loop  = 0;
+
+        for (const char *p = pattern; *p;) {
+                if (*p == '*') {
+                        loop = 1;
+                        ++p;
+                        continue;
+                }
+
+                glob_state st = {.cls = {0}, .loop = loop, .rule = -1};
+                loop = 0;
+
+                if (*p == '?') {
+                        for (int i = 0; i < 4; ++i) st.cls[i] = ~0ull;
+                        st.cls[0] &= ~1ull;
+                        ++p;
+                } else if (*p == '[') {
+                        if (!(p = glob_parse_class(p+1, st.cls))) {
+                                ix->glob.nfa.len = start;
+                                return 0;
+                        }
+                } else {
+                        if (*p == '\\' && p[1]) ++p;
+                        cls_set(st.cls, (uint8_t)*p++);
+                }
+
+                dyn_array_append(ix->glob.nfa, st);
+        }
+
+        glob_state final = {.cls = {0}, .loop = loop, .rule = cmd};
+        dyn_array_append(ix->glob.nfa, final);
+
+        return 1;
+}
+
+static int
+glob_dfa_add(opener_index   *ix,
+             const uint64_t *set)
+{
+        glob_dstate d;
+
+        d.set    = (uint64_t *)malloc(ix->glob.nwords * sizeof(uint64_t));
+        d.accept = -1;
+        memcpy(d.set, set, ix->glob.nwords * sizeof(uint64_t));
+        for (size_t i = 0; i < 256; ++i) d.next[i] = -1;
+
+        for (size_t s = 0; s < ix->glob.nfa.len; ++s) {
+                int rule = ix->glob.nfa.data[s].rule;
+                if ((set[s >> 6] >> (s & 63) & 1) && rule != -1
+                    && (d.accept == -1 || rule < d.accept)) {
+                        d.accept = rule;
+                }
+        }
+
+        dyn_array_append(ix->glob.dfa, d);
+        return ix->glob.dfa.len-1;
+}
+
+// Keep the dead and start states and drop everything else.
+static void
+glob_dfa_flush(opener_index *ix)
+{
+        for (size_t i = 2; i < ix->glob.dfa.len; ++i) free(ix->glob.dfa.data[i].set);
+        ix->glob.dfa.len = 2;
+        for (size_t i = 0; i < 256; ++i) {
+                ix->glob.dfa.data[0].next[i] = 0;
+                ix->glob.dfa.data[1].next[i] = -1;
+        }
+}
+
+// (Re)build the start state once all globs are added.
+static void
+glob_compile(opener_index *ix)
+{
+        while (ix->glob.dfa.len > 0) free(ix->glob.dfa.data[--ix->glob.dfa.len].set);
+        free(ix->glob.scratch);
+
+        ix->glob.nwords  = (ix->glob.nfa.len + 63) / 64 + 1;
+        ix->glob.scratch = (uint64_t *)calloc(ix->glob.nwords, sizeof(uint64_t));
+
+        (void)glob_dfa_add(ix, ix->glob.scratch);
+        for (size_t i = 0; i < 256; ++i) ix->glob.dfa.data[0].next[i] = 0;
+
+        // Every rule starts right after the final state of the previous.
+        for (size_t s = 0; s < ix->glob.nfa.len; ++s) {
+                if (s == 0 || ix->glob.nfa.data[s-1].rule != -1) {
+                        ix->glob.scratch[s >> 6] |= 1ull << (s & 63);
+                }
+        }
+        (void)glob_dfa_add(ix, ix->glob.scratch);
+}
+
+static int
+glob_dfa_step(opener_index *ix,
+              int           from,
+              uint8_t       c)
+{
+        int to = ix->glob.dfa.data[from].next[c];
+        if (to != -1) return to;
+
+        const uint64_t *set  = ix->glob.dfa.data[from].set;
+        uint64_t       *next = ix->glob.scratch;
+
+        memset(next, 0, ix->glob.nwords * sizeof(uint64_t));
+        for (size_t w = 0; w < ix->glob.nwords; ++w) {
+                for (uint64_t bits = set[w]; bits; bits &= bits-1) {
+                        size_t            s  = w*64 + __builtin_ctzll(bits);
+                        const glob_state *st = &ix->glob.nfa.data[s];
+                        if (st->loop)            next[s >> 6]     |= 1ull << (s & 63);
+                        if (cls_has(st->cls, c)) next[(s+1) >> 6] |= 1ull << ((s+1) & 63);
+                }
+        }
+
+        for (size_t i = 0; i < ix->glob.dfa.len && to == -1; ++i) {
+                if (!memcmp(ix->glob.dfa.data[i].set, next, ix->glob.nwords * sizeof(uint64_t))) {
+                        to = i;
+                }
+        }
+
+        if (to == -1) {
+                if (ix->glob.dfa.len >= GLOB_DFA_MAX_STATES) {
+                        glob_dfa_flush(ix);
+                        if (from >= 2) return glob_dfa_add(ix, next);
+                }
+                to = glob_dfa_add(ix, next);
+        }
+
+        ix->glob.dfa.data[from].next[c] = to;
+        return to;
+}
+
+static const char *
+glob_lookup(opener_index *ix,
+            const char   *name)
+{
+        if (ix->glob.dfa.len < 2) return NULL;
+
+        int state = 1;
+        for (const char *p = name; *p && state != 0; ++p) {
+                state = glob_dfa_step(ix, state, (uint8_t)*p);
+        }
+
+        int rule = ix->glob.dfa.data[state].accept;
+        return rule == -1 ? NULL : ix->cmds.data[rule];
+}
+
+static const struct {
+        size_t      off;
+        size_t      n;
+        const char *magic;
+        const char *mime;
+} g_magic[] = {
+        {0,   8, "\x89PNG\r\n\x1a\n",     "image/png"},
+        {0,   3, "\xff\xd8\xff",          "image/jpeg"},
+        {0,   6, "GIF87a",                "image/gif"},
+        {0,   6, "GIF89a",                "image/gif"},
+        {8,   4, "WEBP",                  "image/webp"},
+        {0,   2, "BM",                    "image/bmp"},
+        {0,   5, "%PDF-",                 "application/pdf"},
+        {0,   4, "PK\x03\x04",            "application/zip"},
+        {0,   2, "\x1f\x8b",              "application/gzip"},
+        {0,   3, "BZh",                   "application/x-bzip2"},
+        {0,   6, "\xfd" "7zXZ\x00",       "application/x-xz"},
+        {0,   4, "\x28\xb5\x2f\xfd",      "application/zstd"},
+        {0,   6, "7z\xbc\xaf\x27\x1c",    "application/x-7z-compressed"},
+        {257, 5, "ustar",                 "application/x-tar"},
+        {0,   4, "\x7f" "ELF",            "application/x-executable"},
+        {0,  16, "SQLite format 3\x00",   "application/vnd.sqlite3"},
+        {0,   4, "fLaC",                  "audio/flac"},
+        {0,   4, "OggS",                  "audio/ogg"},
+        {0,   3, "ID3",                   "audio/mpeg"},
+        {8,   4, "WAVE",                  "audio/wav"},
+        {8,   4, "AVI ",                  "video/x-msvideo"},
+        {4,   4, "ftyp",                  "video/mp4"},
+        {0,   4, "\x1a\x45\xdf\xa3",      "video/x-matroska"},
+};
+
+static const char *
+sniff_mime(const char *path)
+{
+        uint8_t buf[SNIFF_BYTES];
+        ssize_t n;
+        int     fd;
+
+        if ((fd = open(path, O_RDONLY|O_CLOEXEC|O_NOCTTY)) == -1) return NULL;
+        n = read(fd, buf, sizeof(buf));
+        close(fd);
+        if (n <= 0) return n == 0 ? "text/plain" : NULL;
+
+        for (size_t i = 0; i < sizeof(g_magic)/sizeof(*g_magic); ++i) {
+                if (g_magic[i].off + g_magic[i].n <= (size_t)n
+                    && !memcmp(buf + g_magic[i].off, g_magic[i].magic, g_magic[i].n)) {
+                        return g_magic[i].mime;
+                }
+        }
+
+        return memchr(buf, 0, n) ? "application/octet-stream" : "text/plain";
+}
+
+static const char *
+mime_lookup(opener_index *ix,
+            const char   *path)
+{
+        const char  *mime;
+        const char **cmd;
+        char         wild[64];
+
+        if (!ix->mimes.tbl.sz || !(mime = sniff_mime(path))) return NULL;
+        if ((cmd = opener_strmap_get(&ix->mimes, mime))) return *cmd;
+
+        const char *slash = strchr(mime, '/');
+        snprintf(wild, sizeof(wild), "%.*s/*", (int)(slash - mime), mime);
+        if ((cmd = opener_strmap_get(&ix->mimes, wild))) return *cmd;
+
+        return NULL;
+}
+
+static void
+opener_index_init(opener_index *ix)
+{
+        memset(ix, 0, sizeof(*ix));
+        ix->exts        = opener_strmap_create(symtbl_hash, symtbl_cmp);
+        ix->mimes       = opener_strmap_create(symtbl_hash, symtbl_cmp);
+        ix->suffix.cmd  = dyn_array_empty(int_array);
+        ix->glob.nfa    = dyn_array_empty(glob_state_array);
+        ix->glob.dfa    = dyn_array_empty(glob_dstate_array);
+        ix->cmds        = dyn_array_empty(str_array);
+        dyn_array_append(ix->suffix.cmd, -1); // root
+        suffix_edges_grow(ix);
+}
+
+static void
+opener_strmap_free_keys(opener_strmap *map)
+{
+        for (size_t i = 0; i < map->tbl.cap; ++i) {
+                if (map->tbl.data[i].used) free((char *)map->tbl.data[i].k);
+        }
+}
+
+static void
+opener_index_destroy(opener_index *ix)
+{
+        opener_strmap_free_keys(&ix->exts);
+        opener_strmap_free_keys(&ix->mimes);
+        opener_strmap_destroy(&ix->exts);
+        opener_strmap_destroy(&ix->mimes);
+        dyn_array_free(ix->suffix.cmd);
+        free(ix->suffix.edges.data);
+        dyn_array_free(ix->glob.nfa);
+        for (size_t i = 0; i < ix->glob.dfa.len; ++i) free(ix->glob.dfa.data[i].set);
+        dyn_array_free(ix->glob.dfa);
+        free(ix->glob.scratch);
+        for (size_t i = 0; i < ix->cmds.len; ++i) free(ix->cmds.data[i]);
+        dyn_array_free(ix->cmds);
+        memset(ix, 0, sizeof(*ix));
+}
+
+// Returns 0 if `pattern` is not valid.
+static int
+opener_index_add(opener_index *ix,
+                 const char   *pattern,
+                 const char   *cmd)
+{
+        int         i   = ix->cmds.len;
+        const char *ext = pattern+2;
+
+        dyn_array_append(ix->cmds, strdup(cmd));
+
+        if (strchr(pattern, '/')) {
+                char *mime = strdup(pattern);
+                if (!opener_strmap_contains(&ix->mimes, mime)) opener_strmap_insert(&ix->mimes, mime, ix->cmds.data[i]);
+                else free(mime);
+                return 1;
+        }
+
+        if (!strncmp(pattern, "*.", 2) && *ext && !strpbrk(ext, "*?[\\")) {
+                if (strchr(ext, '.')) {
+                        suffix_add(ix, pattern+1, i);
+                } else if (!opener_strmap_contains(&ix->exts, ext)) {
+                        opener_strmap_insert(&ix->exts, strdup(ext), ix->cmds.data[i]);
+                }
+                return 1;
+        }
+
+        return glob_add(ix, pattern, i);
+}
+
+// Compile `ie-openers` from `config`. Invalid entries are skipped and
+// reported on stderr if `report` is set.
+static void
+opener_index_load(opener_index *ix,
+                  qcl_config   *config,
+                  int           report)
+{
+        const qcl_value *rules = qcl_key_list(config, &g_keys.openers);
+
+        opener_index_init(ix);
+
+        for (size_t i = 0; i < qcl_value_list_len(rules); ++i) {
+                const qcl_value *pair    = qcl_value_list_at(rules, i);
+                const char      *pattern = qcl_value_as_string(qcl_value_list_at(pair, 0));
+                const char      *cmd     = qcl_value_as_string(qcl_value_list_at(pair, 1));
+                if (qcl_value_list_len(pair) != 2
+                    || !pattern
+                    || !cmd
+                    || !opener_index_add(ix, pattern, cmd)) {
+                        if (report) fprintf(stderr, "ie-openers: ignoring invalid entry %zu\n", i);
+                }
+        }
+
+        glob_compile(ix);
+}
+
+// `name` is the basename used for name rules, `path` is opened for
+// MIME rules. `config` is the config `ix` was loaded from.
+static const char *
+opener_index_lookup(opener_index *ix,
+                    qcl_config   *config,
+                    const char   *path,
+                    const char   *name)
+{
+        const char  *cmd;
+        const char **hit;
+        const char  *ext = endswith(name);
+
+        if ((cmd = suffix_lookup(ix, name))) return cmd;
+
+        if (ext) {
+                if ((hit = opener_strmap_get(&ix->exts, ext))) return *hit;
+                if ((hit = opener_strmap_get(&g_learned, ext))) return *hit;
+
+                if ((cmd = qcl_value_as_string(qcl_value_get(config, ext)))) return cmd;
+        }
+
+        if ((cmd = glob_lookup(ix, name))) return cmd;
+
+        return mime_lookup(ix, path);
+}
+
+// Config snapshots. The parsed config and the opener index compiled
+// from it form an ie_snapshot, which is published through g_snapshot
+// and never changed afterwards. A watcher thread reparses the config
+// when it changes on disk and swaps in a new snapshot, so readers never
+// lock and a reload never stalls the UI.
+//
+// Replaced snapshots are freed with quiescent-state based reclamation.
+// Every thread that reads snapshots registers an ie_reader and marks
+// the points where it holds no snapshot pointers: reader_online() is
+// such a point, and a reader between reader_offline() and
+// reader_online() holds none at all, e.g. while it blocks in poll(). A
+// snapshot retired at epoch E is freed by the watcher once every reader
+// is offline or has been online again since E.
+//
+// The glob DFA of an opener index is built lazily while it is used, so
+// opener_index_lookup() is for the UI thread only. Everything else in a
+// snapshot may be read from any registered reader.
+//
+// The config may include other files. The watcher watches the
+// directories of all of them and keeps their compiled form in g_units,
+// so a reload only reparses the files that changed.
+
+#define IE_MAX_READERS 8
+#define RELOAD_DEBOUNCE_MS 30
+#define RECLAIM_POLL_MS 20
+
+typedef struct ie_snapshot {
+        qcl_config          config;
+        opener_index        openers;
+        uint64_t            retired; // epoch it was replaced at
+        struct ie_snapshot *next;    // in g_watch.retired
+} ie_snapshot;
+
+typedef struct {
+        atomic_int            used;
+        atomic_uint_least64_t epoch; // 0 while offline
+} ie_reader;
+
+// Sent from the watcher to the UI over g_watch.notify. Writes of this
+// size are atomic on a pipe, so messages are never split.
+typedef struct {
+        char ok;
+        char err[255];
+} reload_msg;
+
+static _Atomic(ie_snapshot *) g_snapshot = NULL;
+static atomic_uint_least64_t  g_epoch    = 1;
+static ie_reader              g_readers[IE_MAX_READERS];
+static ie_reader             *g_ui_reader = NULL;
+
+struct {
+        pthread_t    th;
+        int          running;
+        int          inotify;
+        int          stop[2];
+        int          notify[2];
+        ie_snapshot *retired; // watcher thread only
+} g_watch = {
+        .running = 0,
+        .inotify = -1,
+        .stop    = {-1, -1},
+        .notify  = {-1, -1},
+        .retired = NULL,
+};
+
+// Watcher thread only, except before the watcher is started.
+static qcl_unit_cache g_units = {0};
+
+static ie_reader *
+reader_register(void)
+{
+        for (size_t i = 0; i < IE_MAX_READERS; ++i) {
+                int expected = 0;
+                if (atomic_compare_exchange_strong(&g_readers[i].used, &expected, 1)) {
+                        atomic_store(&g_readers[i].epoch, 0);
+                        return &g_readers[i];
+                }
+        }
+        forge_err("too many snapshot readers");
+        return NULL;
+}
+
+static void
+reader_unregister(ie_reader *r)
+{
+        atomic_store(&r->epoch, 0);
+        atomic_store(&r->used, 0);
+}
+
+// Also a quiescent state if the reader is online already.
+static void
+reader_online(ie_reader *r)
+{
+        atomic_store(&r->epoch, atomic_load(&g_epoch));
+}
+
+static void
+reader_offline(ie_reader *r)
+{
+        atomic_store(&r->epoch, 0);
+}
+
+// Only valid while the calling reader is online.
+static ie_snapshot *
+snapshot_get(void)
+{
+        return atomic_load_explicit(&g_snapshot, memory_order_acquire);
+}
+
+static ie_snapshot *
+snapshot_empty(void)
+{
+        ie_snapshot *snap = (ie_snapshot *)calloc(1, sizeof(ie_snapshot));
+        opener_index_init(&snap->openers);
+        return snap;
+}
+
+// Parse the config into a new snapshot. Returns NULL and fills `err`
+// if it does not parse.
+static ie_snapshot *
+snapshot_load(const char *cache,
+              int         report,
+              char       *err,
+              size_t      err_n)
+{
+        ie_snapshot *snap = (ie_snapshot *)calloc(1, sizeof(ie_snapshot));
+
+        snap->config = qcl_parse_file_units(g_config_filepath, cache, &g_units);
+        if (!qcl_ok(&snap->config)) {
+                snprintf(err, err_n, "%s", qcl_geterr(&snap->config));
+                qcl_config_destroy(&snap->config);
+                free(snap);
+                return NULL;
+        }
+
+        opener_index_load(&snap->openers, &snap->config, report);
+
+        return snap;
+}
+
+static void
+snapshot_free(ie_snapshot *snap)
+{
+        opener_index_destroy(&snap->openers);
+        qcl_config_destroy(&snap->config);
+        free(snap);
+}
+
+// Watcher thread only, except before the watcher is started.
+static void
+snapshot_publish(ie_snapshot *snap)
+{
+        ie_snapshot *old = atomic_exchange(&g_snapshot, snap);
+        if (!old) return;
+
+        old->retired    = atomic_fetch_add(&g_epoch, 1) + 1;
+        old->next       = g_watch.retired;
+        g_watch.retired = old;
+}
+
+static int
+snapshot_grace_over(uint64_t epoch)
+{
+        for (size_t i = 0; i < IE_MAX_READERS; ++i) {
+                if (!atomic_load(&g_readers[i].used)) continue;
+                uint64_t e = atomic_load(&g_readers[i].epoch);
+                if (e != 0 && e < epoch) return 0;
+        }
+        return 1;
+}
+
+static void
+snapshot_reclaim(void)
+{
+        ie_snapshot **it = &g_watch.retired;
+        while (*it) {
+                ie_snapshot *snap = *it;
+                if (snapshot_grace_over(snap->retired)) {
+                        *it = snap->next;
+                        snapshot_free(snap);
+                } else {
+                        it = &snap->next;
+                }
+        }
+}
+
+static void
+reload_notify(int ok, const char *err)
+{
+        reload_msg msg = {0};
+        msg.ok = ok;
+        if (err) snprintf(msg.err, sizeof(msg.err), "%s", err);
+        ssize_t _ = write(g_watch.notify[1], &msg, sizeof(msg));
+        (void)_;
+}
+
+// Watch the directories of the files `snap` was read from, besides the
+// directory of the config itself. Directories that are watched already
+// are not added twice by inotify.
+static void
+config_watch_files(const ie_snapshot *snap)
+{
+        char        dir[PATH_MAX];
+        const char *fp;
+
+        for (size_t i = 0; (fp = qcl_config_file(&snap->config, i)); ++i) {
+                const char *slash = strrchr(fp, '/');
+                if (!slash) continue;
+                snprintf(dir, sizeof(dir), "%.*s", slash == fp ? 1 : (int)(slash - fp), fp);
+                (void)inotify_add_watch(g_watch.inotify, dir, IN_CLOSE_WRITE|IN_MOVED_TO);
+        }
+}
+
+// Whether an event for `name` may be a change of the config. The
+// directory does not matter, config_reload() checks the files.
+static int
+config_watch_match(const char *name)
+{
+        const ie_snapshot *snap = atomic_load(&g_snapshot);
+        const char        *fp;
+
+        if (!strcmp(name, CONFIG_FILENAME)) return 1;
+        for (size_t i = 0; snap && (fp = qcl_config_file(&snap->config, i)); ++i) {
+                const char *slash = strrchr(fp, '/');
+                if (!strcmp(slash ? slash+1 : fp, name)) return 1;
+        }
+        return 0;
+}
+
+// The watcher is the only thread that frees snapshots, so it can use
+// the current one without being a reader.
+static void
+config_reload(const char *cache)
+{
+        ie_snapshot *cur = atomic_load(&g_snapshot);
+        struct stat  st;
+        char         err[256];
+
+        // Keep the current config if the file went away, and skip
+        // events that did not change it or anything it includes.
+        if (stat(g_config_filepath, &st) != 0) return;
+        if (cur && qcl_config_file(&cur->config, 0) && !qcl_config_changed(&cur->config)) {
+                return;
+        }
+
+        uint64_t     t0   = TRACE_BEGIN();
+        ie_snapshot *snap = snapshot_load(cache, /*report=*/0, err, sizeof(err));
+        TRACE_END(TRACE_RELOAD, t0);
+        if (!snap) {
+                reload_notify(0, err);
+                return;
+        }
+
+        snapshot_publish(snap);
+        config_watch_files(snap);
+        reload_notify(1, NULL);
+}
+
+// Events for the config are collected until it has been quiet for
+// RELOAD_DEBOUNCE_MS, so an editor saving in several steps causes a
+// single reload.
+static void *
+config_watch_worker(void *arg)
+{
+        const char *cache = (const char *)arg;
+        char        buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+        int         dirty = 0;
+
+        struct pollfd fds[2] = {
+                { .fd = g_watch.inotify, .events = POLLIN },
+                { .fd = g_watch.stop[0], .events = POLLIN },
+        };
+
+        while (1) {
+                int timeout = dirty ? RELOAD_DEBOUNCE_MS : g_watch.retired ? RECLAIM_POLL_MS : -1;
+                int n       = poll(fds, 2, timeout);
+
+                if (n == -1) {
+                        if (errno == EINTR) continue;
+                        break;
+                }
+                if (fds[1].revents) break;
+
+                if (n > 0 && (fds[0].revents & POLLIN)) {
+                        ssize_t len = read(g_watch.inotify, buf, sizeof(buf));
+                        for (ssize_t off = 0; off < len;) {
+                                const struct inotify_event *ev = (const struct inotify_event *)(buf + off);
+                                if (ev->len && config_watch_match(ev->name)) dirty = 1;
+                                off += sizeof(*ev) + ev->len;
+                        }
+                        continue;
+                }
+
+                if (dirty) {
+                        dirty = 0;
+                        config_reload(cache);
+                }
+                snapshot_reclaim();
+        }
+
+        return NULL;
+}
+
+// Watch the directory rather than the file, compaction and most
+// editors replace the file with rename(). Without inotify the config
+// is simply not reloaded.
+static void
+config_watch_start(const char *cache)
+{
+        char        dir[1024];
+        const char *slash = strrchr(g_config_filepath, '/');
+
+        snprintf(dir, sizeof(dir), "%.*s", slash ? (int)(slash - g_config_filepath) : 1,
+                 slash ? g_config_filepath : ".");
+
+        if ((g_watch.inotify = inotify_init1(IN_NONBLOCK|IN_CLOEXEC)) == -1) return;
+        if (inotify_add_watch(g_watch.inotify, dir, IN_CLOSE_WRITE|IN_MOVED_TO) == -1
+            || pipe(g_watch.stop) != 0) {
+                goto fail;
+        }
+        if (pipe(g_watch.notify) != 0) goto fail_stop;
+
+        for (int i = 0; i < 2; ++i) {
+                fcntl(g_watch.notify[i], F_SETFL, fcntl(g_watch.notify[i], F_GETFL) | O_NONBLOCK);
+                fcntl(g_watch.notify[i], F_SETFD, FD_CLOEXEC);
+                fcntl(g_watch.stop[i], F_SETFD, FD_CLOEXEC);
+        }
+
+        if (atomic_load(&g_snapshot)) config_watch_files(atomic_load(&g_snapshot));
+
+        if (pthread_create(&g_watch.th, NULL, config_watch_worker, (void *)cache) != 0) {
+                close(g_watch.notify[0]), close(g_watch.notify[1]);
+                g_watch.notify[0] = g_watch.notify[1] = -1;
+                goto fail_stop;
+        }
+
+        g_watch.running = 1;
+        return;
+
+ fail_stop:
+        close(g_watch.stop[0]), close(g_watch.stop[1]);
+        g_watch.stop[0] = g_watch.stop[1] = -1;
+ fail:
+        close(g_watch.inotify);
+        g_watch.inotify = -1;
+}
+
+// Stop the watcher and free every snapshot. No reader may be online.
+static void
+config_watch_stop(void)
+{
+        if (g_watch.running) {
+                ssize_t _ = write(g_watch.stop[1], "q", 1);
+                (void)_;
+                pthread_join(g_watch.th, NULL);
+                g_watch.running = 0;
+
+                close(g_watch.inotify);
+                for (int i = 0; i < 2; ++i) {
+                        close(g_watch.stop[i]);
+                        close(g_watch.notify[i]);
+                }
+        }
+
+        while (g_watch.retired) {
+                ie_snapshot *next = g_watch.retired->next;
+                snapshot_free(g_watch.retired);
+                g_watch.retired = next;
+        }
+
+        ie_snapshot *snap = atomic_exchange(&g_snapshot, NULL);
+        if (snap) snapshot_free(snap);
+}
+
+// Prefetch. Entering a directory costs a listing_read(), mostly its
+// lstat() calls. When the cursor rests on a directory for
+// PREFETCH_DWELL_MS, a worker reads that directory ahead, and the
+// parent as well for "..". The listings wait in a few slots that
+// context_refresh() takes them from.
+//
+// A slot is only taken while its directory has the inode and mtime it
+// had before it was read, and for PREFETCH_TTL_MS at most, since
+// changes to the files in a directory do not move its mtime. Slots
+// hold PREFETCH_BUDGET bytes of entries in all, the least recently
+// read are dropped first and larger directories are not prefetched.
+//
+// Moving the cursor bumps g_prefetch.gen, which cancels the listing
+// being read. The worker runs at the lowest CPU and I/O priority, so
+// it only takes time the UI and the rest of the system leave over.
+//
+
+#define PREFETCH_DWELL_MS 120
+#define PREFETCH_TTL_MS   10000
+#define PREFETCH_SLOTS    8
+#define PREFETCH_BUDGET   (32u*1024*1024)
+
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_IDLE  (3 << 13)
+
+typedef struct {
+        FE_array        fes;
+        struct stat     dir;   // before it was read
+        struct timespec read;  // when it was read
+        size_t          bytes; // 0 if the slot is free
+} prefetch_slot;
+
+struct {
+        pthread_t       th;
+        int             running;
+        int             stop;
+        pthread_mutex_t mu;
+        pthread_cond_t  cv;
+        atomic_uint     gen;
+        char            want[2][PATH_MAX]; // the directory under the cursor and the parent, "" for none
+        int             next;              // the next of `want` to read, 2 once both were
+        struct timespec due;
+        prefetch_slot   slots[PREFETCH_SLOTS];
+        size_t          bytes;
+} g_prefetch = {
+        .running = 0,
+        .stop    = 0,
+        .mu      = PTHREAD_MUTEX_INITIALIZER,
+        .next    = 2,
+};
+
+static int
+timespec_passed(const struct timespec *t)
+{
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return now.tv_sec > t->tv_sec || (now.tv_sec == t->tv_sec && now.tv_nsec >= t->tv_nsec);
+}
+
+static struct timespec
+timespec_in(long ms)
+{
+        struct timespec t;
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        t.tv_sec  += ms / 1000;
+        t.tv_nsec += (ms % 1000) * 1000000L;
+        if (t.tv_nsec >= 1000000000L) {
+                ++t.tv_sec;
+                t.tv_nsec -= 1000000000L;
+        }
+        return t;
+}
+
+static void
+prefetch_slot_free(prefetch_slot *slot)
+{
+        listing_free(&slot->fes);
+        dyn_array_free(slot->fes);
+        g_prefetch.bytes -= slot->bytes;
+        memset(slot, 0, sizeof(*slot));
+}
+
+// The slot with a usable listing of the directory `st`. Slots of it
+// that are too old or outdated are freed. Locked.
+static prefetch_slot *
+prefetch_find(const struct stat *st)
+{
+        for (int i = 0; i < PREFETCH_SLOTS; ++i) {
+                prefetch_slot *slot = &g_prefetch.slots[i];
+
+                if (!slot->bytes || slot->dir.st_dev != st->st_dev || slot->dir.st_ino != st->st_ino) {
+                        continue;
+                }
+
+                struct timespec expiry = slot->read;
+                expiry.tv_sec += PREFETCH_TTL_MS / 1000;
+                if (slot->dir.st_mtim.tv_sec != st->st_mtim.tv_sec
+                    || slot->dir.st_mtim.tv_nsec != st->st_mtim.tv_nsec
+                    || timespec_passed(&expiry)) {
+                        prefetch_slot_free(slot);
+                        continue;
+                }
+
+                return slot;
+        }
+        return NULL;
+}
+
+// Takes `fes`, evicting the oldest listings until it fits. Locked.
+static void
+prefetch_put(const struct stat *st,
+             FE_array          *fes)
+{
+        size_t bytes = listing_bytes(fes);
+
+        while (1) {
+                prefetch_slot *free_slot = NULL;
+                prefetch_slot *oldest    = NULL;
+
+                for (int i = 0; i < PREFETCH_SLOTS; ++i) {
+                        prefetch_slot *slot = &g_prefetch.slots[i];
+                        if (!slot->bytes) {
+                                if (!free_slot) free_slot = slot;
+                        } else if (!oldest
+                                   || slot->read.tv_sec < oldest->read.tv_sec
+                                   || (slot->read.tv_sec == oldest->read.tv_sec
+                                       && slot->read.tv_nsec < oldest->read.tv_nsec)) {
+                                oldest = slot;
+                        }
+                }
+
+                if (free_slot && g_prefetch.bytes + bytes <= PREFETCH_BUDGET) {
+                        free_slot->fes   = *fes;
+                        free_slot->dir   = *st;
+                        free_slot->bytes = bytes ? bytes : 1;
+                        clock_gettime(CLOCK_MONOTONIC, &free_slot->read);
+                        g_prefetch.bytes += free_slot->bytes;
+                        *fes = dyn_array_empty(FE_array);
+                        return;
+                }
+                if (!oldest) return;
+                prefetch_slot_free(oldest);
+        }
+}
+
+static void
+prefetch_read(const char *dir,
+              unsigned    gen)
+{
+        struct stat st;
+        if (stat(dir, &st) != 0 || !S_ISDIR(st.st_mode)) return;
+
+        pthread_mutex_lock(&g_prefetch.mu);
+        int have = prefetch_find(&st) != NULL;
+        pthread_mutex_unlock(&g_prefetch.mu);
+        if (have) return;
+
+        FE_array fes = dyn_array_empty(FE_array);
+        if (listing_read_bg(&fes, dir, &g_prefetch.gen, gen, PREFETCH_BUDGET)) {
+                pthread_mutex_lock(&g_prefetch.mu);
+                if (atomic_load(&g_prefetch.gen) == gen) prefetch_put(&st, &fes);
+                pthread_mutex_unlock(&g_prefetch.mu);
+        }
+
+        listing_free(&fes);
+        dyn_array_free(fes);
+}
+
+static void *
+prefetch_worker(void *arg)
+{
+        (void)arg;
+
+        pid_t tid = (pid_t)syscall(SYS_gettid);
+        (void)setpriority(PRIO_PROCESS, (id_t)tid, 19);
+        (void)syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, (int)tid, IOPRIO_CLASS_IDLE);
+
+        pthread_mutex_lock(&g_prefetch.mu);
+        while (!g_prefetch.stop) {
+                if (g_prefetch.next == 2) {
+                        pthread_cond_wait(&g_prefetch.cv, &g_prefetch.mu);
+                        continue;
+                }
+                if (!timespec_passed(&g_prefetch.due)) {
+                        pthread_cond_timedwait(&g_prefetch.cv, &g_prefetch.mu, &g_prefetch.due);
+                        continue;
+                }
+
+                char dir[PATH_MAX];
+                memcpy(dir, g_prefetch.want[g_prefetch.next++], sizeof(dir));
+                if (!dir[0]) continue;
+
+                unsigned gen = atomic_load(&g_prefetch.gen);
+                pthread_mutex_unlock(&g_prefetch.mu);
+                prefetch_read(dir, gen);
+                pthread_mutex_lock(&g_prefetch.mu);
+        }
+        pthread_mutex_unlock(&g_prefetch.mu);
+
+        return NULL;
+}
+
+// Without the worker nothing is prefetched and every listing is read
+// when it is entered.
+static void
+prefetch_start(void)
+{
+        pthread_condattr_t attr;
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&g_prefetch.cv, &attr);
+        pthread_condattr_destroy(&attr);
+
+        if (pthread_create(&g_prefetch.th, NULL, prefetch_worker, NULL) != 0) {
+                pthread_cond_destroy(&g_prefetch.cv);
+                return;
+        }
+        g_prefetch.running = 1;
+}
+
+// Drops every prefetched listing and cancels the read in flight, e.g.
+// after a shell command that may have changed anything. The next hint
+// starts over.
+static void
+prefetch_flush(void)
+{
+        pthread_mutex_lock(&g_prefetch.mu);
+        memset(g_prefetch.want, 0, sizeof(g_prefetch.want));
+        g_prefetch.next = 2;
+        atomic_fetch_add(&g_prefetch.gen, 1);
+        for (int i = 0; i < PREFETCH_SLOTS; ++i) {
+                if (g_prefetch.slots[i].bytes) prefetch_slot_free(&g_prefetch.slots[i]);
+        }
+        pthread_mutex_unlock(&g_prefetch.mu);
+}
+
+static void
+prefetch_stop(void)
+{
+        if (!g_prefetch.running) return;
+
+        pthread_mutex_lock(&g_prefetch.mu);
+        g_prefetch.stop = 1;
+        atomic_fetch_add(&g_prefetch.gen, 1);
+        pthread_cond_signal(&g_prefetch.cv);
+        pthread_mutex_unlock(&g_prefetch.mu);
+
+        pthread_join(g_prefetch.th, NULL);
+        pthread_cond_destroy(&g_prefetch.cv);
+        g_prefetch.running = 0;
+
+        prefetch_flush();
+}
+
+// Called after every frame with the cursor where it rests now. The
+// dwell starts over, and the read in flight is cancelled, only if the
+// directories to prefetch changed.
+static void
+prefetch_hint(const ie_context *ctx)
+{
+        char want[2][PATH_MAX] = {{0}};
+
+        if (!g_prefetch.running) return;
+
+        if (ctx->entries.i < ctx->entries.fes.len) {
+                const FE *fe = ctx->entries.fes.data[ctx->entries.i];
+                if (S_ISDIR(fe->st.st_mode) && strcmp(fe->name, ".") && strcmp(fe->name, "..")) {
+                        snprintf(want[0], PATH_MAX, "%s/%s", ctx->filepath, fe->name);
+                }
+        }
+        if (strcmp(ctx->filepath, "/")) snprintf(want[1], PATH_MAX, "%s/..", ctx->filepath);
+
+        pthread_mutex_lock(&g_prefetch.mu);
+        if (strcmp(want[0], g_prefetch.want[0]) || strcmp(want[1], g_prefetch.want[1])) {
+                memcpy(g_prefetch.want, want, sizeof(want));
+                g_prefetch.next = 0;
+                g_prefetch.due  = timespec_in(PREFETCH_DWELL_MS);
+                atomic_fetch_add(&g_prefetch.gen, 1);
+                pthread_cond_signal(&g_prefetch.cv);
+        }
+        pthread_mutex_unlock(&g_prefetch.mu);
+}
+
+// Moves a prefetched listing of the directory `st` into `fes`, which
+// must be empty. Returns 0 if there is none.
+static int
+prefetch_take(const struct stat *st,
+              FE_array          *fes)
+{
+        if (!g_prefetch.running) return 0;
+
+        pthread_mutex_lock(&g_prefetch.mu);
+        prefetch_slot *slot = prefetch_find(st);
+        if (slot) {
+                dyn_array_free(*fes);
+                *fes = slot->fes;
+                slot->fes = dyn_array_empty(FE_array);
+                prefetch_slot_free(slot);
+        }
+        pthread_mutex_unlock(&g_prefetch.mu);
+
+        return slot != NULL;
+}
+
+// Shell commands. `!` starts the command in the background, with its
+// output and errors on a pipe, and browsing goes on meanwhile. The UI
+// drains the pipe from wait_for_input() into a ring of JOB_OUTPUT_CAP
+// bytes. When the ring is full the oldest lines are dropped, so a
+// command that never stops printing takes no more memory. The status
+// line shows the command and how it ended, and `o` opens its output in
+// job_view().
+//
+// One command runs at a time. It gets its own process group so that it
+// can be stopped as a whole.
+//
+
+#define JOB_OUTPUT_CAP   (4u*1024*1024)
+#define JOB_READ_CHUNK   65536
+#define JOB_REDRAW_MS    50
+#define JOB_REAP_POLL_MS 50
+
+struct {
+        char            *cmd;     // NULL before the first command
+        pid_t            pid;     // 0 once reaped
+        int              fd;      // the read end of the output, -1 after EOF
+        int              status;  // from waitpid()
+        int              viewing; // job_view() is open
+        int              dirty;   // output job_view() did not draw yet
+        int              finished; // reaped, display() did not look again yet
+        dev_t            dev;     // of the directory the command runs in
+        ino_t            ino;
+        struct timespec  drawn;   // when job_view() last drew
+        struct {
+                char    *buf;     // JOB_OUTPUT_CAP bytes
+                size_t   start;   // of the oldest byte
+                size_t   len;
+                size_t   dropped; // lines
+                size_t   total;   // bytes ever read
+        } out;
+} g_job = {
+        .cmd     = NULL,
+        .pid     = 0,
+        .fd      = -1,
+        .status  = 0,
+        .viewing = 0,
+        .dirty   = 0,
+        .finished = 0,
+        .out     = {0},
+};
+
+static void
+job_append(const char *p,
+           size_t      n)
+{
+        size_t cap = JOB_OUTPUT_CAP;
+
+        if (n > cap) {
+                p += n - cap;
+                n  = cap;
+        }
+
+        // Make room by dropping whole lines from the front.
+        if (g_job.out.len + n > cap) {
+                size_t drop = g_job.out.len + n - cap;
+                while (drop < g_job.out.len && g_job.out.buf[(g_job.out.start + drop - 1) % cap] != '\n') {
+                        ++drop;
+                }
+                for (size_t i = 0; i < drop; ++i) {
+                        g_job.out.dropped += g_job.out.buf[(g_job.out.start + i) % cap] == '\n';
+                }
+                g_job.out.start = (g_job.out.start + drop) % cap;
+                g_job.out.len  -= drop;
+        }
+
+        size_t end   = (g_job.out.start + g_job.out.len) % cap;
+        size_t first = n < cap - end ? n : cap - end;
+        memcpy(g_job.out.buf + end, p, first);
+        memcpy(g_job.out.buf, p + first, n - first);
+        g_job.out.len   += n;
+        g_job.out.total += n;
+}
+
+// Returns whether the command ended since the last call. Its output
+// may go on, from programs it left running.
+static int
+job_reap(void)
+{
+        const ie_proc *p = g_job.pid ? proc_find(g_job.pid) : NULL;
+        if (!p || p->running) return 0;
+
+        g_job.status   = p->status;
+        g_job.pid      = 0;
+        g_job.finished = 1;
+
+        // The command may have changed anything, entries in place too,
+        // which leaves the mtime of their directory as it was.
+        for (size_t i = 0; i < g_state.ctxs.len; ++i) {
+                ie_context *ctx = g_state.ctxs.data[i];
+                if (ctx->entries.dir.st_dev == g_job.dev && ctx->entries.dir.st_ino == g_job.ino) {
+                        ctx->stale = 1;
+                }
+        }
+        prefetch_flush();
+        return 1;
+}
+
+// Reads what the command wrote so far, a bounded amount per call so
+// that a flood of output cannot hold up the UI.
+static void
+job_drain(void)
+{
+        char buf[JOB_READ_CHUNK];
+
+        for (size_t i = 0; g_job.fd != -1 && i < JOB_OUTPUT_CAP / JOB_READ_CHUNK; ++i) {
+                ssize_t n = read(g_job.fd, buf, sizeof(buf));
+                if (n > 0) {
+                        job_append(buf, (size_t)n);
+                        g_job.dirty = 1;
+                        continue;
+                }
+                if (n == -1 && (errno == EINTR)) continue;
+                if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+
+                close(g_job.fd);
+                g_job.fd = -1;
+        }
+}
+
+static int
+job_start(const char *cmdline,
+          int         dirfd)
+{
+        int fds[2];
+
+        if (!g_job.out.buf && !(g_job.out.buf = (char *)malloc(JOB_OUTPUT_CAP))) return 0;
+        if (pipe(fds) != 0) return 0;
+
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+        posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+        posix_spawn_file_actions_adddup2(&actions, fds[1], STDERR_FILENO);
+        posix_spawn_file_actions_addclose(&actions, fds[0]);
+        posix_spawn_file_actions_addclose(&actions, fds[1]);
+
+        char *const argv[] = { "sh", "-c", (char *)cmdline, NULL };
+        pid_t       pid    = proc_spawn("/bin/sh", argv, /*search=*/0, &actions, /*pgroup=*/1, dirfd);
+
+        posix_spawn_file_actions_destroy(&actions);
+        close(fds[1]);
+        if (pid == -1) {
+                close(fds[0]);
+                return 0;
+        }
+
+        if (g_job.fd != -1) close(g_job.fd);
+
+        struct stat st;
+        if (fstat(dirfd, &st) != 0) memset(&st, 0, sizeof(st));
+
+        fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+        fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+
+        free(g_job.cmd);
+        g_job.cmd         = strdup(cmdline);
+        g_job.pid         = pid;
+        g_job.fd          = fds[0];
+        g_job.status      = 0;
+        g_job.dirty       = 1;
+        g_job.dev         = st.st_dev;
+        g_job.ino         = st.st_ino;
+        g_job.out.start   = 0;
+        g_job.out.len     = 0;
+        g_job.out.dropped = 0;
+        g_job.out.total   = 0;
+
+        return 1;
+}
+
+// Hangs up on the command, when ie quits or from job_view().
+static void
+job_stop(int sig)
+{
+        if (g_job.pid) kill(-g_job.pid, sig);
+}
+
+static void
+job_status(void)
+{
+        if (!g_job.cmd) return;
+
+        int wide = strlen(g_job.cmd) > 24;
+        printf("  " BOLD "!" RESET " %.*s%s: ", 24, g_job.cmd, wide ? "..." : "");
+
+        if (g_job.pid) {
+                printf(YELLOW "running" RESET " %s", human_size((off_t)g_job.out.total));
+        } else if (WIFEXITED(g_job.status) && WEXITSTATUS(g_job.status) == 0) {
+                printf(GREEN "done" RESET);
+        } else if (WIFEXITED(g_job.status)) {
+                printf(RED "exit %d" RESET, WEXITSTATUS(g_job.status));
+        } else if (WIFSIGNALED(g_job.status)) {
+                printf(RED "%s" RESET, strsignal(WTERMSIG(g_job.status)));
+        }
+        printf(GRAY " (o)" RESET);
+}
+
+// Options of the config that map onto g_config.flags. Toggles made
+// with keys stay in effect unless the config sets the option itself.
+static void
+apply_config_flags(ie_snapshot *snap)
+{
+        int ghost;
+        if (qcl_key_bool(&snap->config, &g_keys.showghost, &ghost)) {
+                if (ghost) g_config.flags |= FT_SHOWGHOST;
+                else       g_config.flags &= ~FT_SHOWGHOST;
+        }
+}
+
+// Drain the messages of the watcher. Called by the UI thread.
+static void
+handle_reload(void)
+{
+        reload_msg msgs[8];
+        ssize_t    n;
+
+        while ((n = read(g_watch.notify[0], msgs, sizeof(msgs))) > 0) {
+                for (size_t i = 0; i < (size_t)n / sizeof(reload_msg); ++i) {
+                        if (msgs[i].ok) {
+                                g_config.reload_err[0] = '\0';
+                                apply_config_flags(snapshot_get());
+                        } else {
+                                snprintf(g_config.reload_err, sizeof(g_config.reload_err), "%s", msgs[i].err);
+                        }
+                }
+        }
+}
+
+static int
+clicked(ie_context *ctx,
+        const char  *to)
+{
+        const FE   *fe = ctx->entries.fes.data[ctx->entries.i];
+        struct stat st;
+
+        if (fstatat(ctx->dirfd, to, &st, 0) == 0 && S_ISDIR(st.st_mode)) {
+                if (!context_enter(ctx, to)) {
+                        perror(to);
+                        any_key();
+                        return 0;
+                }
+                if (!strcmp(to, "..") && ctx->stack.len > 0) {
+                        ctx->entries.i = ctx->stack.data[ctx->stack.len-1];
+                        --ctx->stack.len;
+                }
+                else
+                        dyn_array_append(ctx->stack, ctx->entries.i);
+                return 1;
+        } else if (!fe->stat_failed
+                   && (fe->st.st_mode & (S_IXUSR|S_IXGRP|S_IXOTH))
+                   && endswith(fe->name) == NULL) {
+                str_array args = dyn_array_empty(str_array);
+                dyn_array_append(args, fe->name);
+
+                char *prompt = forge_rdln("Arguments: ");
+
+                char *tok = strtok(prompt, " ");
+                while (tok) {
+                        dyn_array_append(args, strdup(tok));
+                        tok = strtok(prompt, tok);
+                }
+                dyn_array_append(args, NULL);
+
+                pid_t pid = proc_spawn(fe->name, args.data, /*search=*/0, NULL, /*pgroup=*/0, ctx->dirfd);
+
+                if (pid == -1) perror(fe->name);
+                else           (void)proc_wait(pid);
+
+                any_key();
+
+                dyn_array_free(args);
+
+                return 1;
+        } else {
+                char         path[PATH_MAX];
+                ie_snapshot *snap     = snapshot_get();
+                const char  *ext      = endswith(to);
+
+                snprintf(path, sizeof(path), "%s/%s", ctx->filepath, to);
+                const char  *openwith = opener_index_lookup(&snap->openers, &snap->config, path, to);
+
+                if (openwith) goto do_cmd;
+
+                openwith = forge_rdln("Open file with (leave empty to view txt): ");
+
+                if (!openwith || strlen(openwith) == 0) {
+                        char **lns = forge_io_read_file_to_lines(path);
+                        size_t lns_n;
+                        for (lns_n = 0; lns[lns_n]; ++lns_n);
+                        forge_viewer *v = forge_viewer_alloc(lns, lns_n, 1);
+                        forge_viewer_display(v);
+                        forge_viewer_free(v);
+                        for (size_t i = 0; i < lns_n; ++i) free(lns[i]);
+                        free(lns);
+                        return 0;
+                }
+                if (ext) {
+                        // Save 'openwith' for future uses. This is queued
+                        // and appended to the config once the loop is idle.
+                        (void)qcl_writer_set_string(&g_config.writer, ext, openwith);
+
+                        // Snapshots are immutable, remember it on the side
+                        // until the appended config is reloaded.
+                        const char **old = opener_strmap_get(&g_learned, ext);
+                        if (old) {
+                                free((char *)*old);
+                                *old = strdup(openwith);
+                        } else {
+                                opener_strmap_insert(&g_learned, strdup(ext), strdup(openwith));
+                        }
+                }
+do_cmd:
+                assert(openwith);
+                exec_cmd(openwith, to, ctx->dirfd);
+        }
+        return 0;
+}
+
+static void
+remove_selection(ie_context *ctx)
+{
+        str_array confirm = dyn_array_empty(str_array);
+        size_t_array indices = dyn_array_empty(size_t_array);
+
+        if (marks_count(&ctx->marked) > 0) {
+                for (size_t i = marks_next(&ctx->marked, 0); i < ctx->entries.fes.len; i = marks_next(&ctx->marked, i+1)) {
+                        char *path = ctx->entries.fes.data[i]->name;
+                        if (!strcmp(path, "..") || !strcmp(path, ".")) {
+                                continue;
+                        }
+                        dyn_array_append(confirm, path);
+                        dyn_array_append(indices, i);
+                }
+        } else {
+                if (ctx->entries.i >= ctx->entries.fes.len) return;
+                char *path = ctx->entries.fes.data[ctx->entries.i]->name;
+                if (!strcmp(path, "..") || !strcmp(path, ".")) {
+                        return;
+                }
+                dyn_array_append(confirm, path);
+        }
+
+        forge_ctrl_clear_terminal();
+        for (size_t i = 0; i < confirm.len; ++i) {
+                printf(RED BOLD "--- %s" RESET "\n", confirm.data[i]);
+        }
+
+        int choice = forge_chooser_yesno("Remove these files?", NULL, 1);
+        if (choice) {
+                for (size_t i = 0; i < confirm.len; ++i) {
+                        rm_at(ctx->dirfd, confirm.data[i]);
+                        if (indices.len > 0) {
+                                marks_set(&ctx->marked, indices.data[i], 0);
+                        }
+                }
+        }
+
+        dyn_array_free(confirm);
+        dyn_array_free(indices);
+}
+
+static void
+clearln(ie_context *ctx)
+{
+        for (size_t i = 0; i < ctx->term.w; ++i) putchar(' ');
+        forge_ctrl_cursor_to_col(1);
+}
+
+static int
+rename_selection(ie_context *ctx)
+{
+        if (ctx->entries.i >= ctx->entries.fes.len) return 0;
+
+        CURSOR_UP(1);
+        clearln(ctx);
+
+        const char *path = ctx->entries.fes.data[ctx->entries.i]->name;
+        printf(BOLD WHITE "Rename [" YELLOW "%s" RESET "]" RESET, path);
+
+        forge_ctrl_cursor_to_first_line();
+        CURSOR_DOWN(ctx->entries.i + 1);
+        forge_ctrl_cursor_to_col(strlen(path)+1);
+
+        char *s = forge_rdln(NULL);
 
         if (!s || strlen(s) == 0) return 0;
 
-        if (rename(path, s) != 0) {
+        uint64_t t0 = TRACE_BEGIN();
+        if (renameat(ctx->dirfd, path, ctx->dirfd, s) != 0) {
                 forge_err_wargs("failed to rename `%s` to `%s`", path, s);
         }
+        TRACE_SYSCALLS(1);
+        TRACE_END_OP("rename", path, t0);
+
+        return 1;
+}
+
+// Bulk rename. The names to rename are written to a file, one per
+// line, and the user edits them in $VISUAL or $EDITOR. Line i of the
+// saved file is the new name of the i-th entry. The whole plan is
+// checked before anything is renamed: every name must be valid, no two
+// entries may get the same name, and no name may be taken by a file
+// that is not renamed away.
+//
+// Renames can depend on each other. `a b` to `b c` must rename b
+// first, and `a b` to `b a` is a cycle. Every target is unique, so
+// each rename vacates a name for at most one other. The renames form
+// chains and cycles. A chain is applied from its free end back, and a
+// cycle by parking one of its files under a temporary name first.
+// Nothing is ever replaced: renames use renameat2(RENAME_NOREPLACE) on
+// the directory, so a file created after the check stops the plan
+// instead of being lost.
+
+#ifndef RENAME_NOREPLACE
+#define RENAME_NOREPLACE (1 << 0)
+#endif
+
+#define RENAME_ERRORS_SHOWN 20
+
+typedef struct {
+        const char *src;
+        char       *dst;
+        long        next; // the rename out of dst, -1 if dst is free
+        long        prev; // the rename into src, -1 for none
+        int         done;
+} rename_move;
+
+DYN_ARRAY_TYPE(rename_move, rename_move_array);
+
+typedef struct {
+        int    dirfd;
+        size_t renamed;
+        size_t parked; // cycles broken through a temporary name
+        char   failed[PATH_MAX + 64];
+} rename_apply;
+
+static rename_move_array *g_rename_sort = NULL;
+
+static int
+rename_src_compar(const void *a,
+                  const void *b)
+{
+        return strcmp(g_rename_sort->data[*(const long *)a].src,
+                      g_rename_sort->data[*(const long *)b].src);
+}
+
+static int
+rename_src_find(const void *key,
+                const void *b)
+{
+        return strcmp((const char *)key, g_rename_sort->data[*(const long *)b].src);
+}
+
+static int
+rename_dst_compar(const void *a,
+                  const void *b)
+{
+        return strcmp(g_rename_sort->data[*(const long *)a].dst,
+                      g_rename_sort->data[*(const long *)b].dst);
+}
+
+// Falls back to a check and rename() on file systems without
+// RENAME_NOREPLACE, which leaves a window for a race.
+static int
+rename_noreplace(int         dirfd,
+                 const char *from,
+                 const char *to)
+{
+        if (syscall(SYS_renameat2, dirfd, from, dirfd, to, RENAME_NOREPLACE) == 0) return 0;
+        if (errno != EINVAL && errno != ENOSYS) return -1;
+
+        struct stat st;
+        if (fstatat(dirfd, to, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+                errno = EEXIST;
+                return -1;
+        }
+        return renameat(dirfd, from, dirfd, to);
+}
+
+static int
+rename_step(rename_apply *ap,
+            const char   *from,
+            const char   *to)
+{
+        TRACE_SYSCALLS(1);
+        if (rename_noreplace(ap->dirfd, from, to) == 0) return 1;
+
+        snprintf(ap->failed, sizeof(ap->failed), "%s -> %s: %s", from, to, strerror(errno));
+        return 0;
+}
+
+// Applies the renames of the chain that ends with `i`, back to its
+// start, i.e. each one once the name it takes was vacated.
+static int
+rename_chain(rename_apply      *ap,
+             rename_move_array *moves,
+             long               i,
+             long               stop)
+{
+        for (; i != -1 && i != stop; i = moves->data[i].prev) {
+                if (!rename_step(ap, moves->data[i].src, moves->data[i].dst)) return 0;
+                moves->data[i].done = 1;
+                ++ap->renamed;
+        }
+        return 1;
+}
+
+static int
+rename_cycle(rename_apply      *ap,
+             rename_move_array *moves,
+             long               k)
+{
+        rename_move *m = &moves->data[k];
+        char         tmp[64];
+
+        // Park the src of k, which frees it for the rename before k.
+        for (unsigned n = 0;; ++n) {
+                snprintf(tmp, sizeof(tmp), ".ie-rename-%ld-%u", (long)getpid(), n);
+                TRACE_SYSCALLS(1);
+                if (rename_noreplace(ap->dirfd, m->src, tmp) == 0) break;
+                if (errno != EEXIST) {
+                        snprintf(ap->failed, sizeof(ap->failed), "%s -> %s: %s", m->src, tmp, strerror(errno));
+                        return 0;
+                }
+        }
+        ++ap->parked;
+
+        if (!rename_chain(ap, moves, m->prev, k)) {
+                snprintf(ap->failed + strlen(ap->failed), sizeof(ap->failed) - strlen(ap->failed),
+                         " (%s is parked as %s)", m->src, tmp);
+                return 0;
+        }
+        if (!rename_step(ap, tmp, m->dst)) return 0;
+
+        m->done = 1;
+        ++ap->renamed;
+        return 1;
+}
+
+// Runs the editor on `path` with the terminal as it was before ie.
+static int
+edit_file(const char *path)
+{
+        const char *editor = getenv("VISUAL");
+        if (!editor || !*editor) editor = getenv("EDITOR");
+        if (!editor || !*editor) editor = "vi";
+
+        forge_ctrl_clear_terminal();
+        (void)forge_ctrl_disable_raw_terminal(STDIN_FILENO, &g_config.term.t);
+
+        // The editor may come with arguments, as for git.
+        char script[PATH_MAX];
+        snprintf(script, sizeof(script), "%s \"$1\"", editor);
+
+        char *const argv[] = { "sh", "-c", script, "sh", (char *)path, NULL };
+        int         status = -1;
+        pid_t       pid    = proc_spawn("/bin/sh", argv, /*search=*/0, NULL, /*pgroup=*/0, -1);
+        if (pid > 0) status = proc_wait(pid);
+
+        (void)forge_ctrl_enable_raw_terminal(STDIN_FILENO, &g_config.term.t);
+
+        return status != -1 && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// Validates the edited names and fills `moves` with the ones that
+// changed. Problems are printed, returns their count.
+static size_t
+rename_plan(int                 dirfd,
+            FILE               *fp,
+            const char        **srcs,
+            size_t              n,
+            rename_move_array  *moves)
+{
+        size_t  errors = 0;
+        size_t  lineno = 0;
+        char   *line   = NULL;
+        size_t  cap    = 0;
+        ssize_t len;
+
+#define RENAME_ERROR(...)                                                       \
+        do {                                                                    \
+                if (errors++ < RENAME_ERRORS_SHOWN) {                           \
+                        printf(RED "  " __VA_ARGS__);                           \
+                        printf(RESET "\n");                                     \
+                }                                                               \
+        } while (0)
+
+        while ((len = getline(&line, &cap, fp)) != -1) {
+                if (len > 0 && line[len-1] == '\n') line[--len] = '\0';
+                if (lineno++ >= n) continue;
+
+                const char *src = srcs[lineno-1];
+                if (!strcmp(line, src)) continue;
+
+                if (!*line || !strcmp(line, ".") || !strcmp(line, "..") || strchr(line, '/')) {
+                        RENAME_ERROR("line %zu: `%s` is not a file name", lineno, line);
+                        continue;
+                }
+                if (strlen(line) > NAME_MAX) {
+                        RENAME_ERROR("line %zu: the name is too long", lineno);
+                        continue;
+                }
+
+                rename_move m = {
+                        .src  = src,
+                        .dst  = strdup(line),
+                        .next = -1,
+                        .prev = -1,
+                        .done = 0,
+                };
+                dyn_array_append(*moves, m);
+        }
+        free(line);
+
+        if (lineno != n) {
+                RENAME_ERROR("%zu lines for %zu names, lines must not be added or removed", lineno, n);
+                return errors;
+        }
+        if (errors || !moves->len) return errors;
+
+        long *by_src = (long *)malloc(moves->len * sizeof(long));
+        long *by_dst = (long *)malloc(moves->len * sizeof(long));
+        for (size_t i = 0; i < moves->len; ++i) by_src[i] = by_dst[i] = (long)i;
+
+        g_rename_sort = moves;
+        qsort(by_src, moves->len, sizeof(long), rename_src_compar);
+        qsort(by_dst, moves->len, sizeof(long), rename_dst_compar);
+
+        for (size_t i = 1; i < moves->len; ++i) {
+                const char *dst = moves->data[by_dst[i]].dst;
+                if (!strcmp(moves->data[by_dst[i-1]].dst, dst)) {
+                        RENAME_ERROR("more than one file renamed to `%s`", dst);
+                }
+        }
+
+        // A target must be free unless its file is renamed away too.
+        struct stat st;
+        for (size_t i = 0; i < moves->len; ++i) {
+                rename_move *m   = &moves->data[i];
+                long        *hit = (long *)bsearch(m->dst, by_src, moves->len, sizeof(long), rename_src_find);
+
+                TRACE_SYSCALLS(2);
+                if (fstatat(dirfd, m->src, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+                        RENAME_ERROR("`%s` is gone", m->src);
+                }
+                if (hit) {
+                        m->next = *hit;
+                        moves->data[*hit].prev = (long)i;
+                } else if (fstatat(dirfd, m->dst, &st, AT_SYMLINK_NOFOLLOW) == 0 || errno != ENOENT) {
+                        RENAME_ERROR("`%s` already exists", m->dst);
+                }
+        }
+
+        g_rename_sort = NULL;
+        free(by_src);
+        free(by_dst);
+
+#undef RENAME_ERROR
+
+        return errors;
+}
+
+static int
+bulk_rename(ie_context *ctx)
+{
+        const FE_array *fes = &ctx->entries.fes;
+        const char    **srcs = (const char **)malloc(fes->len * sizeof(char *));
+        size_t          n    = 0;
+        size_t          skipped = 0;
+        int             all  = marks_count(&ctx->marked) == 0;
+
+        for (size_t i = 2; i < fes->len; ++i) {
+                if (!all && !marks_test(&ctx->marked, i)) continue;
+                // A name with a newline cannot be a line of the file.
+                if (strchr(fes->data[i]->name, '\n')) ++skipped;
+                else                                   srcs[n++] = fes->data[i]->name;
+        }
+
+        rename_move_array moves = dyn_array_empty(rename_move_array);
+        rename_apply      ap    = { .dirfd = ctx->dirfd, .renamed = 0, .parked = 0, .failed = {0} };
+        char              path[PATH_MAX];
+        const char       *tmpdir = getenv("TMPDIR");
+        FILE             *fp     = NULL;
+        int               fd;
+
+        snprintf(path, sizeof(path), "%s/ie-rename-XXXXXX", tmpdir && *tmpdir ? tmpdir : "/tmp");
+        if (!n || (fd = mkstemp(path)) == -1) {
+                free(srcs);
+                return 0;
+        }
+        if ((fp = fdopen(fd, "w+"))) {
+                for (size_t i = 0; i < n; ++i) fprintf(fp, "%s\n", srcs[i]);
+                fflush(fp);
+        }
+
+        uint64_t t0 = TRACE_BEGIN();
+
+        if (!fp || ferror(fp)) {
+                printf(RED "could not write %s: %s" RESET "\n", path, strerror(errno));
+                goto out;
+        }
+        if (!edit_file(path)) {
+                forge_ctrl_clear_terminal();
+                printf(RED "the editor failed, nothing was renamed" RESET "\n");
+                goto out;
+        }
+
+        // Editors may replace the file rather than write to it.
+        fclose(fp);
+        fd = -1;
+        if (!(fp = fopen(path, "r"))) goto out;
+
+        forge_ctrl_clear_terminal();
+        ap.dirfd = ctx->dirfd;
+
+        size_t errors = rename_plan(ap.dirfd, fp, srcs, n, &moves);
+        if (errors) {
+                if (errors > RENAME_ERRORS_SHOWN) printf(RED "  and %zu more" RESET "\n", errors - RENAME_ERRORS_SHOWN);
+                printf(BOLD "%zu problem%s, nothing was renamed" RESET "\n", errors, errors == 1 ? "" : "s");
+                goto out;
+        }
+        if (!moves.len) {
+                printf(BOLD "no name was changed" RESET "\n");
+                goto out;
+        }
+
+        // Chains first, what is left over are cycles.
+        int ok = 1;
+        for (size_t i = 0; ok && i < moves.len; ++i) {
+                if (moves.data[i].next == -1) ok = rename_chain(&ap, &moves, (long)i, -1);
+        }
+        for (size_t i = 0; ok && i < moves.len; ++i) {
+                if (!moves.data[i].done) ok = rename_cycle(&ap, &moves, (long)i);
+        }
+
+        printf(BOLD "renamed %zu of %zu" RESET, ap.renamed, moves.len);
+        if (ap.parked)  printf(", %zu cycle%s", ap.parked, ap.parked == 1 ? "" : "s");
+        if (n > moves.len) printf(", %zu unchanged", n - moves.len);
+        if (skipped)    printf(", %zu name%s with a newline left out", skipped, skipped == 1 ? "" : "s");
+        printf("\n");
+        if (!ok) printf(RED "stopped at %s" RESET "\n", ap.failed);
+
+ out:
+        TRACE_END_OP("bulk-rename", ctx->filepath, t0);
+
+        if (fp)           fclose(fp);
+        else if (fd != -1) close(fd);
+        unlink(path);
+        for (size_t i = 0; i < moves.len; ++i) free(moves.data[i].dst);
+        dyn_array_free(moves);
+        free(srcs);
 
-        return 1;
+        any_key();
+
+        return ap.renamed > 0;
 }
 
 static void
@@ -487,8 +2688,6 @@ search(ie_context *ctx,
        int          jmp,
        int          rev)
 {
-        NOOP(rev);
-
         if (!jmp) {
                 CURSOR_UP(1);
                 ctx->last_query = forge_rdln("Query: ");
@@ -496,21 +2695,7 @@ search(ie_context *ctx,
                 return;
         }
 
-        if (!rev) {
-                for (size_t i = ctx->entries.i+1; i < ctx->entries.fes.len; ++i) {
-                        if (forge_utils_regex(ctx->last_query, ctx->entries.fes.data[i]->name)) {
-                                ctx->entries.i = i;
-                                break;
-                        }
-                }
-        } else {
-                for (size_t i = ctx->entries.i-1; i > 0; --i) {
-                        if (forge_utils_regex(ctx->last_query, ctx->entries.fes.data[i]->name)) {
-                                ctx->entries.i = i;
-                                break;
-                        }
-                }
-        }
+        ctx->entries.i = listing_search(&ctx->entries.fes, ctx->entries.i, ctx->last_query, rev);
 }
 
 static char **
@@ -533,296 +2718,832 @@ buffers_as_strings(const ie_context *ctx, size_t *paths_n)
                 }
         }
 
-        *paths_n = ar.len;
-        return ar.data;
+        *paths_n = ar.len;
+        return ar.data;
+}
+
+static int
+manual_directory_entry(ie_context *ctx)
+{
+        char *dir = forge_rdln("cd: ");
+
+        int   ok  = dir && *dir && context_enter(ctx, dir);
+
+        if (dir && *dir && !ok) {
+                perror(dir);
+                any_key();
+        }
+        free(dir);
+        return ok;
+}
+
+static int
+ctrl_x(ie_context *ctx)
+{
+        char ch;
+        forge_ctrl_input_type ty = forge_ctrl_get_input(&ch);
+
+        if (ty == USER_INPUT_TYPE_NORMAL && ch == '\n') {
+                return clicked(ctx, "..");
+        } else if (ty == USER_INPUT_TYPE_CTRL && ch == CTRL_Q) {
+                return rename_selection(ctx);
+        } else if (ty == USER_INPUT_TYPE_NORMAL && ch == 'c') {
+                dyn_array_append(g_state.ctxs, ie_context_alloc(ctx->filepath));
+                g_state.ctxs_i = g_state.ctxs.len-1;
+                return 0;
+        } else if (ty == USER_INPUT_TYPE_NORMAL && ch == 'b') {
+                size_t ctxs_n = g_state.ctxs.len;
+                char **choices = (char **)malloc(sizeof(char *) * ctxs_n);
+                for (size_t i = 0; i < ctxs_n; ++i) {
+                        choices[i] = g_state.ctxs.data[i]->filepath;
+                }
+                int choice = forge_chooser("Choose Buffer",
+                                           (const char **)choices,
+                                           ctxs_n, g_state.ctxs_i);
+
+                free(choices);
+
+                if (choice == -1)             return 0;
+                if (choice == g_state.ctxs_i) return 0;
+
+                // Not a change of the file system, display() revalidates
+                // the listing of the buffer.
+                g_state.ctxs_i = choice;
+
+                return 0;
+        } else if (ty == USER_INPUT_TYPE_CTRL && ch == CTRL_F) {
+                return manual_directory_entry(ctx);
+        }
+
+ bad:
+        CURSOR_UP(1);
+        clearln(ctx);
+        printf(INVERT BOLD RED "C-x: Unknown Sequence" RESET "\n");
+        minisleep();
+        return 0;
+}
+
+static void
+mark_or_unmark_selection(ie_context *ctx, int mark)
+{
+        if (ctx->entries.i == 0) {
+                marks_range(&ctx->marked, 2, ctx->entries.fes.len, mark ? MARK_SET : MARK_CLEAR);
+        } else if (ctx->entries.i != 1) {
+                marks_set(&ctx->marked, ctx->entries.i, mark);
+                ctx->marked.anchor = ctx->entries.i;
+                selection_down(ctx);
+        }
+
+}
+
+static void
+invert_marks(ie_context *ctx)
+{
+        marks_range(&ctx->marked, 2, ctx->entries.fes.len, MARK_FLIP);
+}
+
+// Marks every row between the one last marked or unmarked and the
+// selection.
+static void
+mark_to_selection(ie_context *ctx)
+{
+        size_t from = ctx->marked.anchor ? ctx->marked.anchor : ctx->entries.i;
+        size_t to   = ctx->entries.i;
+
+        if (from > to) {
+                size_t tmp = from;
+                from = to;
+                to   = tmp;
+        }
+        if (from < 2) from = 2;
+
+        marks_range(&ctx->marked, from, to+1, MARK_SET);
+        ctx->marked.anchor = ctx->entries.i;
+}
+
+static int
+move_selection(ie_context *ctx)
+{
+        // Fail if no other buffer is open.
+        if (g_state.ctxs.len == 1) {
+                // TODO: add error message
+                return 0;
+        }
+
+        size_t paths_n = 0;
+        char **paths = buffers_as_strings(ctx, &paths_n);
+        int choice = forge_chooser("Choose Buffer",
+                                   (const char **)paths,
+                                   paths_n, 0);
+
+        free(paths);
+        if (choice == -1) return 0;
+
+        if (marks_count(&ctx->marked) > 0) {
+                // move multiple files
+                mark_bits  *m    = &ctx->marked;
+                size_t      len  = ctx->entries.fes.len;
+                ie_context *dest = g_state.ctxs.data[choice];
+                for (size_t i = marks_next(m, 0); i < len; i = marks_next(m, i+1)) {
+                        char *oldpath_rel = ctx->entries.fes.data[i]->name;
+                        printf("%s/%s -> %s/%s\n", ctx->filepath, oldpath_rel, dest->filepath, oldpath_rel);
+                }
+
+                int yes = forge_chooser_yesno("Move?", NULL, 1);
+                if (yes) {
+                        for (size_t i = marks_next(m, 0); i < len; i = marks_next(m, i+1)) {
+                                char *oldpath_rel = ctx->entries.fes.data[i]->name;
+                                char *oldpath = forge_cstr_builder(ctx->filepath, "/", oldpath_rel, NULL);
+                                char *newpath = forge_cstr_builder(dest->filepath, "/", oldpath_rel, NULL);
+                                uint64_t t0 = TRACE_BEGIN();
+                                if (renameat(ctx->dirfd, oldpath_rel, dest->dirfd, oldpath_rel) != 0) {
+                                        perror("rename");
+                                        forge_err_wargs("failed to move `%s` to `%s`", oldpath, newpath);
+                                }
+                                TRACE_SYSCALLS(1);
+                                TRACE_END_OP("move", oldpath, t0);
+                                free(newpath);
+                                free(oldpath);
+                                marks_set(m, i, 0);
+                        }
+                        return 1;
+                }
+                return 0;
+        } else if (ctx->entries.i < ctx->entries.fes.len) {
+                // single file
+                ie_context *dest        = g_state.ctxs.data[choice];
+                char       *oldpath_rel = ctx->entries.fes.data[ctx->entries.i]->name;
+                char       *oldpath     = forge_cstr_builder(ctx->filepath, "/", oldpath_rel, NULL);
+                char       *newpath     = forge_cstr_builder(dest->filepath, "/", oldpath_rel, NULL);
+
+                printf("%s -> %s\n", oldpath, newpath);
+                int yes = forge_chooser_yesno("Move?", NULL, 1);
+
+                if (yes) {
+                        uint64_t t0 = TRACE_BEGIN();
+                        if (renameat(ctx->dirfd, oldpath_rel, dest->dirfd, oldpath_rel) != 0) {
+                                perror("rename");
+                                forge_err_wargs("failed to move `%s` to `%s`", oldpath, newpath);
+                        }
+                        TRACE_SYSCALLS(1);
+                        TRACE_END_OP("move", oldpath, t0);
+                        free(newpath);
+                        free(oldpath);
+                        return 1;
+                }
+                free(oldpath);
+                free(newpath);
+        }
+        return 0;
+}
+
+static void
+display_help(void)
+{
+        forge_viewer *v = forge_viewer_alloc(g_help_buffer,
+                                             sizeof(g_help_buffer)/sizeof(*g_help_buffer), 0);
+        forge_viewer_display(v);
+        forge_viewer_free(v);
+}
+
+static int
+do_command(ie_context *ctx)
+{
+        CURSOR_UP(1);
+        char *command = forge_rdln(": ");
+
+        if (!command || strlen(command) == 0) return 0;
+
+        if (!strcmp(command, CMD_SEARCH)) {
+                search(ctx, /*jmp=*/0, /*rev=*/0);
+        } else if (!strcmp(command, CMD_HELP)) {
+                display_help();
+        }
+
+        return 0;
+}
+
+static void
+issue_bash_cmd(ie_context *ctx)
+{
+        if (g_job.pid) {
+                CURSOR_UP(1);
+                clearln(ctx);
+                printf(INVERT BOLD RED "a command is still running, see it with o" RESET "\n");
+                minisleep();
+                return;
+        }
+
+        char *bashcmd = forge_rdln("! ");
+
+        if (!bashcmd || strlen(bashcmd) == 0) return;
+
+        if (!job_start(bashcmd, ctx->dirfd)) {
+                perror("!");
+                any_key();
+        }
+        free(bashcmd);
+}
+
+static int
+newdir(ie_context *ctx)
+{
+        CURSOR_UP(1);
+        char *name = forge_rdln("mkdir name: ");
+
+        if (!name || strlen(name) == 0) return 0;
+
+        uint64_t t0 = TRACE_BEGIN();
+        int      rc = mkdirat(ctx->dirfd, name, 0755);
+        TRACE_SYSCALLS(1);
+        TRACE_END_OP("mkdir", name, t0);
+
+        if (rc != 0) {
+                perror("mkdir");
+                any_key();
+        }
+
+        return 1;
+}
+
+// The rows left for entries, -2 for path + status line. At least one,
+// the terminal may be smaller than that after a resize.
+static size_t
+list_rows(const ie_context *ctx)
+{
+        return ctx->term.h > 2 ? ctx->term.h - 2 : 1;
+}
+
+static void
+adjust_scroll(ie_context *ctx)
+{
+        size_t visible_lines = list_rows(ctx);
+
+        // Scroll down when selection reaches bottom of screen
+        if (ctx->entries.i >= ctx->hoffset + visible_lines) {
+                ctx->hoffset = ctx->entries.i - visible_lines + 1;
+        }
+
+        // Scroll up when selection reaches top of screen
+        if (ctx->entries.i < ctx->hoffset) {
+                ctx->hoffset = ctx->entries.i;
+        }
+
+        // Clamp hoffset to valid range
+        if (ctx->hoffset + visible_lines > ctx->entries.fes.len) {
+                ctx->hoffset = ctx->entries.fes.len > visible_lines ?
+                        ctx->entries.fes.len - visible_lines : 0;
+        }
+        if (ctx->hoffset >= ctx->entries.fes.len) {
+                ctx->hoffset = 0;
+        }
+}
+
+static void
+winch_handler(int sig)
+{
+        NOOP(sig);
+        int saved_errno = errno;
+        // Pipe is non-blocking, if it is full a redraw is already pending.
+        ssize_t _ = write(g_winch_pipe[1], "w", 1);
+        (void)_;
+        errno = saved_errno;
+}
+
+static void
+install_resize_handler(void)
+{
+        if (pipe(g_winch_pipe) != 0) {
+                forge_err("could not create SIGWINCH pipe");
+        }
+
+        for (int i = 0; i < 2; ++i) {
+                fcntl(g_winch_pipe[i], F_SETFL, fcntl(g_winch_pipe[i], F_GETFL) | O_NONBLOCK);
+                fcntl(g_winch_pipe[i], F_SETFD, FD_CLOEXEC);
+        }
+
+        struct sigaction sa = {0};
+        sa.sa_handler = winch_handler;
+        sa.sa_flags   = SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+        if (sigaction(SIGWINCH, &sa, NULL) != 0) {
+                forge_err("could not install SIGWINCH handler");
+        }
+}
+
+// Update the geometry of every context from the current terminal
+// size. Only the scroll offsets are recomputed, the cached listings
+// are left untouched.
+static void
+handle_resize(void)
+{
+        char buf[64];
+        while (read(g_winch_pipe[0], buf, sizeof(buf)) > 0);
+
+        size_t w, h;
+        if (!forge_ctrl_get_terminal_xy(&w, &h)) return;
+
+        g_config.term.w = w;
+        g_config.term.h = h;
+
+        for (size_t i = 0; i < g_state.ctxs.len; ++i) {
+                ie_context *ctx = g_state.ctxs.data[i];
+                ctx->term.w = w;
+                ctx->term.h = h;
+                adjust_scroll(ctx);
+        }
+}
+
+static long
+ns_since(const struct timespec *t0)
+{
+        struct timespec t1;
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        return (t1.tv_sec - t0->tv_sec)*1000000000L + (t1.tv_nsec - t0->tv_nsec);
+}
+
+// Block until either a key is available on stdin (returns 1) or the
+// terminal has been resized, the config reloaded or the shell command
+// ended (returns 0). Children that end are reaped. Output of the
+// command is read meanwhile, and while job_view() shows it this also
+// returns 0 at most every JOB_REDRAW_MS. The UI holds no snapshot while
+// it waits.
+static int
+wait_for_input(void)
+{
+        if (g_input.pending) return 1;
+
+        struct pollfd fds[5] = {
+                { .fd = STDIN_FILENO,       .events = POLLIN },
+                { .fd = g_winch_pipe[0],    .events = POLLIN },
+                { .fd = g_watch.notify[0],  .events = POLLIN },
+                { .fd = -1,                 .events = POLLIN },
+                { .fd = g_procs.sigfd,      .events = POLLIN },
+        };
+        int ret = 1;
+
+        reader_offline(g_ui_reader);
+
+        while (1) {
+                int timeout = -1;
+
+                // Without the signalfd the end of the command is polled for.
+                if (g_job.pid && g_procs.sigfd == -1) timeout = JOB_REAP_POLL_MS;
+                if (g_job.viewing && g_job.dirty) {
+                        long left = JOB_REDRAW_MS - ns_since(&g_job.drawn) / 1000000L;
+                        if (left <= 0) {
+                                ret = 0;
+                                break;
+                        }
+                        if (timeout == -1 || left < timeout) timeout = (int)left;
+                }
+
+                fds[3].fd = g_job.fd;
+                if (poll(fds, 5, timeout) == -1) {
+                        if (errno == EINTR) continue;
+                        break;
+                }
+
+                if (fds[3].revents) job_drain();
+                if (fds[4].revents || g_procs.sigfd == -1) proc_reap();
+                if (job_reap()) {
+                        ret = 0;
+                        break;
+                }
+
+                if (fds[1].revents & POLLIN) {
+                        handle_resize();
+                        ret = 0;
+                        break;
+                }
+
+                if (fds[2].revents & POLLIN) {
+                        reader_online(g_ui_reader);
+                        handle_reload();
+                        return 0;
+                }
+
+                if (fds[0].revents) break;
+        }
+
+        reader_online(g_ui_reader);
+        return ret;
 }
 
-static int
-manual_directory_entry(ie_context *ctx)
+static void *
+compact_config_worker(void *arg)
 {
-        char *dir = forge_rdln("cd: ");
-        char *abs = forge_io_resolve_absolute_path(dir);
+        char *fp = (char *)arg;
+        (void)qcl_writer_compact(fp);
+        free(fp);
+        return NULL;
+}
 
-        ctx->filepath = abs;
+// Drop overridden associations from the config on a detached thread.
+// Compaction only swaps the file in with rename(), so it is safe to
+// exit while it is still running.
+static void
+compact_config_async(void)
+{
+        pthread_t th;
+        char *fp = strdup(g_config.writer.fp);
 
-        free(dir);
-        return 1;
+        if (pthread_create(&th, NULL, compact_config_worker, fp) != 0) {
+                free(fp);
+                return;
+        }
+        pthread_detach(th);
 }
 
-static int
-ctrl_x(ie_context *ctx)
+static void
+persist_associations(void)
 {
-        char ch;
-        forge_ctrl_input_type ty = forge_ctrl_get_input(&ch);
-
-        if (ty == USER_INPUT_TYPE_NORMAL && ch == '\n') {
-                return clicked(ctx, "..");
-        } else if (ty == USER_INPUT_TYPE_CTRL && ch == CTRL_Q) {
-                return rename_selection(ctx);
-        } else if (ty == USER_INPUT_TYPE_NORMAL && ch == 'c') {
-                dyn_array_append(g_state.ctxs, ie_context_alloc(ctx->filepath));
-                ++g_state.ctxs_i;
-                return 1;
-        } else if (ty == USER_INPUT_TYPE_NORMAL && ch == 'b') {
-                size_t ctxs_n = g_state.ctxs.len;
-                char **choices = (char **)malloc(sizeof(char *) * ctxs_n);
-                for (size_t i = 0; i < ctxs_n; ++i) {
-                        choices[i] = g_state.ctxs.data[i]->filepath;
-                }
-                int choice = forge_chooser("Choose Buffer",
-                                           (const char **)choices,
-                                           ctxs_n, g_state.ctxs_i);
+        if (!g_config.writer.fp) return;
 
-                free(choices);
+        int n = qcl_writer_flush(&g_config.writer);
+        if (n <= 0) return;
 
-                if (choice == -1)             return 0;
-                if (choice == g_state.ctxs_i) return 0;
+        g_config.appended += n;
+        if (g_config.appended >= QCL_WRITER_COMPACT_THRESHOLD) {
+                g_config.appended = 0;
+                compact_config_async();
+        }
+}
 
-                size_t old_ctxs_i = g_state.ctxs_i;
-                g_state.ctxs_i = choice;
+static int
+input_ready(void)
+{
+        if (g_input.pending) return 1;
+        struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+        return poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN);
+}
 
-                return 1;
-        } else if (ty == USER_INPUT_TYPE_CTRL && ch == CTRL_F) {
-                return manual_directory_entry(ctx);
+static ie_key
+read_key(void)
+{
+        ie_key key;
+        if (g_input.pending) {
+                g_input.pending = 0;
+                return g_input.key;
         }
-
- bad:
-        CURSOR_UP(1);
-        clearln(ctx);
-        printf(INVERT BOLD RED "C-x: Unknown Sequence" RESET "\n");
-        minisleep();
-        return 0;
+        key.ty = forge_ctrl_get_input(&key.ch);
+        return key;
 }
 
+// Returns 1 if `key` moves the cursor by a relative amount, storing
+// the amount in `delta`.
 static int
-is_like_compar(const void *a,
-               const void *b)
+nav_delta(const ie_key *key, long *delta)
 {
-        const char *const *pa = a;
-        const char *const *pb = b;
-        const char *na = *pa;
-        const char *nb = *pb;
+        int down = 0, up = 0;
+
+        switch (key->ty) {
+        case USER_INPUT_TYPE_ARROW:
+                down = key->ch == DOWN_ARROW;
+                up   = key->ch == UP_ARROW;
+                break;
+        case USER_INPUT_TYPE_CTRL:
+                down = key->ch == CTRL_N;
+                up   = key->ch == CTRL_P;
+                break;
+        case USER_INPUT_TYPE_NORMAL:
+                down = key->ch == 'j';
+                up   = key->ch == 'k';
+                break;
+        default: break;
+        }
 
-        if (strcmp(na, ".") == 0)  return -1;
-        if (strcmp(nb, ".") == 0)  return  1;
+        *delta = down ? 1 : up ? -1 : 0;
+        return down || up;
+}
+
+// Drain every navigation key that is already queued without blocking
+// and fold them into `delta`. The first non-navigation key ends the
+// batch and is kept for the next iteration.
+static void
+coalesce_nav(long *delta)
+{
+        struct timespec t0;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+
+        while (input_ready() && ns_since(&t0) < FRAME_BUDGET_NS) {
+                ie_key next = read_key();
+                long d;
+                if (!nav_delta(&next, &d)) {
+                        g_input.pending = 1;
+                        g_input.key     = next;
+                        break;
+                }
+                *delta += d;
+        }
+}
 
-        if (strcmp(na, "..") == 0) return -1;
-        if (strcmp(nb, "..") == 0) return  1;
+// The output of the shell command, a line per row. It follows the end
+// of the output while the last line is shown. Keys: j/k and the arrows
+// scroll, space and C-v page, g/G go to the top and the bottom, / n N
+// search with an extended regex, x stops the command, q goes back.
+typedef struct {
+        char   *text;  // the ring, contiguous, with the newlines made NULs
+        size_t *lines; // offsets into text
+        size_t  n;
+} job_lines;
 
-        return strcmp(na, nb);
+static void
+job_lines_read(job_lines *jl)
+{
+        size_t len = g_job.out.len;
+
+        jl->text = (char *)realloc(jl->text, len + 1);
+        for (size_t done = 0; done < len;) {
+                size_t at = (g_job.out.start + done) % JOB_OUTPUT_CAP;
+                size_t k  = len - done < JOB_OUTPUT_CAP - at ? len - done : JOB_OUTPUT_CAP - at;
+                memcpy(jl->text + done, g_job.out.buf + at, k);
+                done += k;
+        }
+        jl->text[len] = '\0';
+
+        size_t cap = 1;
+        for (size_t i = 0; i < len; ++i) cap += jl->text[i] == '\n';
+        jl->lines = (size_t *)realloc(jl->lines, cap * sizeof(size_t));
+        jl->n     = 0;
+
+        for (size_t i = 0; i < len;) {
+                jl->lines[jl->n++] = i;
+                char *nl = memchr(jl->text + i, '\n', len - i);
+                if (!nl) break;
+                *nl = '\0';
+                i   = (size_t)(nl - jl->text) + 1;
+        }
 }
 
+// Control bytes would move the cursor, they are drawn as '?'.
 static void
-mark_or_unmark_selection(ie_context *ctx, int mark)
+job_line_draw(const char *line,
+              size_t      w)
 {
-        if (ctx->entries.i == 0) {
-                for (size_t i = 2; i < ctx->entries.fes.len; ++i) {
-                        if (!mark && sizet_set_contains(&ctx->marked, i)) {
-                                sizet_set_remove(&ctx->marked, i);
-                        } else if (mark && !sizet_set_contains(&ctx->marked, i)) {
-                                sizet_set_insert(&ctx->marked, i);
-                        }
+        for (size_t i = 0; line[i] && i < w; ++i) {
+                unsigned char c = (unsigned char)line[i];
+                putchar(c == '\t' ? ' ' : c < 0x20 || c == 0x7f ? '?' : c);
+        }
+}
+
+// The first line at or after `i` (at or before it if `rev`) that
+// matches `re`, or SIZE_MAX.
+static size_t
+job_search(const job_lines *jl,
+           const regex_t   *re,
+           size_t           i,
+           int              rev)
+{
+        if (!rev) {
+                for (; i < jl->n; ++i) {
+                        if (!regexec(re, jl->text + jl->lines[i], 0, NULL, 0)) return i;
                 }
-        } else if (ctx->entries.i != 1) {
-                if (!mark && sizet_set_contains(&ctx->marked, ctx->entries.i)) {
-                        sizet_set_remove(&ctx->marked, ctx->entries.i);
-                } else if (mark && !sizet_set_contains(&ctx->marked, ctx->entries.i)) {
-                        sizet_set_insert(&ctx->marked, ctx->entries.i);
+        } else {
+                for (i = i < jl->n ? i+1 : jl->n; i-- > 0;) {
+                        if (!regexec(re, jl->text + jl->lines[i], 0, NULL, 0)) return i;
                 }
-                selection_down(ctx);
         }
-
+        return SIZE_MAX;
 }
 
-static int
-move_selection(ie_context *ctx)
+static void
+job_view(ie_context *ctx)
 {
-        // Fail if no other buffer is open.
-        if (g_state.ctxs.len == 1) {
-                // TODO: add error message
-                return 0;
-        }
+        if (!g_job.cmd) return;
 
-        size_t paths_n = 0;
-        char **paths = buffers_as_strings(ctx, &paths_n);
-        int choice = forge_chooser("Choose Buffer",
-                                   (const char **)paths,
-                                   paths_n, 0);
+        job_lines jl     = {0};
+        regex_t   re;
+        int       have_re = 0;
+        size_t    top     = 0;
+        size_t    hit     = SIZE_MAX;
+        int       follow  = 1;
+        size_t    dropped = g_job.out.dropped;
 
-        free(paths);
-        if (choice == -1) return 0;
+        g_job.viewing = 1;
+        g_job.dirty   = 1;
 
-        if (sizet_set_size(&ctx->marked) > 0) {
-                // move multiple files
-                size_t **idxs = sizet_set_iter(&ctx->marked);
-                for (size_t i = 0; idxs[i]; ++i) {
-                        char *oldpath_rel = ctx->entries.fes.data[*idxs[i]]->name;
-                        char *oldpath = forge_io_resolve_absolute_path(oldpath_rel);
-                        char *newpath = forge_cstr_builder(g_state.ctxs.data[choice]->filepath, "/",
-                                                           oldpath_rel,
-                                                           NULL);
-                        printf("%s -> %s\n", oldpath, newpath);
-                        free(newpath);
-                }
+        while (1) {
+                size_t rows = list_rows(ctx);
 
-                int yes = forge_chooser_yesno("Move?", NULL, 1);
-                if (yes) {
-                        for (size_t i = 0; idxs[i]; ++i) {
-                                char *oldpath_rel = ctx->entries.fes.data[*idxs[i]]->name;
-                                char *oldpath = forge_io_resolve_absolute_path(oldpath_rel);
-                                char *newpath = forge_cstr_builder(g_state.ctxs.data[choice]->filepath, "/",
-                                                                   oldpath_rel,
-                                                                   NULL);
-                                if (rename(oldpath, newpath) != 0) {
-                                        perror("rename");
-                                        forge_err_wargs("failed to move `%s` to `%s`", oldpath, newpath);
-                                }
-                                free(newpath);
-                                free(oldpath);
-                                sizet_set_remove(&ctx->marked, *idxs[i]);
-                        }
-                        return 1;
-                }
-                return 0;
-        } else {
-                // single file
-                char *oldpath_rel = ctx->entries.fes.data[ctx->entries.i]->name;
-                char *oldpath =
-                        forge_io_resolve_absolute_path(
-                                ctx->entries.fes.data[ctx->entries.i]->name
-                        );
-                char *newpath = forge_cstr_builder(g_state.ctxs.data[choice]->filepath, "/",
-                                                   oldpath_rel,
-                                                   NULL);
+                if (g_job.dirty) {
+                        job_lines_read(&jl);
+                        g_job.dirty = 0;
 
-                printf("%s -> %s\n", oldpath, newpath);
-                int yes = forge_chooser_yesno("Move?", NULL, 1);
+                        // Lines dropped from the front move the others up.
+                        size_t gone = g_job.out.dropped - dropped;
+                        dropped = g_job.out.dropped;
+                        top = top > gone ? top - gone : 0;
+                        if (hit != SIZE_MAX) hit = hit >= gone ? hit - gone : SIZE_MAX;
+                }
+                size_t bottom = jl.n > rows ? jl.n - rows : 0;
+                if (follow || top > bottom) top = bottom;
 
-                if (yes) {
-                        if (rename(oldpath, newpath) != 0) {
-                                perror("rename");
-                                forge_err_wargs("failed to move `%s` to `%s`", oldpath, newpath);
+                forge_ctrl_clear_terminal();
+                printf(BOLD "! " RESET "%s" GRAY "  lines %zu-%zu of %zu" RESET,
+                       g_job.cmd, jl.n ? top+1 : 0, top + rows < jl.n ? top + rows : jl.n, jl.n);
+                if (g_job.out.dropped) printf(GRAY ", %zu dropped" RESET, g_job.out.dropped);
+                putchar('\n');
+                for (size_t i = top; i < top + rows && i < jl.n; ++i) {
+                        if (i == hit) printf(INVERT);
+                        job_line_draw(jl.text + jl.lines[i], ctx->term.w);
+                        printf(RESET "\n");
+                }
+                job_status();
+                putchar('\n');
+                fflush(stdout);
+                clock_gettime(CLOCK_MONOTONIC, &g_job.drawn);
+
+                if (!wait_for_input()) continue;
+
+                ie_key key = read_key();
+                char   ch  = key.ch;
+                long   delta;
+
+                if (nav_delta(&key, &delta)) {
+                        coalesce_nav(&delta);
+                        if (delta < 0 && (size_t)-delta > top) top = 0;
+                        else                                  top += delta;
+                } else if (key.ty == USER_INPUT_TYPE_CTRL && ch == CTRL_V) {
+                        top += rows;
+                } else if (key.ty != USER_INPUT_TYPE_NORMAL) {
+                        continue;
+                } else if (ch == 'q') {
+                        break;
+                } else if (ch == ' ') {
+                        top += rows;
+                } else if (ch == 'g') {
+                        top = 0;
+                } else if (ch == 'G') {
+                        top = bottom;
+                } else if (ch == 'x') {
+                        job_stop(SIGTERM);
+                } else if (ch == '/' || ((ch == 'n' || ch == 'N') && have_re)) {
+                        size_t next;
+                        if (ch == '/') {
+                                CURSOR_UP(1);
+                                char *q = forge_rdln("Query: ");
+                                if (!q || !*q) continue;
+                                if (have_re) regfree(&re);
+                                if (!(have_re = regcomp(&re, q, REG_EXTENDED|REG_NOSUB) == 0)) continue;
+                                next = job_search(&jl, &re, top, 0);
+                        } else if (ch == 'n') {
+                                next = job_search(&jl, &re, hit == SIZE_MAX ? top : hit+1, 0);
+                        } else {
+                                next = hit == SIZE_MAX ? job_search(&jl, &re, top, 1)
+                                     : hit > 0         ? job_search(&jl, &re, hit-1, 1)
+                                     : SIZE_MAX;
+                        }
+                        if (next != SIZE_MAX) {
+                                hit = next;
+                                top = hit > rows / 2 ? hit - rows / 2 : 0;
                         }
-                        free(newpath);
-                        free(oldpath);
-                        return 1;
                 }
-                free(oldpath);
-                free(newpath);
-                return 0;
+
+                bottom = jl.n > rows ? jl.n - rows : 0;
+                if (top > bottom) top = bottom;
+                follow = top == bottom;
         }
+
+        g_job.viewing = 0;
+        if (have_re) regfree(&re);
+        free(jl.text);
+        free(jl.lines);
 }
 
+// Timings of the last frame, at the end of the status line. The frame
+// that shows them is still being drawn.
 static void
-display_help(void)
+hud(void)
 {
-        forge_viewer *v = forge_viewer_alloc(g_help_buffer,
-                                             sizeof(g_help_buffer)/sizeof(*g_help_buffer), 0);
-        forge_viewer_display(v);
-        forge_viewer_free(v);
+        const trace_frame *f = &g_trace_last;
+
+        printf(GRAY "  | frame %.2f ms  key %.2f ms  fs %llu |",
+               f->ns[TRACE_FRAME] / 1e6, f->latency_ns / 1e6, (unsigned long long)f->syscalls);
+        for (int p = TRACE_SCAN; p <= TRACE_FILEOP; ++p) {
+                if (f->ns[p]) printf(" %s %.2f", g_trace_phases[p], f->ns[p] / 1e6);
+        }
+        printf(RESET);
 }
 
-static int
-do_command(ie_context *ctx)
+// The directory of `ctx` was removed while it was shown, reading it
+// through its fd gives no entries and no error. Moves `ctx` to the
+// nearest parent that still exists.
+static void
+context_lost(ie_context *ctx)
 {
-        CURSOR_UP(1);
-        char *command = forge_rdln(": ");
+        char *gone   = strdup(ctx->filepath);
+        char *parent = strdup(ctx->filepath);
 
-        if (!command || strlen(command) == 0) return 0;
+        do {
+                char *slash = strrchr(parent, '/');
+                if (slash == parent) slash[1] = '\0';
+                else                 *slash   = '\0';
+        } while (!context_enter(ctx, parent) && strcmp(parent, "/"));
 
-        if (!strcmp(command, CMD_SEARCH)) {
-                search(ctx, /*jmp=*/0, /*rev=*/0);
-        } else if (!strcmp(command, CMD_HELP)) {
-                display_help();
+        if (!strcmp(ctx->filepath, gone)) {
+                forge_err_wargs("%s was removed and no parent of it is left", gone);
         }
 
-        return 0;
+        printf(RED "%s was removed, showing %s" RESET "\n", gone, ctx->filepath);
+        any_key();
+
+        ctx->entries.i = 0;
+        ctx->hoffset   = 0;
+        free(parent);
+        free(gone);
 }
 
-static int
-issue_bash_cmd(ie_context *ctx)
+// Buffers keep their listing, cursor and scroll while they are not
+// shown. A listing is read again when it was changed through ie
+// (`force`, or `stale` after a shell command), or when the mtime of its
+// directory moved since it was read, in which case the cursor stays on
+// the entry it was on. Marks stay on their files as long as the buffer
+// shows the same directory.
+static void
+context_refresh(ie_context *ctx,
+                int         force)
 {
-        char *bashcmd = forge_rdln("! ");
+        struct stat st;
+        int         have;
+
+ again:
+        have = fstat(ctx->dirfd, &st) == 0;
+        TRACE_SYSCALLS(1);
 
-        if (!bashcmd || strlen(bashcmd) == 0) return 0;
+        if (have && st.st_nlink == 0) {
+                context_lost(ctx);
+                force = 1;
+                goto again;
+        }
 
-        (void)cmd(bashcmd);
+        int same = have && ctx->entries.fes.len > 0
+                && st.st_dev == ctx->entries.dir.st_dev
+                && st.st_ino == ctx->entries.dir.st_ino;
 
-        any_key();
-        free(bashcmd);
+        if (!force && same
+            && st.st_mtim.tv_sec == ctx->entries.dir.st_mtim.tv_sec
+            && st.st_mtim.tv_nsec == ctx->entries.dir.st_mtim.tv_nsec) {
+                return;
+        }
+        ctx->stale = 0;
 
-        return 1;
-}
+        // The old listing is kept until the new one is read, the
+        // cursor and the marks are found again by what they were on.
+        FE_array  old    = ctx->entries.fes;
+        size_t    keys_n = 0;
+        mark_key *keys   = same ? marks_keys(&ctx->marked, &old, &keys_n) : NULL;
 
-static int
-newdir(void)
-{
-        CURSOR_UP(1);
-        char *name = forge_rdln("mkdir name: ");
+        ctx->entries.fes = dyn_array_empty(FE_array);
+        if (!(have && prefetch_take(&st, &ctx->entries.fes))
+            && !listing_read(&ctx->entries.fes, ctx->dirfd)) {
+                forge_err_wargs("could not list files in filepath: %s", ctx->filepath);
+        }
 
-        if (!name || strlen(name) == 0) return 0;
+        // Removed between the fstat() and the read, "." and ".." are gone.
+        if (ctx->entries.fes.len < 2) {
+                listing_free(&ctx->entries.fes);
+                dyn_array_free(ctx->entries.fes);
+                ctx->entries.fes = old;
+                free(keys);
+                context_lost(ctx);
+                force = 1;
+                goto again;
+        }
 
-        if (mkdir(name, 0755) != 0) {
-                perror("mkdir");
-                any_key();
+        if (have) ctx->entries.dir = st;
+        else      memset(&ctx->entries.dir, 0, sizeof(ctx->entries.dir));
+
+        if (!force && ctx->entries.i < old.len) {
+                size_t i = listing_index(&ctx->entries.fes, old.data[ctx->entries.i]->name);
+                if (i < ctx->entries.fes.len) ctx->entries.i = i;
         }
 
-        return 1;
+        marks_remap(&ctx->marked, &ctx->entries.fes, keys, keys_n);
+
+        free(keys);
+        listing_free(&old);
+        dyn_array_free(old);
 }
 
 static void
 display(void)
 {
         int fs_changed     = 1;
-        char **files       = NULL;
         size_t last_ctxs_i = g_state.ctxs_i;
-        int first          = 1;
 
         while (1) {
+                uint64_t frame_t0 = TRACE_BEGIN();
+
                 forge_ctrl_clear_terminal();
 
                 ie_context *ctx = g_state.ctxs.data[g_state.ctxs_i];
-                CD(ctx->filepath, forge_err_wargs("could not cd() to %s", ctx->filepath));
-
-                if (first || g_state.ctxs_i != last_ctxs_i) {
-                        first = 0;
-                        ctx->entries.i = 0;
-                        fs_changed = 1;
-                        last_ctxs_i = g_state.ctxs_i;
-                }
-
-                if (fs_changed) {
-                        files = ls(ctx->filepath);
-                        if (!files) {
-                                forge_err_wargs("could not list files in filepath: %s", ctx->filepath);
-                        }
-                        fs_changed = 0;
-
-                        // Sort files
-                        size_t count = 0;
-                        while (files[count]) ++count;
-                        qsort(files, count, sizeof(*files), is_like_compar);
-                        for (size_t i = 0; i < count; ++i) {
-                                char *fullpath = forge_io_resolve_absolute_path(files[i]);
-                                FE *fe = (FE *)malloc(sizeof(FE));
-                                fe->name = files[i];
-                                fe->owner = NULL;
-                                fe->group = NULL;
-                                fe->stat_failed = (lstat(fullpath, &fe->st) == -1);
-
-                                if (!fe->stat_failed) {
-                                        struct passwd *pw = getpwuid(fe->st.st_uid);
-                                        struct group  *gr = getgrgid(fe->st.st_gid);
-                                        fe->owner = pw ? strdup(pw->pw_name) : strdup("?");
-                                        fe->group = gr ? strdup(gr->gr_name) : strdup("?");
-                                } else {
-                                        fe->owner = strdup("?");
-                                        fe->group = strdup("?");
-                                        memset(&fe->st, 0, sizeof(fe->st));
-                                }
 
-                                dyn_array_append(ctx->entries.fes, fe);
-                        }
+                if (fs_changed || g_state.ctxs_i != last_ctxs_i || g_job.finished || ctx->stale) {
+                        context_refresh(ctx, fs_changed || g_job.finished || ctx->stale);
+                        fs_changed     = 0;
+                        last_ctxs_i    = g_state.ctxs_i;
+                        g_job.finished = 0;
                 }
 
                 // If we are out-of-bounds (from deleting, marking, etc.) move
@@ -830,108 +3551,73 @@ display(void)
                 while (ctx->entries.i > ctx->entries.fes.len-1) {
                         --ctx->entries.i;
                 }
+                adjust_scroll(ctx);
+
+                uint64_t render_t0 = TRACE_BEGIN();
 
                 // Header
-                char *abspath = forge_io_resolve_absolute_path(ctx->filepath);
-                printf(YELLOW BOLD "(I)nteractive.(E)xplorer-v" VERSION RESET " list. " INVERT BLUE "%s" RESET "\n", abspath);
-                free(abspath);
+                printf(YELLOW BOLD "(I)nteractive.(E)xplorer-v" VERSION RESET " list. " INVERT BLUE "%s" RESET "\n", ctx->filepath);
 
                 // Print files
                 size_t dirs_n = 0;
                 size_t start = ctx->hoffset;
-                size_t end = start + ctx->term.h - 2;
+                size_t end = start + list_rows(ctx);
                 if (end > ctx->entries.fes.len)
                         end = ctx->entries.fes.len;
                 for (size_t i = start; i < end; ++i) {
-                        FE *e = ctx->entries.fes.data[i];
-                        int is_selected = (i == ctx->entries.i);
-                        int is_marked   = sizet_set_contains(&ctx->marked, i);
-                        int is_dir      = !e->stat_failed && S_ISDIR(e->st.st_mode);
-
-                        if (!strcmp(e->name, "..") || !strcmp(e->name, ".")) {
-                                printf(GRAY);
-                                ++dirs_n;
-                        }
-                        else if (is_dir) {
-                                printf(BOLD CYAN);
-                                ++dirs_n;
-                        } else if (!e->stat_failed && (e->st.st_mode & (S_IXUSR|S_IXGRP|S_IXOTH))) {
-                                printf(GREEN);  // executable
-                        } else {
-                                printf(WHITE);
-                        }
-
-                        if (is_selected) printf(INVERT);
-                        if (is_marked)   printf(PINK "<M> ");
-
-                        char modebuf[11] = "??????????";
-                        if (!e->stat_failed) mode_string(e->st.st_mode, modebuf);
-
-                        const char *size_str = e->stat_failed ? "     ? " : human_size(e->st.st_size);
-                        const char *time_str = e->stat_failed ? "?????????????" : format_time(e->st.st_mtime);
-
-                        printf("%s %3ld %-8s %-8s %s %s %s",
-                               modebuf,
-                               e->stat_failed ? 0L : (long)e->st.st_nlink,
-                               e->owner ? e->owner : "?",
-                               e->group ? e->group : "?",
-                               size_str,
-                               time_str,
-                               e->name);
-
-                        // Symlink target
-                        if (!e->stat_failed && S_ISLNK(e->st.st_mode)) {
-                                char fullpath[PATH_MAX];
-                                snprintf(fullpath, sizeof(fullpath), "%s/%s", ctx->filepath, e->name);
-                                char target[PATH_MAX];
-                                ssize_t len = readlink(fullpath, target, sizeof(target)-1);
-                                if (len != -1) {
-                                        target[len] = '\0';
-                                        printf(" -> " CYAN "%s" RESET, target);
-                                }
-                        }
-
-                        // Show ghosted full path on selected line
-                        if (is_selected && (g_config.flags & FT_SHOWGHOST)) {
-                                char fullpath[PATH_MAX];
-                                snprintf(fullpath, sizeof(fullpath), "%s/%s", ctx->filepath, e->name);
-                                char *abs = forge_io_resolve_absolute_path(fullpath);
-                                printf(RESET "  " ITALIC GRAY "%s" RESET, abs);
-                                free(abs);
-                        }
-
+                        dirs_n += listing_row(stdout, ctx->dirfd, ctx->filepath, ctx->entries.fes.data[i],
+                                              i == ctx->entries.i,
+                                              marks_test(&ctx->marked, i),
+                                              g_config.flags & FT_SHOWGHOST);
                         putchar('\n');
                         printf(RESET);
                 }
 
                 // Directory status
                 printf(BOLD WHITE "%zu items" RESET "  (%zu dirs)" RESET "  [" YELLOW "%zu" RESET "/" YELLOW "%zu" RESET "]",
-                       ctx->entries.fes.len - 2,
-                       dirs_n - 2,
+                       ctx->entries.fes.len > 2 ? ctx->entries.fes.len - 2 : 0,
+                       dirs_n > 2 ? dirs_n - 2 : 0,
                        ctx->entries.i+1,
                        ctx->entries.fes.len);
-                if (sizet_set_size(&ctx->marked) > 0) {
-                        printf(YELLOW "  %zu" RESET " MARKED (u to unmark)\n", sizet_set_size(&ctx->marked));
-                } else {
-                        putchar('\n');
+                size_t marks_n = marks_count(&ctx->marked);
+                if (marks_n > 0) {
+                        printf(YELLOW "  %zu" RESET " MARKED (u to unmark)", marks_n);
+                }
+                if (g_config.reload_err[0]) {
+                        printf(RED "  config not reloaded: %s" RESET, g_config.reload_err);
+                }
+                job_status();
+                if (g_trace & TRACE_HUD) hud();
+                putchar('\n');
+                fflush(stdout);
+                TRACE_END(TRACE_RENDER, render_t0);
+                trace_frame_end(frame_t0);
+
+                prefetch_hint(ctx);
+                persist_associations();
+
+                // A resize only reflows, redraw from the cached listing.
+                if (!wait_for_input()) continue;
+
+                ie_key key = read_key();
+                char   ch  = key.ch;
+                long   delta;
+
+                trace_key();
+
+                // Runs of navigation keys become one cursor move and
+                // one redraw.
+                if (nav_delta(&key, &delta)) {
+                        coalesce_nav(&delta);
+                        selection_move(ctx, delta);
+                        adjust_scroll(ctx);
+                        continue;
                 }
-
-                char ch;
-                forge_ctrl_input_type ty = forge_ctrl_get_input(&ch);
 
                 // Handle input
-                switch (ty) {
-                case USER_INPUT_TYPE_ARROW: {
-                        if (ch == DOWN_ARROW) {
-                                selection_down(ctx);
-                        } else if (ch == UP_ARROW) {
-                                selection_up(ctx);
-                        }
-                } break;
+                switch (key.ty) {
                 case USER_INPUT_TYPE_CTRL: {
-                        if      (ch == CTRL_N) selection_down(ctx);
-                        else if (ch == CTRL_P) selection_up(ctx);
-                        else if (ch == CTRL_X) fs_changed = ctrl_x(ctx);
+                        if (ch == CTRL_X) fs_changed = ctrl_x(ctx);
                 } break;
                 case USER_INPUT_TYPE_NORMAL: {
                         if      (ch == 'q') goto done;
@@ -939,12 +3625,13 @@ display(void)
                                 remove_selection(ctx);
                                 fs_changed = 1;
                         }
-                        else if (ch == 'j') selection_down(ctx);
-                        else if (ch == 'k') selection_up(ctx);
                         else if (ch == 'r') {
                                 fs_changed = rename_selection(ctx);
                         }
-                        else if (ch == '\n') {
+                        else if (ch == 'R') {
+                                fs_changed = bulk_rename(ctx);
+                        }
+                        else if (ch == '\n' && ctx->entries.i < ctx->entries.fes.len) {
                                 if (clicked(ctx, ctx->entries.fes.data[ctx->entries.i]->name)) {
                                         ctx->entries.i = ctx->entries.fes.len >= 2 ? 2 : 1;
                                         fs_changed = 1;
@@ -953,6 +3640,10 @@ display(void)
                                 mark_or_unmark_selection(ctx, /*mark=*/1);
                         } else if (ch == 'u') {
                                 mark_or_unmark_selection(ctx, /*mark=*/0);
+                        } else if (ch == 'i') {
+                                invert_marks(ctx);
+                        } else if (ch == 'V') {
+                                mark_to_selection(ctx);
                         } else if (ch == '/') {
                                 search(ctx, /*jmp=*/0, /*rev=*/0);
                         } else if (ch == 'n') {
@@ -962,7 +3653,7 @@ display(void)
                         } else if (ch == 'g') {
                                 ctx->entries.i = 0;
                         } else if (ch == 'G') {
-                                ctx->entries.i = ctx->entries.fes.len-1;
+                                ctx->entries.i = ctx->entries.fes.len ? ctx->entries.fes.len-1 : 0;
                         } else if (ch == 'M') {
                                 fs_changed = move_selection(ctx);
                         } else if (ch == ':') {
@@ -970,53 +3661,53 @@ display(void)
                         } else if (ch == '?') {
                                 display_help();
                         } else if (ch == '!') {
-                                fs_changed = issue_bash_cmd(ctx);
+                                issue_bash_cmd(ctx);
+                        } else if (ch == 'o') {
+                                job_view(ctx);
+                        } else if (ch == 'P') {
+                                proc_view();
                         } else if (ch == '+' || ch == '%') {
-                                fs_changed = newdir();
+                                fs_changed = newdir(ctx);
                         } else if (ch == '\\') {
                                 g_config.flags ^= FT_SHOWGHOST;
+                        } else if (ch == 'T') {
+                                trace_hud(!(g_trace & TRACE_HUD));
                         }
                 } break;
                 default: break;
                 }
 
-                size_t visible_lines = ctx->term.h - 2;  // -2 for path + status line
-
-                // Scroll down when selection reaches bottom of screen
-                if (ctx->entries.i >= ctx->hoffset + visible_lines) {
-                        ctx->hoffset = ctx->entries.i - visible_lines + 1;
-                }
-
-                // Scroll up when selection reaches top of screen
-                if (ctx->entries.i < ctx->hoffset) {
-                        ctx->hoffset = ctx->entries.i;
-                }
-
-                // Clamp hoffset to valid range
-                if (ctx->hoffset + visible_lines > ctx->entries.fes.len) {
-                        ctx->hoffset = ctx->entries.fes.len > visible_lines ?
-                                ctx->entries.fes.len - visible_lines : 0;
-                }
-                if (ctx->hoffset >= ctx->entries.fes.len) {
-                        ctx->hoffset = 0;
-                }
+                adjust_scroll(ctx);
 
-                if (fs_changed) {
-                        for (size_t i = 0; files[i]; ++i) {
-                                free(files[i]);
-                                free(ctx->entries.fes.data[i]->owner);
-                                free(ctx->entries.fes.data[i]->group);
-                        }
-                        free(files);
-                        dyn_array_clear(ctx->entries.fes);
-                        ctx->last_query = NULL;
-                }
+                if (fs_changed) ctx->last_query = NULL;
         }
 
  done:
         forge_ctrl_clear_terminal();
 }
 
+// $XDG_CACHE_HOME/ie/config.cache, falling back to ~/.cache. Returns
+// NULL if the directory cannot be created, which disables the cache.
+static const char *
+config_cache_path(const char *home)
+{
+        const char *xdg = getenv("XDG_CACHE_HOME");
+        char dir[1024];
+
+        if (xdg && *xdg) snprintf(dir, sizeof(dir), "%s", xdg);
+        else             snprintf(dir, sizeof(dir), "%s/.cache", home);
+
+        if (mkdir(dir, 0755) != 0 && errno != EEXIST) return NULL;
+
+        strncat(dir, "/" CONFIG_CACHE_DIR, sizeof(dir)-strlen(dir)-1);
+        if (mkdir(dir, 0755) != 0 && errno != EEXIST) return NULL;
+
+        snprintf(g_config_cachepath, sizeof(g_config_cachepath),
+                 "%s/%s", dir, CONFIG_CACHE_FILENAME);
+
+        return g_config_cachepath;
+}
+
 static int
 setup(void)
 {
@@ -1027,35 +3718,140 @@ setup(void)
         }
 
         sprintf(g_config_filepath, "%s/%s", home, CONFIG_FILENAME);
+        g_config_cache = config_cache_path(home);
 
         if (!forge_io_filepath_exists(g_config_filepath)) {
                 forge_io_create_file(g_config_filepath, 1);
+                g_config.writer = qcl_writer_create(g_config_filepath);
+                snapshot_publish(snapshot_empty());
                 return 1;
         }
 
-        qcl_config config = qcl_parse_file(g_config_filepath);
-        if (!qcl_ok(&config)) {
-                fprintf(stderr, "%s\n", qcl_geterr(&config));
+        g_config.writer = qcl_writer_create(g_config_filepath);
+
+        char         err[256];
+        ie_snapshot *snap = snapshot_load(g_config_cache, /*report=*/1, err, sizeof(err));
+        if (!snap) {
+                fprintf(stderr, "%s\n", err);
                 fprintf(stderr, "could not parse config\n");
+                snapshot_publish(snapshot_empty());
                 return 0;
         }
 
-        g_config.written_config = config;
+        snapshot_publish(snap);
+
+        // Fold associations appended by earlier sessions back into the
+        // config in the background.
+        compact_config_async();
 
         return 1;
 }
 
+// `ie --list [DIR]` writes the listing of DIR, or of the working
+// directory, to stdout and exits. It runs before the config is read and
+// never touches the terminal, so it can be used from scripts. DIR is
+// any argument that does not start with `--`, wherever it is:
+//
+//   --sort=name|size|mtime|none  size and mtime put the largest and
+//                                newest first, none is directory order
+//   --reverse                    not with --sort=none, which is written
+//                                while the directory is read
+//   --format=tsv|json|nul        nul writes names only, like -print0
+//   --type=f|d|l
+//   --match=REGEX                extended regex on the name
+static int
+list_main(int argc, char **argv)
+{
+        listing_export_opts opts = {
+                .sort    = LISTING_SORT_NAME,
+                .reverse = 0,
+                .format  = LISTING_FORMAT_TSV,
+                .type    = 0,
+                .match   = NULL,
+        };
+        const char *dir = NULL;
+
+        for (int i = 1; i < argc; ++i) {
+                const char *a = argv[i];
+                const char *d = strncmp(a, "--", 2)      ? a
+                              : !strncmp(a, "--list=", 7) ? a + 7
+                              : NULL;
+
+                if (d) {
+                        if (dir) {
+                                fprintf(stderr, "ie: --list takes one directory, got %s and %s\n", dir, d);
+                                return 2;
+                        }
+                        dir = d;
+                }
+                else if (!strcmp(a, "--list"))          continue;
+                else if (!strcmp(a, "--sort=name"))     opts.sort    = LISTING_SORT_NAME;
+                else if (!strcmp(a, "--sort=size"))     opts.sort    = LISTING_SORT_SIZE;
+                else if (!strcmp(a, "--sort=mtime"))    opts.sort    = LISTING_SORT_MTIME;
+                else if (!strcmp(a, "--sort=none"))     opts.sort    = LISTING_SORT_NONE;
+                else if (!strcmp(a, "--reverse"))       opts.reverse = 1;
+                else if (!strcmp(a, "--format=tsv"))    opts.format  = LISTING_FORMAT_TSV;
+                else if (!strcmp(a, "--format=json"))   opts.format  = LISTING_FORMAT_JSON;
+                else if (!strcmp(a, "--format=nul"))    opts.format  = LISTING_FORMAT_NUL;
+                else if (!strcmp(a, "--type=f"))        opts.type    = S_IFREG;
+                else if (!strcmp(a, "--type=d"))        opts.type    = S_IFDIR;
+                else if (!strcmp(a, "--type=l"))        opts.type    = S_IFLNK;
+                else if (!strncmp(a, "--match=", 8))    opts.match   = a + 8;
+                else {
+                        fprintf(stderr, "ie: unknown option for --list: %s\n", a);
+                        return 2;
+                }
+        }
+
+        if (opts.reverse && opts.sort == LISTING_SORT_NONE) {
+                fprintf(stderr, "ie: --reverse cannot be used with --sort=none\n");
+                return 2;
+        }
+        if (!dir) dir = ".";
+
+        static char buf[1 << 16];
+        setvbuf(stdout, buf, _IOFBF, sizeof(buf));
+
+        if (!listing_export(stdout, dir, &opts)) {
+                if (errno == EINVAL && opts.match) fprintf(stderr, "ie: invalid regex: %s\n", opts.match);
+                else fprintf(stderr, "ie: cannot list %s: %s\n", dir, strerror(errno));
+                return 1;
+        }
+
+        return 0;
+}
+
 int
 main(int argc, char **argv)
 {
-        if (!setup()) any_key();
+        for (int i = 1; i < argc; ++i) {
+                if (!strncmp(argv[i], "--list", 6) && (!argv[i][6] || argv[i][6] == '=')) {
+                        return list_main(argc, argv);
+                }
+        }
+
+        proc_init();
 
-        qcl_value *ghostv = qcl_value_get(&g_config.written_config, "ie-showghost");
-        if (ghostv && ghostv->kind == QCL_VALUE_KIND_BOOL) {
-                if (((qcl_value_bool *)ghostv)->b)
-                        g_config.flags |= FT_SHOWGHOST;
+        g_learned        = opener_strmap_create(symtbl_hash, symtbl_cmp);
+        g_keys.openers   = qcl_key_resolve("ie-openers");
+        g_keys.showghost = qcl_key_resolve("ie-showghost");
+        g_units          = qcl_unit_cache_create();
+
+        trace_init();
+        const char *trace_fp = getenv("IE_TRACE");
+        if (trace_fp && *trace_fp && !trace_open(trace_fp)) {
+                fprintf(stderr, "could not open trace file %s: %s\n", trace_fp, strerror(errno));
         }
 
+        if (!setup()) any_key();
+
+        g_ui_reader = reader_register();
+        reader_online(g_ui_reader);
+        apply_config_flags(snapshot_get());
+
+        config_watch_start(g_config_cache);
+        prefetch_start();
+
         struct termios t;
         char *filepath = NULL;
         size_t w, h;
@@ -1084,9 +3880,28 @@ main(int argc, char **argv)
                 forge_err("could not enable raw terminal");
         }
 
+        install_resize_handler();
+
         dyn_array_append(g_state.ctxs, ie_context_alloc(filepath));
 
         display();
+        job_stop(SIGHUP);
+        prefetch_stop();
+
+        persist_associations();
+        qcl_writer_destroy(&g_config.writer);
+
+        reader_unregister(g_ui_reader);
+        config_watch_stop();
+        qcl_unit_cache_destroy(&g_units);
+        trace_close();
+
+        for (size_t i = 0; i < g_learned.tbl.cap; ++i) {
+                if (!g_learned.tbl.data[i].used) continue;
+                free((char *)g_learned.tbl.data[i].k);
+                free((char *)g_learned.tbl.data[i].v);
+        }
+        opener_strmap_destroy(&g_learned);
 
         if (!forge_ctrl_disable_raw_terminal(STDIN_FILENO, &g_config.term.t)) {
                 forge_err("could not disable raw terminal");
@@ -0,0 +1,369 @@
+/**
+ * Benchmarks for qcl.h.
+ *
+ * Build and run with `make bench` from the src directory. This is not
+ * built by default.
+ *
+ * Every phase of the engine (lex, parse, compile, run, get, key) is timed
+ * separately over generated configs of increasing size and of several
+ * shapes. Results are printed as a table and, if a path is given as the
+ * first argument, written there as JSON so runs can be compared:
+ *
+ *   ./qcl-bench results.json
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Count every allocation qcl makes.
+static size_t g_allocs = 0;
+
+static void *bench_malloc(size_t n)             { ++g_allocs; return malloc(n); }
+static void *bench_calloc(size_t n, size_t sz)  { ++g_allocs; return calloc(n, sz); }
+static void *bench_realloc(void *p, size_t n)   { ++g_allocs; return realloc(p, n); }
+
+#define QCL_MALLOC(n)     bench_malloc(n)
+#define QCL_CALLOC(n, sz) bench_calloc(n, sz)
+#define QCL_REALLOC(p, n) bench_realloc(p, n)
+
+#define QCL_IMPL
+#include "qcl.h"
+
+#define BENCH_MAP_KEYS 100000
+#define BENCH_MAX_RESULTS 128
+#define BENCH_MIN_GETS 1000000
+
+typedef struct {
+        const char *shape;
+        size_t      n;       // shape parameter
+        size_t      bytes;   // size of the source
+        const char *phase;
+        size_t      ops;
+        double      secs;
+        size_t      allocs;
+} bench_result;
+
+static bench_result g_results[BENCH_MAX_RESULTS];
+static size_t       g_results_n = 0;
+
+static double
+now_sec(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+report(const char *shape,
+       size_t      n,
+       size_t      bytes,
+       const char *phase,
+       size_t      ops,
+       double      secs,
+       size_t      allocs)
+{
+        printf("%-8s %8zu %-10s %10zu ops %10.3f ms %10.1f ns/op %8.1f MB/s %10zu allocs\n",
+               shape, n, phase, ops, secs * 1e3, secs * 1e9 / ops,
+               bytes ? bytes / secs / (1024*1024) : 0.0, allocs);
+
+        if (g_results_n < BENCH_MAX_RESULTS) {
+                g_results[g_results_n++] = (bench_result) {
+                        .shape  = shape,
+                        .n      = n,
+                        .bytes  = bytes,
+                        .phase  = phase,
+                        .ops    = ops,
+                        .secs   = secs,
+                        .allocs = allocs,
+                };
+        }
+}
+
+static int
+write_json(const char *path)
+{
+        FILE *f = fopen(path, "w");
+        if (!f) {
+                perror(path);
+                return 0;
+        }
+
+        fprintf(f, "[\n");
+        for (size_t i = 0; i < g_results_n; ++i) {
+                const bench_result *r = &g_results[i];
+                fprintf(f, "  {\"shape\": \"%s\", \"n\": %zu, \"bytes\": %zu, \"phase\": \"%s\", "
+                        "\"ops\": %zu, \"ns\": %.0f, \"ns_per_op\": %.2f, \"allocs\": %zu}%s\n",
+                        r->shape, r->n, r->bytes, r->phase, r->ops, r->secs * 1e9,
+                        r->secs * 1e9 / r->ops, r->allocs, i+1 < g_results_n ? "," : "");
+        }
+        fprintf(f, "]\n");
+
+        return fclose(f) == 0;
+}
+
+// Keys look like generated extension -> opener entries. They all share
+// the same first characters, which used to put every key in one chain.
+static void
+bench_map(size_t n)
+{
+        char  **keys = (char **)malloc(sizeof(char *) * n);
+        char  **miss = (char **)malloc(sizeof(char *) * n);
+        char    buf[64];
+        double  t0;
+        size_t  a0;
+        size_t  found = 0;
+
+        for (size_t i = 0; i < n; ++i) {
+                snprintf(buf, sizeof(buf), "ext%zu", i);
+                keys[i] = strdup(buf);
+                snprintf(buf, sizeof(buf), "ext%zu-missing", i);
+                miss[i] = strdup(buf);
+        }
+
+        qcl_value *v = (qcl_value *)qcl_value_bool_alloc(1);
+        symtbl tbl = symtbl_create(symtbl_hash, symtbl_cmp);
+
+        t0 = now_sec(), a0 = g_allocs;
+        for (size_t i = 0; i < n; ++i) {
+                symtbl_insert(&tbl, keys[i], v);
+        }
+        report("map", n, 0, "insert", n, now_sec() - t0, g_allocs - a0);
+
+        t0 = now_sec(), a0 = g_allocs;
+        for (size_t i = 0; i < n; ++i) {
+                found += symtbl_get(&tbl, keys[i]) != NULL;
+        }
+        report("map", n, 0, "hit", n, now_sec() - t0, g_allocs - a0);
+
+        t0 = now_sec(), a0 = g_allocs;
+        for (size_t i = 0; i < n; ++i) {
+                found += symtbl_get(&tbl, miss[i]) != NULL;
+        }
+        report("map", n, 0, "miss", n, now_sec() - t0, g_allocs - a0);
+
+        if (found != n) {
+                fprintf(stderr, "map: expected %zu hits, got %zu\n", n, found);
+                exit(1);
+        }
+
+        symtbl_destroy(&tbl);
+        for (size_t i = 0; i < n; ++i) {
+                free(keys[i]);
+                free(miss[i]);
+        }
+        free(keys);
+        free(miss);
+        free(v);
+}
+
+// Growable source buffer for the generators.
+typedef struct {
+        char   *s;
+        size_t  len;
+        size_t  cap;
+} bench_src;
+
+static void
+src_printf(bench_src *b, const char *fmt, ...)
+{
+        va_list ap;
+        int     n;
+
+        va_start(ap, fmt);
+        n = vsnprintf(NULL, 0, fmt, ap);
+        va_end(ap);
+
+        if (b->len + n + 1 > b->cap) {
+                b->cap = (b->len + n + 1) * 2;
+                b->s   = (char *)realloc(b->s, b->cap);
+        }
+
+        va_start(ap, fmt);
+        vsnprintf(b->s + b->len, n+1, fmt, ap);
+        va_end(ap);
+        b->len += n;
+}
+
+// Generators write a config with parameter `n` to `b` and the names
+// that qcl_value_get() is timed on to `names`.
+
+// `n` independent assignments.
+static void
+gen_keys(bench_src *b, qcl_str_array *names, size_t n)
+{
+        char buf[32];
+        for (size_t i = 0; i < n; ++i) {
+                src_printf(b, "# opener %zu\next_%zu = 'opener-%zu';\n", i, i, i);
+                snprintf(buf, sizeof(buf), "ext_%zu", i);
+                qcl_array_append(*names, strdup(buf));
+        }
+}
+
+// `if` statements nested `n` deep, every level assigning a variable.
+static void
+gen_deep_if(bench_src *b, qcl_str_array *names, size_t n)
+{
+        char buf[32];
+        for (size_t i = 0; i < n; ++i) {
+                src_printf(b, "if !false { d%zu = 'level-%zu';\n", i, i);
+                snprintf(buf, sizeof(buf), "d%zu", i);
+                qcl_array_append(*names, strdup(buf));
+        }
+        for (size_t i = 0; i < n; ++i) {
+                src_printf(b, "} else { d%zu = 'never'; }\n", n-i-1);
+        }
+}
+
+// A list of `n` strings, then lists built out of it.
+static void
+gen_lists(bench_src *b, qcl_str_array *names, size_t n)
+{
+        src_printf(b, "l0 = [");
+        for (size_t i = 0; i < n; ++i) {
+                src_printf(b, "%s'item-%zu'", i ? ", " : "", i);
+        }
+        src_printf(b, "];\n");
+        src_printf(b, "l1 = l0 + l0;\nl2 = [l0, l1, 'x'];\nl3 = l2 + l1 + l0;\n");
+
+        qcl_array_append(*names, strdup("l0"));
+        qcl_array_append(*names, strdup("l1"));
+        qcl_array_append(*names, strdup("l2"));
+        qcl_array_append(*names, strdup("l3"));
+}
+
+// `n` assignments reading and concatenating environment variables.
+static void
+gen_env(bench_src *b, qcl_str_array *names, size_t n)
+{
+        char buf[32];
+        for (size_t i = 0; i < n; ++i) {
+                src_printf(b, "e%zu = $\"HOME\" + '/' + $\"QCL_BENCH_UNSET\" + $\"PATH\";\n", i);
+                snprintf(buf, sizeof(buf), "e%zu", i);
+                qcl_array_append(*names, strdup(buf));
+        }
+}
+
+static void
+bench_phases(const char *shape,
+             void      (*gen)(bench_src *, qcl_str_array *, size_t),
+             size_t      n)
+{
+        bench_src     src   = {0};
+        qcl_str_array names = qcl_array_empty(qcl_str_array);
+        double        t0;
+        size_t        a0;
+
+        gen(&src, &names, n);
+
+        t0 = now_sec(), a0 = g_allocs;
+        _qcl_lexer lexer = _qcl_lex_file("<bench>", src.s, src.len);
+        double lex_secs = now_sec() - t0;
+        size_t lex_allocs = g_allocs - a0;
+
+        if (lexer.err.msg) {
+                fprintf(stderr, "%s: lex: %s\n", shape, lexer.err.msg);
+                exit(1);
+        }
+
+        size_t toks = lexer.toks.len;
+        report(shape, n, src.len, "lex", toks, lex_secs, lex_allocs);
+
+        t0 = now_sec(), a0 = g_allocs;
+        _qcl_parser parser = _qcl_create_program(&lexer);
+        report(shape, n, src.len, "parse", toks, now_sec() - t0, g_allocs - a0);
+
+        if (parser.err.msg) {
+                fprintf(stderr, "%s: parse: %s\n", shape, parser.err.msg);
+                exit(1);
+        }
+
+        qcl_config config;
+        memset(&config, 0, sizeof(config));
+
+        t0 = now_sec(), a0 = g_allocs;
+        _qcl_bytecode bc = _qcl_compile(&parser.p, &config.interpreter.arena);
+        report(shape, n, src.len, "compile", parser.p.stmts.len, now_sec() - t0, g_allocs - a0);
+
+        t0 = now_sec(), a0 = g_allocs;
+        config.interpreter.tbl = _qcl_run(&bc, &config.interpreter.arena, &config.err);
+        report(shape, n, src.len, "run", bc.code.len, now_sec() - t0, g_allocs - a0);
+
+        if (config.err.msg) {
+                fprintf(stderr, "%s: run: %s\n", shape, config.err.msg);
+                exit(1);
+        }
+
+        _qcl_bytecode_free(&bc);
+
+        _qcl_program_free(&parser.p);
+        _qcl_lexer_free(&lexer);
+
+        size_t rounds = BENCH_MIN_GETS / names.len + 1;
+        size_t found  = 0;
+
+        t0 = now_sec(), a0 = g_allocs;
+        for (size_t r = 0; r < rounds; ++r) {
+                for (size_t i = 0; i < names.len; ++i) {
+                        found += qcl_value_get(&config, names.data[i]) != NULL;
+                }
+        }
+        report(shape, n, 0, "get", rounds * names.len, now_sec() - t0, g_allocs - a0);
+
+        if (found != rounds * names.len) {
+                fprintf(stderr, "%s: %zu lookups failed\n", shape, rounds * names.len - found);
+                exit(1);
+        }
+
+        qcl_key *keys = (qcl_key *)malloc(sizeof(qcl_key) * names.len);
+        for (size_t i = 0; i < names.len; ++i) keys[i] = qcl_key_resolve(names.data[i]);
+
+        found = 0;
+        t0 = now_sec(), a0 = g_allocs;
+        for (size_t r = 0; r < rounds; ++r) {
+                for (size_t i = 0; i < names.len; ++i) {
+                        found += qcl_key_value(&config, &keys[i]) != NULL;
+                }
+        }
+        report(shape, n, 0, "key", rounds * names.len, now_sec() - t0, g_allocs - a0);
+
+        if (found != rounds * names.len) {
+                fprintf(stderr, "%s: %zu key lookups failed\n", shape, rounds * names.len - found);
+                exit(1);
+        }
+
+        free(keys);
+        qcl_config_destroy(&config);
+        for (size_t i = 0; i < names.len; ++i) free(names.data[i]);
+        qcl_array_free(names);
+        free(src.s);
+}
+
+int
+main(int argc, char **argv)
+{
+        static const size_t sizes[]  = {1000, 10000, 100000};
+        static const size_t depths[] = {16, 256, 4096};
+
+        bench_map(BENCH_MAP_KEYS);
+
+        for (size_t i = 0; i < sizeof(sizes)/sizeof(*sizes); ++i) {
+                bench_phases("keys", gen_keys, sizes[i]);
+        }
+        for (size_t i = 0; i < sizeof(depths)/sizeof(*depths); ++i) {
+                bench_phases("deep-if", gen_deep_if, depths[i]);
+        }
+        for (size_t i = 0; i < sizeof(sizes)/sizeof(*sizes); ++i) {
+                bench_phases("lists", gen_lists, sizes[i]);
+        }
+        for (size_t i = 0; i < sizeof(sizes)/sizeof(*sizes); ++i) {
+                bench_phases("env", gen_env, sizes[i]);
+        }
+
+        if (argc > 1 && !write_json(argv[1])) return 1;
+
+        return 0;
+}
@@ -26,9 +26,6 @@
  *     #include "qcl.h"
  *     ... other includes
  *
- * TODO:
- *   Impl map_destroy() to map macro code gen.
- *
  * Available interface:
  *
  * FUNCTIONS
@@ -38,6 +35,37 @@
  *    Get a configuration object. This should be the first function
  *    you call to parse a file.
  *
+ *  qcl_config qcl_parse_file_cached(const char *fp, const char *cache_fp)
+ *
+ *    Same as qcl_parse_file(), but first tries the compiled image at
+ *    `cache_fp`. If the image was built from the current contents of
+ *    `fp` it is mmap()'d and queried in place, otherwise the file is
+ *    parsed and a new image is written to `cache_fp`. Passing NULL for
+ *    `cache_fp` disables the cache.
+ *
+ *  qcl_config qcl_parse_file_units(const char *fp, const char *cache_fp,
+ *                                  qcl_unit_cache *units)
+ *
+ *    Same as qcl_parse_file_cached(), and files that have to be parsed
+ *    are compiled through `units`: a file that was compiled into
+ *    `units` before and has not changed since is not read again. Keep
+ *    `units` around between loads of the same config. NULL for either
+ *    cache disables it.
+ *
+ *  qcl_unit_cache qcl_unit_cache_create(void)
+ *  void qcl_unit_cache_destroy(qcl_unit_cache *units)
+ *
+ *    Create and free a cache of compiled files. Configs loaded with it
+ *    stay valid after it is destroyed. A cache, and destroying configs
+ *    loaded with it, must be used by one thread at a time.
+ *
+ *  int qcl_config_changed(const qcl_config *config)
+ *  const char *qcl_config_file(const qcl_config *config, size_t i)
+ *
+ *    Whether any of the files `config` was read from, i.e. the file
+ *    and every file it includes, changed since; and the real path of
+ *    the `i`th of them, or NULL after the last one.
+ *
  *  int qcl_ok(const qcl_config *config)
  *
  *    Returns 0 if any errors were found and 1 if ok.
@@ -51,6 +79,34 @@
  *    Query a value that is found in the configuration file. It will be
  *    one of the VALUES or NULL if it is not defined.
  *
+ *    Variables may be dotted paths (`viewer.wrap = true;`) to group
+ *    related settings; `var` is then the whole path.
+ *
+ *  qcl_key qcl_key_resolve(const char *path)
+ *
+ *    Check and hash `path` once so it can be looked up repeatedly with
+ *    the qcl_key_*() functions below. `path` is borrowed and must
+ *    outlive the key. An invalid path gives a key that never matches.
+ *    Keys are not tied to a config, so resolve them once at startup.
+ *
+ *  const qcl_value *qcl_key_value(qcl_config *config, const qcl_key *key)
+ *  const char *qcl_key_string(qcl_config *config, const qcl_key *key)
+ *  int qcl_key_bool(qcl_config *config, const qcl_key *key, int *b)
+ *  const qcl_value *qcl_key_list(qcl_config *config, const qcl_key *key)
+ *
+ *    Typed lookups. Each returns NULL (or 0) if `key` is not defined
+ *    or is defined as a different kind of value, so callers do not
+ *    need to check `kind` or cast. Strings and lists are borrowed
+ *    from `config`.
+ *
+ *  const char *qcl_value_as_string(const qcl_value *v)
+ *  int qcl_value_as_bool(const qcl_value *v, int *b)
+ *  size_t qcl_value_list_len(const qcl_value *v)
+ *  const qcl_value *qcl_value_list_at(const qcl_value *v, size_t i)
+ *
+ *    The same checked conversions for any value, e.g. the elements of
+ *    a list. A NULL `v` is accepted by all of them.
+ *
  *  char **qcl_value_flatten(qcl_config *config, const char *var)
  *
  *    Flatten a variable into an array of values. This is useful for
@@ -63,9 +119,24 @@
  *      at least 1 in length and the last element in the
  *      array will be NULL.
  *
+ *  qcl_value_iter qcl_value_iter_begin(qcl_config *config, const char *var)
+ *  const char *qcl_value_iter_next(qcl_value_iter *it)
+ *
+ *    Iterate over the same strings that qcl_value_flatten() returns,
+ *    without copying them. The strings are owned by `config`:
+ *
+ *      qcl_value_iter it = qcl_value_iter_begin(&config, "lst");
+ *      for (const char *s; (s = qcl_value_iter_next(&it));) ...
+ *
  * void qcl_add_value(qcl_config *config, const char *id, qcl_value  *value)
  *
- *   Add a new variable in-memory.
+ *   Add a new variable in-memory. `id` and `value` are still owned by
+ *   the caller and must outlive `config`.
+ *
+ *  void qcl_config_destroy(qcl_config *config)
+ *
+ *    Free everything that was created while parsing `config`. Any
+ *    qcl_value or string obtained from it is invalid afterwards.
  *
  * STRUCTS
  *
@@ -77,6 +148,13 @@
  *  VALUES
  *
  *    TODO
+ *
+ * INCLUDES
+ *
+ *  `include 'path';` runs the file at `path`, relative to the directory
+ *  of the file it appears in, as if its statements were written there.
+ *  The files of a config are parsed in parallel unless QCL_NO_THREADS
+ *  is defined, in which case qcl does not use pthreads at all.
  */
 
 #ifndef QCL_INCLUDED_H
@@ -91,25 +169,58 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+// Every allocation qcl makes goes through these, so they can be
+// overridden before including this file, e.g. to count allocations.
+// Memory handed to the caller (qcl_value_flatten()) is released with
+// free(), so overrides must stay compatible with the C allocator.
+#ifndef QCL_MALLOC
+#define QCL_MALLOC(n) malloc(n)
+#endif
+#ifndef QCL_CALLOC
+#define QCL_CALLOC(n, sz) calloc(n, sz)
+#endif
+#ifndef QCL_REALLOC
+#define QCL_REALLOC(p, n) realloc(p, n)
+#endif
+#ifndef QCL_FREE
+#define QCL_FREE(p) free(p)
+#endif
 
 /**
  * A simple generic map datastructure with C macro magic.
+ *
+ * Open addressing with linear probing. The table capacity is always a
+ * power of two and doubles whenever the load factor would go above
+ * QCL_MAP_MAX_LOAD_NUM/QCL_MAP_MAX_LOAD_DEN. The hash of every key is
+ * stored next to it so that probing and growing never re-hash and only
+ * call `cmp` on a full hash match. The map does not own its keys or
+ * values, `destroy` only frees the table itself.
  */
-#define QCL_MAP_DEFAULT_CAPACITY 2048
+#define QCL_MAP_DEFAULT_CAPACITY 16
+#define QCL_MAP_MAX_LOAD_NUM 3
+#define QCL_MAP_MAX_LOAD_DEN 4
 #define QCL_MAP_TYPE(ktype, vtype, mapname) \
         typedef unsigned (*qcl_##mapname##_hash_sig)(ktype *); \
         typedef int      (*qcl_##mapname##_cmp_sig)(ktype *, ktype *); \
         \
-        typedef struct __##mapname##_node { \
-                ktype k; \
-                vtype v; \
-                struct __##mapname##_node *n; \
-        } __##mapname##_node; \
+        typedef struct { \
+                ktype    k; \
+                vtype    v; \
+                unsigned h; \
+                int      used; \
+        } __##mapname##_slot, mapname##_slot; \
         \
         typedef struct { \
                 struct { \
-                        __##mapname##_node **data; \
-                        size_t len; \
+                        __##mapname##_slot *data; \
                         size_t cap; \
                         size_t sz; \
                 } tbl; \
@@ -122,17 +233,19 @@
         void     mapname##_insert(mapname *map, ktype k, vtype v); \
         int      mapname##_contains(mapname *map, ktype k); \
         vtype   *mapname##_get(mapname *map, ktype k); \
+        vtype   *mapname##_get_hashed(mapname *map, ktype k, unsigned h); \
+        void     mapname##_reserve(mapname *map, size_t n); \
+        mapname##_slot *mapname##_emplace(mapname *map, ktype k, int *added); \
         \
         mapname \
         mapname##_create(qcl_##mapname##_hash_sig hash, \
                          qcl_##mapname##_cmp_sig cmp) \
         { \
-                __##mapname##_node **data \
-                        = (__##mapname##_node **)calloc(QCL_MAP_DEFAULT_CAPACITY, sizeof(__##mapname##_node *)); \
+                __##mapname##_slot *data \
+                        = (__##mapname##_slot *)QCL_CALLOC(QCL_MAP_DEFAULT_CAPACITY, sizeof(__##mapname##_slot)); \
                 return (mapname) { \
                         .tbl = { \
                                 .data = data, \
-                                .len = 0, \
                                 .cap = QCL_MAP_DEFAULT_CAPACITY, \
                                 .sz = 0, \
                         }, \
@@ -142,30 +255,90 @@
         } \
         \
         void \
-        mapname##_insert(mapname *map, ktype k, vtype v) \
+        mapname##_destroy(mapname *map) \
+        { \
+                QCL_FREE(map->tbl.data); \
+                map->tbl.data = NULL; \
+                map->tbl.cap = 0; \
+                map->tbl.sz = 0; \
+        } \
+        \
+        static __##mapname##_slot * \
+        __##mapname##_find(mapname *map, ktype *k, unsigned h) \
         { \
-                unsigned idx = map->hash(&k) % map->tbl.cap; \
-                __##mapname##_node *it = map->tbl.data[idx]; \
-                __##mapname##_node *prev = NULL; \
-                while (it) { \
-                        if (!map->cmp(&it->k, &k)) { \
-                                it->v = v; \
-                                return; \
+                size_t mask = map->tbl.cap-1; \
+                size_t idx = h & mask; \
+                while (map->tbl.data[idx].used) { \
+                        __##mapname##_slot *it = &map->tbl.data[idx]; \
+                        if (it->h == h && !map->cmp(&it->k, k)) { \
+                                return it; \
                         } \
-                        prev = it; \
-                        it = it->n; \
+                        idx = (idx+1) & mask; \
                 } \
-                it = (__##mapname##_node *)malloc(sizeof(__##mapname##_node)); \
-                it->k = k; \
-                it->v = v; \
-                it->n = NULL; \
-                if (prev) { \
-                        prev->n = it; \
-                } else { \
-                        map->tbl.data[idx] = it; \
-                        ++map->tbl.len; \
+                return &map->tbl.data[idx]; \
+        } \
+        \
+        static void \
+        __##mapname##_grow(mapname *map) \
+        { \
+                __##mapname##_slot *old = map->tbl.data; \
+                size_t old_cap = map->tbl.cap; \
+                map->tbl.cap = old_cap ? old_cap*2 : QCL_MAP_DEFAULT_CAPACITY; \
+                map->tbl.data = (__##mapname##_slot *)QCL_CALLOC(map->tbl.cap, sizeof(__##mapname##_slot)); \
+                size_t mask = map->tbl.cap-1; \
+                for (size_t i = 0; i < old_cap; ++i) { \
+                        if (!old[i].used) continue; \
+                        size_t idx = old[i].h & mask; \
+                        while (map->tbl.data[idx].used) idx = (idx+1) & mask; \
+                        map->tbl.data[idx] = old[i]; \
+                } \
+                QCL_FREE(old); \
+        } \
+        \
+        void \
+        mapname##_reserve(mapname *map, size_t n) \
+        { \
+                while (n*QCL_MAP_MAX_LOAD_DEN > map->tbl.cap*QCL_MAP_MAX_LOAD_NUM) { \
+                        __##mapname##_grow(map); \
+                } \
+        } \
+        \
+        /* Find the slot of `k`, adding it without a value if it is not \
+           there yet, which is reported in `added`. The key of an added \
+           slot may be replaced with an equal one. */ \
+        mapname##_slot * \
+        mapname##_emplace(mapname *map, ktype k, int *added) \
+        { \
+                if ((map->tbl.sz+1)*QCL_MAP_MAX_LOAD_DEN > map->tbl.cap*QCL_MAP_MAX_LOAD_NUM) { \
+                        __##mapname##_grow(map); \
+                } \
+                unsigned h = map->hash(&k); \
+                __##mapname##_slot *it = __##mapname##_find(map, &k, h); \
+                *added = !it->used; \
+                if (!it->used) { \
+                        it->k = k; \
+                        it->h = h; \
+                        it->used = 1; \
+                        ++map->tbl.sz; \
+                } \
+                return it; \
+        } \
+        \
+        void \
+        mapname##_insert(mapname *map, ktype k, vtype v) \
+        { \
+                if ((map->tbl.sz+1)*QCL_MAP_MAX_LOAD_DEN > map->tbl.cap*QCL_MAP_MAX_LOAD_NUM) { \
+                        __##mapname##_grow(map); \
+                } \
+                unsigned h = map->hash(&k); \
+                __##mapname##_slot *it = __##mapname##_find(map, &k, h); \
+                if (!it->used) { \
+                        it->k = k; \
+                        it->h = h; \
+                        it->used = 1; \
+                        ++map->tbl.sz; \
                 } \
-                ++map->tbl.sz; \
+                it->v = v; \
         } \
         \
         int \
@@ -177,15 +350,18 @@
         vtype * \
         mapname##_get(mapname *map, ktype k) \
         { \
-                unsigned idx = map->hash(&k) % map->tbl.cap; \
-                __##mapname##_node *it = map->tbl.data[idx]; \
-                while (it) { \
-                        if (!map->cmp(&it->k, &k)) { \
-                                return &it->v; \
-                        } \
-                        it = it->n; \
-                } \
-                return NULL; \
+                if (!map->tbl.cap) return NULL; \
+                return mapname##_get_hashed(map, k, map->hash(&k)); \
+        } \
+        \
+        /* Same as get() for a `h` that is already known to be the hash \
+           of `k`. */ \
+        vtype * \
+        mapname##_get_hashed(mapname *map, ktype k, unsigned h) \
+        { \
+                if (!map->tbl.cap) return NULL; \
+                __##mapname##_slot *it = __##mapname##_find(map, &k, h); \
+                return it->used ? &it->v : NULL; \
         } \
 
 #define QCL_ARRAY_TYPE(ty, name)                \
@@ -205,14 +381,14 @@
         struct {                                                        \
                 ty *data;                                               \
                 size_t len, cap;                                        \
-        } (name) = { .data = (typeof(ty) *)malloc(sizeof(ty)), .len = 0, .cap = 1 };
+        } (name) = { .data = (typeof(ty) *)QCL_MALLOC(sizeof(ty)), .len = 0, .cap = 1 };
 
 #define qcl_array_append(da, value)                                     \
         do {                                                            \
                 if ((da).len >= (da).cap) {                             \
                         (da).cap = (da).cap ? (da).cap * 2 : 2;         \
                         (da).data = (typeof(*((da).data)) *)            \
-                                realloc((da).data,                      \
+                                QCL_REALLOC((da).data,                  \
                                         (da).cap * sizeof(*((da).data))); \
                 }                                                       \
                 (da).data[(da).len++] = (value);                        \
@@ -221,7 +397,7 @@
 #define qcl_array_free(da)                      \
         do {                                    \
                 if ((da).data != NULL) {        \
-                        free((da).data);        \
+                        QCL_FREE((da).data);    \
                 }                               \
                 (da).len = (da).cap = 0;        \
         } while (0)
@@ -239,6 +415,42 @@
 
 QCL_ARRAY_TYPE(char *, qcl_str_array);
 
+// FNV-1a, 64 bit over a byte range.
+static uint64_t
+_qcl_hash64(const uint8_t *p, size_t n)
+{
+        uint64_t hash = 14695981039346656037ull;
+        for (size_t i = 0; i < n; ++i) {
+                hash ^= p[i];
+                hash *= 1099511628211ull;
+        }
+        return hash;
+}
+
+// FNV-1a
+static unsigned
+_qcl_strhash(const char *s)
+{
+        uint32_t hash = 2166136261u;
+        while (*s) {
+                hash ^= (uint8_t)*s++;
+                hash *= 16777619u;
+        }
+        return hash;
+}
+
+// Same as _qcl_strhash() over `n` bytes.
+static unsigned
+_qcl_strnhash(const char *s, size_t n)
+{
+        uint32_t hash = 2166136261u;
+        for (size_t i = 0; i < n; ++i) {
+                hash ^= (uint8_t)s[i];
+                hash *= 16777619u;
+        }
+        return hash;
+}
+
 // ####################
 // # ARENA            #
 // ####################
@@ -249,43 +461,68 @@ QCL_ARRAY_TYPE(char *, qcl_str_array);
 #endif
 #define _QCL_ARENA_ALIGN_MASK (QCL_ARENA_ALIGN_SIZE-1)
 
+/**
+ * The arena is a list of fixed size chunks. Allocations never move, so
+ * pointers into the arena stay valid until it is freed. Requests that
+ * are larger than the chunk size get a chunk of their own. A zeroed
+ * arena is valid and uses QCL_ARENA_DEFAULT_ALLOC_SIZE chunks.
+ */
+typedef struct _qcl_arena_chunk {
+        struct _qcl_arena_chunk *next;
+        size_t                   cap;
+        size_t                   offset;
+        _Alignas(QCL_ARENA_ALIGN_SIZE) uint8_t buf[];
+} _qcl_arena_chunk;
+
 typedef struct {
-        uint8_t *buf;
-        size_t   cap;
-        size_t   offset;
+        _qcl_arena_chunk *hd;
+        size_t            chunk_size;
 } _qcl_arena;
 
-static void
-_qcl_arena_init(_qcl_arena *a,
-                size_t      bytes)
-{
-        a->buf    = (uint8_t *)calloc(bytes, 1);
-        a->cap    = bytes;
-        a->offset = 0;
-}
-
 static inline size_t
 _qcl_arena_alignup(size_t n)
 {
         return (n + _QCL_ARENA_ALIGN_MASK) & ~_QCL_ARENA_ALIGN_MASK;
 }
 
+static _qcl_arena_chunk *
+_qcl_arena_chunk_alloc(size_t bytes)
+{
+        _qcl_arena_chunk *c = (_qcl_arena_chunk *)QCL_MALLOC(sizeof(_qcl_arena_chunk) + bytes);
+        if (!c) {
+                fprintf(stderr, "FATAL: _qcl_arena_alloc: could not allocate chunk\n");
+                exit(1);
+        }
+        c->next   = NULL;
+        c->cap    = bytes;
+        c->offset = 0;
+        return c;
+}
+
+static void
+_qcl_arena_init(_qcl_arena *a,
+                size_t      bytes)
+{
+        a->chunk_size = _qcl_arena_alignup(bytes);
+        a->hd         = _qcl_arena_chunk_alloc(a->chunk_size);
+}
+
 static void *
 _qcl_arena_alloc(_qcl_arena *a, size_t size)
 {
-        size_t aligned    = _qcl_arena_alignup(size);
-        size_t new_offset = a->offset + aligned;
+        size_t aligned = _qcl_arena_alignup(size);
 
-        if (new_offset > a->cap) {
-                a->cap *= 2;
-                if (!(a->buf = (uint8_t *)realloc(a->buf, a->cap))) {
-                        fprintf(stderr, "FATAL: _qcl_arena_alloc: could not realloc buffer\n");
-                        exit(1);
-                }
+        if (!a->chunk_size) a->chunk_size = QCL_ARENA_DEFAULT_ALLOC_SIZE;
+
+        if (!a->hd || a->hd->offset + aligned > a->hd->cap) {
+                _qcl_arena_chunk *c = _qcl_arena_chunk_alloc(aligned > a->chunk_size
+                                                             ? aligned : a->chunk_size);
+                c->next = a->hd;
+                a->hd   = c;
         }
 
-        void *p   = a->buf + a->offset;
-        a->offset = new_offset;
+        void *p        = a->hd->buf + a->hd->offset;
+        a->hd->offset += aligned;
         return p;
 }
 
@@ -299,49 +536,78 @@ _qcl_arena_allocz(_qcl_arena *a, size_t size)
 }
 #endif
 
-static void
-_qcl_arena_clear(_qcl_arena *a)
+static char *
+_qcl_arena_strndup(_qcl_arena *a, const char *s, size_t n)
+{
+        char *p = (char *)_qcl_arena_alloc(a, n+1);
+        memcpy(p, s, n);
+        p[n] = 0;
+        return p;
+}
+
+static char *
+_qcl_arena_strdup(_qcl_arena *a, const char *s)
 {
-        a->offset = 0;
+        return _qcl_arena_strndup(a, s, strlen(s));
 }
 
+// Move the contents of a QCL_ARRAY_TYPE into the arena, trimmed to its
+// length, and free the original buffer.
+#define _qcl_array_to_arena(a, da)                                              \
+        do {                                                                    \
+                size_t __n = (da).len * sizeof(*(da).data);                     \
+                void  *__p = _qcl_arena_alloc((a), __n ? __n : 1);              \
+                if (__n) memcpy(__p, (da).data, __n);                           \
+                QCL_FREE((da).data);                                            \
+                (da).data = (typeof((da).data))__p;                             \
+                (da).cap  = (da).len;                                           \
+        } while (0)
+
 static void
 _qcl_arena_free(_qcl_arena *a)
 {
-        if (a->buf) free(a->buf);
-        a->buf    = NULL;
-        a->cap    = 0;
-        a->offset = 0;
+        _qcl_arena_chunk *c = a->hd;
+        while (c) {
+                _qcl_arena_chunk *next = c->next;
+                QCL_FREE(c);
+                c = next;
+        }
+        a->hd = NULL;
 }
 
 // ####################
 // # KEYWORDS         #
 // ####################
 
-#define QCL_KWD_NULL  "null"
-#define QCL_KWD_IF    "if"
-#define QCL_KWD_ELSE  "else"
-#define QCL_KWD_TRUE  "true"
-#define QCL_KWD_FALSE "false"
-#define QCL_KWD_CL {   \
-        QCL_KWD_NULL,  \
-        QCL_KWD_IF,    \
-        QCL_KWD_ELSE,  \
-        QCL_KWD_TRUE,  \
-        QCL_KWD_FALSE, \
-        NULL,          \
+#define QCL_KWD_NULL    "null"
+#define QCL_KWD_IF      "if"
+#define QCL_KWD_ELSE    "else"
+#define QCL_KWD_TRUE    "true"
+#define QCL_KWD_FALSE   "false"
+#define QCL_KWD_INCLUDE "include"
+#define QCL_KWD_CL {     \
+        QCL_KWD_NULL,    \
+        QCL_KWD_IF,      \
+        QCL_KWD_ELSE,    \
+        QCL_KWD_TRUE,    \
+        QCL_KWD_FALSE,   \
+        QCL_KWD_INCLUDE, \
+        NULL,            \
 }
 
 static int
-_qcl_is_kw(const char *s)
+_qcl_is_kw(const char *s,
+           size_t      n)
 {
-        static const char *kwds[] = QCL_KWD_CL;
-        for (size_t i = 0; kwds[i]; ++i) {
-                if (!strcmp(s, kwds[i])) {
-                        return 1;
-                }
+        switch (n) {
+        case 2: return !memcmp(s, QCL_KWD_IF, 2);
+        case 4: return !memcmp(s, QCL_KWD_NULL, 4)
+                        || !memcmp(s, QCL_KWD_ELSE, 4)
+                        || !memcmp(s, QCL_KWD_TRUE, 4);
+        case 5: return !memcmp(s, QCL_KWD_FALSE, 5);
+        case 7: return !memcmp(s, QCL_KWD_INCLUDE, 7);
+        default: return 0;
         }
-        return 0;
 }
 
 typedef enum {
@@ -366,9 +632,17 @@ typedef enum {
         _QCL_TT_BANG,
 } _qcl_tt;
 
+// A byte range that is not NUL-terminated, usually a lexeme inside
+// the source.
+typedef struct {
+        const char *s;
+        size_t      n;
+} _qcl_slice;
+
 typedef struct {
         size_t      r;
         size_t      c;
+        size_t      off; // byte offset of the token in the source
         const char *fp;
 } _qcl_loc;
 
@@ -377,166 +651,258 @@ typedef struct {
         _qcl_loc loc;
 } _qcl_err;
 
-typedef struct _qcl_token {
-        char              *lx;
-        _qcl_tt            ty;
-        _qcl_loc           loc;
-        struct _qcl_token *n;
+// Tokens point into the source instead of owning a copy of their
+// lexeme. For strings the range excludes the quotes.
+typedef struct {
+        uint32_t off;
+        uint32_t len;
+        _qcl_tt  ty;
 } _qcl_token;
 
+QCL_ARRAY_TYPE(_qcl_token, _qcl_token_array);
+
 typedef struct {
-        _qcl_token      *hd;
-        _qcl_token      *tl;
-        const char      *fp;
-        _qcl_err         err;
-        _qcl_arena       tarena;
+        const char       *src; // NUL-terminated, owned by the caller
+        size_t            src_n;
+        _qcl_token_array  toks;
+        size_t            pos; // next token handed to the parser
+        const char       *fp;
+        _qcl_err          err;
+        _qcl_arena        tarena;
 } _qcl_lexer;
 
-static _qcl_token *
-_qcl_token_alloc(const char *st,
-                 size_t      st_n,
-                 _qcl_tt     ty,
-                 size_t      r,
-                 size_t      c,
-                 const char *fp,
-                 _qcl_arena *a)
-{
-        _qcl_token *t = (_qcl_token *)_qcl_arena_alloc(a, sizeof(_qcl_token));
-        t->lx         = strndup(st, st_n);
-        t->ty         = ty;
-        t->loc.r      = r;
-        t->loc.c      = c;
-        t->loc.fp     = fp;
-        return t;
+static inline _qcl_slice
+_qcl_token_slice(const _qcl_lexer *l,
+                 const _qcl_token *t)
+{
+        return (_qcl_slice) { l->src + t->off, t->len };
 }
 
-static void
-_qcl_lexer_append(_qcl_lexer *l, _qcl_token *t)
+static inline int
+_qcl_token_is(const _qcl_lexer *l,
+              const _qcl_token *t,
+              const char       *s)
 {
-        if (!l->hd && !l->tl) {
-                l->hd = l->tl = t;
-        } else {
-                l->tl->n = t;
-                l->tl = l->tl->n;
-        }
+        return t->len == strlen(s) && !memcmp(l->src + t->off, s, t->len);
 }
 
-static size_t
-_qcl_consume_while(const char *st,
-                   int (*pred)(int))
+// Rows and columns are not tracked while lexing. They are counted
+// here, only when a location is reported.
+static _qcl_loc
+_qcl_loc_at(const char *src,
+            size_t      off,
+            const char *fp)
 {
-        size_t i = 0;
-        while (st[i] && pred(st[i])) ++i;
-        return i;
+        _qcl_loc loc = { .r = 1, .c = 1, .off = off, .fp = fp };
+        for (size_t i = 0; i < off && src[i]; ++i) {
+                if (src[i] == '\n') ++loc.r, loc.c = 1;
+                else                ++loc.c;
+        }
+        return loc;
 }
 
-static int
-_qcl_isident(int c)
+// The location of `t` for the AST. Only `off` and `fp` are set, see
+// _qcl_lexer_errloc().
+static inline _qcl_loc
+_qcl_token_loc(const _qcl_lexer *l,
+               const _qcl_token *t)
 {
-        return isalnum(c) || c == '_' || c == '-';
+        return (_qcl_loc) {
+                .r   = 0,
+                .c   = 0,
+                .off = t->off - (t->ty == _QCL_TT_STRING),
+                .fp  = l->fp,
+        };
 }
-static int _qcl_notsinglequote(int c) { return c != '\''; }
-static int _qcl_notquote(int c)       { return c != '"';  }
-static int
-_qcl_issym(int c)
+
+static inline _qcl_loc
+_qcl_lexer_errloc(const _qcl_lexer *l,
+                  _qcl_loc          loc)
 {
-        return _qcl_notsinglequote(c)
-                && _qcl_notquote(c)
-                && !_qcl_isident(c)
-                && c != '\n'
-                && c != ' '
-                && c != '\t';
+        return _qcl_loc_at(l->src, loc.off, l->fp);
 }
 
 static _qcl_token *
 _qcl_lexer_peek(const _qcl_lexer *l,
                 size_t            p)
 {
-        _qcl_token *it = l->hd;
-        for (size_t i = 0; it && i < p; ++i) {
-                it = it->n;
-        }
-        return it;
+        return l->pos + p < l->toks.len ? &l->toks.data[l->pos + p] : NULL;
 }
 
 static _qcl_token *
 _qcl_lexer_next(_qcl_lexer *l)
 {
-        if (!l->hd) return NULL;
-        _qcl_token *t = l->hd;
-        l->hd = l->hd->n;
-        return t;
+        return l->pos < l->toks.len ? &l->toks.data[l->pos++] : NULL;
 }
 
 static void
 _qcl_lexer_dump(const _qcl_lexer *l)
 {
-        _qcl_token *it = l->hd;
-        while (it) {
-                printf("{ lx=%s, ty=%d, r=%zu, c=%zu, fp=%s }\n",
-                       it->lx, it->ty, it->loc.r, it->loc.c, it->loc.fp);
-                it = it->n;
+        for (size_t i = 0; i < l->toks.len; ++i) {
+                const _qcl_token *t   = &l->toks.data[i];
+                _qcl_loc          loc = _qcl_lexer_errloc(l, _qcl_token_loc(l, t));
+                printf("{ lx=%.*s, ty=%d, r=%zu, c=%zu, fp=%s }\n",
+                       (int)t->len, l->src + t->off, t->ty, loc.r, loc.c, loc.fp);
         }
 }
 
-QCL_MAP_TYPE(const char *, _qcl_tt, symmap);
+// Character classes for the first byte of a token.
+typedef enum {
+        _QCL_CC_INVALID = 0,
+        _QCL_CC_NUL,
+        _QCL_CC_SPACE,
+        _QCL_CC_NEWLINE,
+        _QCL_CC_COMMENT,
+        _QCL_CC_IDENT,
+        _QCL_CC_DIGIT,
+        _QCL_CC_QUOTE,
+        _QCL_CC_SYM,
+} _qcl_cc;
+
+#define _QCL_CC_RANGE(lo, hi, cc) [lo ... hi] = cc
+
+static const uint8_t _qcl_cc_tbl[256] = {
+        ['\0'] = _QCL_CC_NUL,
+        [' ']  = _QCL_CC_SPACE,
+        ['\t'] = _QCL_CC_SPACE,
+        ['\r'] = _QCL_CC_SPACE,
+        ['\n'] = _QCL_CC_NEWLINE,
+        ['#']  = _QCL_CC_COMMENT,
+        ['"']  = _QCL_CC_QUOTE,
+        ['\''] = _QCL_CC_QUOTE,
+        ['_']  = _QCL_CC_IDENT,
+        ['-']  = _QCL_CC_IDENT,
+        _QCL_CC_RANGE('a', 'z', _QCL_CC_IDENT),
+        _QCL_CC_RANGE('A', 'Z', _QCL_CC_IDENT),
+        _QCL_CC_RANGE('0', '9', _QCL_CC_DIGIT),
+        ['='] = _QCL_CC_SYM, ['['] = _QCL_CC_SYM, [']'] = _QCL_CC_SYM,
+        [','] = _QCL_CC_SYM, ['{'] = _QCL_CC_SYM, ['}'] = _QCL_CC_SYM,
+        ['$'] = _QCL_CC_SYM, [';'] = _QCL_CC_SYM, [':'] = _QCL_CC_SYM,
+        ['!'] = _QCL_CC_SYM, ['+'] = _QCL_CC_SYM,
+};
+
+// Bytes that may continue an identifier.
+static const uint8_t _qcl_ident_tbl[256] = {
+        ['_'] = 1,
+        ['-'] = 1,
+        _QCL_CC_RANGE('a', 'z', 1),
+        _QCL_CC_RANGE('A', 'Z', 1),
+        _QCL_CC_RANGE('0', '9', 1),
+};
+
+static const uint8_t _qcl_digit_tbl[256] = {
+        _QCL_CC_RANGE('0', '9', 1),
+};
 
-static unsigned
-_qcl_symmap_hash(const char **s)
+/**
+ * Static symbol trie. State 0 is the root and a transition to 0 means
+ * there is no edge, so scanning a symbol is a longest-match walk that
+ * remembers the last accepting state. Multi-character symbols are
+ * added by giving a leaf its own row of edges.
+ */
+enum {
+        _QCL_SYM_ROOT = 0,
+        _QCL_SYM_EQUALS,
+        _QCL_SYM_LSQR,
+        _QCL_SYM_RSQR,
+        _QCL_SYM_COMMA,
+        _QCL_SYM_LCURLY,
+        _QCL_SYM_RCURLY,
+        _QCL_SYM_DOLLAR,
+        _QCL_SYM_SEMICOLON,
+        _QCL_SYM_COLON,
+        _QCL_SYM_BANG,
+        _QCL_SYM_PLUS,
+        _QCL_SYM_STATES,
+};
+
+static const uint8_t _qcl_sym_trie[_QCL_SYM_STATES][256] = {
+        [_QCL_SYM_ROOT] = {
+                ['='] = _QCL_SYM_EQUALS,
+                ['['] = _QCL_SYM_LSQR,
+                [']'] = _QCL_SYM_RSQR,
+                [','] = _QCL_SYM_COMMA,
+                ['{'] = _QCL_SYM_LCURLY,
+                ['}'] = _QCL_SYM_RCURLY,
+                ['$'] = _QCL_SYM_DOLLAR,
+                [';'] = _QCL_SYM_SEMICOLON,
+                [':'] = _QCL_SYM_COLON,
+                ['!'] = _QCL_SYM_BANG,
+                ['+'] = _QCL_SYM_PLUS,
+        },
+};
+
+static const _qcl_tt _qcl_sym_accept[_QCL_SYM_STATES] = {
+        [_QCL_SYM_ROOT]      = _QCL_TT_NONE,
+        [_QCL_SYM_EQUALS]    = _QCL_TT_EQUALS,
+        [_QCL_SYM_LSQR]      = _QCL_TT_LSQR,
+        [_QCL_SYM_RSQR]      = _QCL_TT_RSQR,
+        [_QCL_SYM_COMMA]     = _QCL_TT_COMMA,
+        [_QCL_SYM_LCURLY]    = _QCL_TT_LCURLY,
+        [_QCL_SYM_RCURLY]    = _QCL_TT_RCURLY,
+        [_QCL_SYM_DOLLAR]    = _QCL_TT_DOLLAR,
+        [_QCL_SYM_SEMICOLON] = _QCL_TT_SEMICOLON,
+        [_QCL_SYM_COLON]     = _QCL_TT_COLON,
+        [_QCL_SYM_BANG]      = _QCL_TT_BANG,
+        [_QCL_SYM_PLUS]      = _QCL_TT_PLUS,
+};
+
+static size_t
+_qcl_determine_sym(const uint8_t *st,
+                   _qcl_tt       *ty)
 {
-        // TODO: not sure why this wont this work
+        size_t len = 0, i = 0;
+        uint8_t state = _QCL_SYM_ROOT;
 
-        /* unsigned hash = 5381; */
-        /* int c; */
+        *ty = _QCL_TT_NONE;
 
-        /* while ((c = *(*s)++)) */
-        /*         hash = ((hash << 5) + hash) + c; /\* hash * 33 + c *\/ */
+        while ((state = _qcl_sym_trie[state][st[i]]) != _QCL_SYM_ROOT) {
+                ++i;
+                if (_qcl_sym_accept[state] != _QCL_TT_NONE) {
+                        *ty = _qcl_sym_accept[state];
+                        len = i;
+                }
+        }
 
-        /* return hash; */
-        return **s;
+        return len;
 }
 
-static int
-_qcl_symmap_cmp(const char **s0,
-                const char **s1)
+static void
+_qcl_lexer_seterr(_qcl_lexer *l,
+                  const char *msg,
+                  size_t      off)
 {
-        return strcmp(*s0, *s1);
+        l->err.msg = msg;
+        l->err.loc = _qcl_loc_at(l->src, off, l->fp);
 }
 
-static size_t
-_qcl_determine_sym(const char *st,
-                   size_t      len,
-                   _qcl_tt    *ty,
-                   symmap     *map)
+static void
+_qcl_lexer_push(_qcl_lexer *l,
+                size_t      off,
+                size_t      len,
+                _qcl_tt     ty)
 {
-        *ty = _QCL_TT_NONE;
-
-        char buf[256] = {0};
-        (void)strncpy(buf, st, len);
-
-        for (int i = len-1; i >= 0; --i) {
-                if (symmap_contains(map, buf)) {
-                        *ty = *symmap_get(map, buf);
-                        return (size_t)i+1;
-                }
-
-                assert(i < 256);
-
-                buf[i] = 0;
-        }
-
-        return _QCL_TT_NONE;
+        qcl_array_append(l->toks, ((_qcl_token) {
+                .off = (uint32_t)off,
+                .len = (uint32_t)len,
+                .ty  = ty,
+        }));
 }
 
+// Tokenize the `n` bytes at `source`, which must be followed by a NUL
+// byte and outlive the lexer.
 static _qcl_lexer
 _qcl_lex_file(const char *fp,
-              const char *src)
+              const char *source,
+              size_t      n)
 {
-        symmap symmap = symmap_create(_qcl_symmap_hash, _qcl_symmap_cmp);
+        const uint8_t *src = (const uint8_t *)source;
 
         _qcl_lexer lexer = {
-                .hd = NULL,
-                .tl = NULL,
+                .src = source,
+                .src_n = n,
+                .toks = qcl_array_empty(_qcl_token_array),
+                .pos = 0,
                 .fp = fp,
                 .err = {
                         .msg = NULL,
@@ -545,119 +911,160 @@ _qcl_lex_file(const char *fp,
                 .tarena = {0},
         };
 
-        _qcl_arena_init(&lexer.tarena, QCL_ARENA_DEFAULT_ALLOC_SIZE * sizeof(_qcl_token));
-        symmap_insert(&symmap, "=", _QCL_TT_EQUALS);
-        symmap_insert(&symmap, "[", _QCL_TT_LSQR);
-        symmap_insert(&symmap, "]", _QCL_TT_RSQR);
-        symmap_insert(&symmap, ",", _QCL_TT_COMMA);
-        symmap_insert(&symmap, "{", _QCL_TT_LCURLY);
-        symmap_insert(&symmap, "}", _QCL_TT_RCURLY);
-        symmap_insert(&symmap, "$", _QCL_TT_DOLLAR);
-        symmap_insert(&symmap, ";", _QCL_TT_SEMICOLON);
-        symmap_insert(&symmap, ":", _QCL_TT_COLON);
-        symmap_insert(&symmap, "!", _QCL_TT_BANG);
-        symmap_insert(&symmap, "+", _QCL_TT_PLUS);
-
-        size_t r = 1, c = 1, i = 0;
-        while (src[i]) {
-                char ch = src[i];
-
-                if (ch == ' ' || ch == '\t') {
-                        ++i, ++c;
-                } else if (ch == '\n') {
-                        ++i, ++r, c = 1;
-                } else if (ch == '#') {
-                        while (src[i] != '\n') ++i, ++c;
-                        ++i, ++r, c = 1;
-                } else if (isalpha(ch) || ch == '_' || ch == '-') {
-                        size_t len = _qcl_consume_while(src+i, _qcl_isident);
-                        _qcl_token *t = _qcl_token_alloc(src+i, len,
-                                                         _QCL_TT_IDENTIFIER,
-                                                         r, c, lexer.fp,
-                                                         &lexer.tarena);
-                        if (_qcl_is_kw(t->lx)) {
-                                t->ty = _QCL_TT_KEYWORD;
-                        }
-                        _qcl_lexer_append(&lexer, t);
-                        i += len, c += len;
-                } else if (isdigit(ch)) {
-                        size_t len = _qcl_consume_while(src+i, isdigit);
-                        _qcl_token *t = _qcl_token_alloc(src+i, len,
-                                                         _QCL_TT_DIGIT,
-                                                         r, c, lexer.fp,
-                                                         &lexer.tarena);
-                        _qcl_lexer_append(&lexer, t);
-                        i += len, c += len;
-                } else if (ch == '"' || ch == '\'') {
-                        size_t len;
-                        if (ch == '"') {
-                                len = _qcl_consume_while(src+i+1, _qcl_notquote);
-                        } else {
-                                len = _qcl_consume_while(src+i+1, _qcl_notsinglequote);
+        // Offsets are stored in 32 bits.
+        if (n > UINT32_MAX) {
+                _qcl_lexer_seterr(&lexer, "file too large", 0);
+                return lexer;
+        }
+
+        // The parser allocates the AST from `tarena`.
+        _qcl_arena_init(&lexer.tarena, QCL_ARENA_DEFAULT_ALLOC_SIZE * 16);
+
+        // Roughly one token per 6 bytes of a typical config.
+        lexer.toks.cap  = n/6 + 16;
+        lexer.toks.data = (_qcl_token *)QCL_MALLOC(lexer.toks.cap * sizeof(_qcl_token));
+
+        size_t i = 0;
+        while (1) {
+                size_t      len = 0;
+                _qcl_tt     ty  = _QCL_TT_NONE;
+                const char *lx  = (const char *)src+i;
+
+                switch ((_qcl_cc)_qcl_cc_tbl[src[i]]) {
+                case _QCL_CC_NUL: goto eof;
+                case _QCL_CC_SPACE:
+                case _QCL_CC_NEWLINE: {
+                        ++i;
+                } continue;
+                case _QCL_CC_COMMENT: {
+                        while (src[i] && src[i] != '\n') ++i;
+                } continue;
+                case _QCL_CC_IDENT: {
+                        while (_qcl_ident_tbl[src[i+len]]) ++len;
+                        // A dotted path like `viewer.wrap` is a single
+                        // identifier.
+                        while (src[i+len] == '.' && _qcl_cc_tbl[src[i+len+1]] == _QCL_CC_IDENT) {
+                                ++len;
+                                while (_qcl_ident_tbl[src[i+len]]) ++len;
                         }
-                        _qcl_token *t = _qcl_token_alloc(src+i+1, len,
-                                                         _QCL_TT_STRING,
-                                                         r, c, lexer.fp,
-                                                         &lexer.tarena);
-                        _qcl_lexer_append(&lexer, t);
-                        i += len+2, c += len+2;
-                } else {
-                        size_t len     = _qcl_consume_while(src+i, _qcl_issym);
-                        //size_t old_len = len;
-                        _qcl_tt ty     = _QCL_TT_NONE;
-                        len            = _qcl_determine_sym(src+i, len, &ty, &symmap);
-                        if (ty == _QCL_TT_NONE) {
-                                // TODO: put error in error struct of lexer.
-                                /* char buf[256] = {0}; */
-                                /* strncpy(buf, src+i, old_len); */
-                                /* printf("error: unknown symbol: %s\n", buf); */
-                                /* exit(1); */
-                                lexer.err.msg = "invalid symbol";
-                                lexer.err.loc = (_qcl_loc) {
-                                        .r = r,
-                                        .c = c,
-                                        .fp = lexer.fp,
-                                };
+                        ty = _qcl_is_kw(lx, len) ? _QCL_TT_KEYWORD : _QCL_TT_IDENTIFIER;
+                } break;
+                case _QCL_CC_DIGIT: {
+                        while (_qcl_digit_tbl[src[i+len]]) ++len;
+                        ty = _QCL_TT_DIGIT;
+                } break;
+                case _QCL_CC_QUOTE: {
+                        const uint8_t  quote = src[i];
+                        const uint8_t *end   = (const uint8_t *)strchr((const char *)src+i+1, quote);
+                        if (!end) {
+                                _qcl_lexer_seterr(&lexer, "unterminated string", i);
                                 return lexer;
                         }
-                        _qcl_token *t = _qcl_token_alloc(src+i, len,
-                                                         ty, r, c, lexer.fp,
-                                                         &lexer.tarena);
-                        _qcl_lexer_append(&lexer, t);
-                        i += len, c += len;
+                        len = end - (src+i+1);
+                        _qcl_lexer_push(&lexer, i+1, len, _QCL_TT_STRING);
+                        i += len+2;
+                } continue;
+                case _QCL_CC_SYM: {
+                        len = _qcl_determine_sym(src+i, &ty);
+                        if (ty != _QCL_TT_NONE) break;
+                } /* fallthrough */
+                case _QCL_CC_INVALID: {
+                        _qcl_lexer_seterr(&lexer, "invalid symbol", i);
+                        return lexer;
+                }
                 }
-        }
 
-        _qcl_token *t = _qcl_token_alloc("EOF", 3, _QCL_TT_EOF, r, c, lexer.fp, &lexer.tarena);
-        _qcl_lexer_append(&lexer, t);
+                _qcl_lexer_push(&lexer, i, len, ty);
+                i += len;
+        }
 
-        //symmap_destroy(&symmap);
+ eof:
+        _qcl_lexer_push(&lexer, i, 0, _QCL_TT_EOF);
 
         return lexer;
 }
 
-static char *
-_qcl_load_file(const char *path)
+static void
+_qcl_lexer_free(_qcl_lexer *l)
 {
-        FILE   *f;
-        char   *buf;
-        size_t  size;
+        qcl_array_free(l->toks);
+        _qcl_arena_free(&l->tarena);
+}
 
-        if ((f = fopen(path, "rb")) == NULL)
-                return NULL;
+/**
+ * The contents of a file, followed by a NUL byte. Files of at least
+ * _QCL_MMAP_MIN bytes are mmap()'d so lexing and parsing do not copy
+ * the source; the tail of the last page, which the kernel zero fills,
+ * provides the NUL. The last page is written to once so it becomes
+ * private and stays terminated even if the file is appended to while
+ * it is mapped. Smaller files, and files that exactly fill their last
+ * page, are read() into a buffer instead.
+ *
+ * A mapping raises SIGBUS when a page past the end of a file that was
+ * truncated meanwhile is touched, and configs are reloaded while they
+ * are being edited. Configs are small, so only inputs too large to
+ * copy cheaply take that risk.
+ */
+
+#define _QCL_MMAP_MIN (1u << 20)
 
-        fseek(f, 0, SEEK_END);
-        size = ftell(f);
-        fseek(f, 0, SEEK_SET);
+typedef struct {
+        const char *data;
+        size_t      len;
+        int         mapped;
+} _qcl_source;
 
-        buf = (char *)malloc(size + 1);
-        int _ = fread(buf, 1, size, f);
-        (void)_;
-        fclose(f);
+static int
+_qcl_load_file(const char  *path,
+               _qcl_source *out)
+{
+        struct stat st;
+        int         fd;
+        char       *buf;
+        size_t      size;
 
-        buf[size] = '\0';
+        memset(out, 0, sizeof(*out));
 
-        return buf;
+        if ((fd = open(path, O_RDONLY|O_CLOEXEC)) == -1) return 0;
+        if (fstat(fd, &st) != 0) {
+                close(fd);
+                return 0;
+        }
+
+        size = (size_t)st.st_size;
+
+        if (size >= _QCL_MMAP_MIN && size % (size_t)sysconf(_SC_PAGESIZE) != 0) {
+                buf = (char *)mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+                if (buf != MAP_FAILED) {
+                        close(fd);
+                        buf[size] = '\0';
+                        *out = (_qcl_source) { buf, size, 1 };
+                        return 1;
+                }
+        }
+
+        buf = (char *)QCL_MALLOC(size + 1);
+        size_t n = 0;
+        while (n < size) {
+                ssize_t k = read(fd, buf + n, size - n);
+                if (k < 0 && errno == EINTR) continue;
+                if (k <= 0) break;
+                n += k;
+        }
+        close(fd);
+
+        buf[n] = '\0';
+        *out = (_qcl_source) { buf, n, 0 };
+
+        return 1;
+}
+
+static void
+_qcl_source_free(_qcl_source *src)
+{
+        if (src->mapped) munmap((void *)src->data, src->len);
+        else             QCL_FREE((void *)src->data);
+        memset(src, 0, sizeof(*src));
 }
 
 // ###############
@@ -678,6 +1085,7 @@ static void *_qcl_accept_expr_binary(_qcl_expr *e, _qcl_visitor *v);
 static void *_qcl_accept_stmt_assigment(_qcl_stmt *s, _qcl_visitor *v);
 static void *_qcl_accept_stmt_if(_qcl_stmt *s, _qcl_visitor *v);
 static void *_qcl_accept_stmt_block(_qcl_stmt *s, _qcl_visitor *v);
+static void *_qcl_accept_stmt_include(_qcl_stmt *s, _qcl_visitor *v);
 
 typedef enum {
         _QCL_TYPE_STRING = 0,
@@ -717,12 +1125,12 @@ QCL_ARRAY_TYPE(_qcl_expr *, _qcl_expr_array);
 
 typedef struct {
         _qcl_expr    base;
-        const char  *s;
+        _qcl_slice   s;  // into the source
 } _qcl_expr_string;
 
 typedef struct {
         _qcl_expr    base;
-        const char  *id;
+        _qcl_slice   id; // into the source
 } _qcl_expr_identifier;
 
 typedef struct {
@@ -754,10 +1162,11 @@ typedef struct {
 } _qcl_expr_binary;
 
 static _qcl_expr_env *
-_qcl_expr_env_alloc(_qcl_expr *rhs)
+_qcl_expr_env_alloc(_qcl_arena *a,
+                    _qcl_expr  *rhs)
 {
         _qcl_expr_env *expr =
-                (_qcl_expr_env *)malloc(sizeof(_qcl_expr_env));
+                (_qcl_expr_env *)_qcl_arena_alloc(a, sizeof(_qcl_expr_env));
         expr->rhs = rhs;
         expr->base = (_qcl_expr) {
                 .kind = _QCL_EXPR_KIND_ENV,
@@ -768,10 +1177,11 @@ _qcl_expr_env_alloc(_qcl_expr *rhs)
 }
 
 static _qcl_expr_string *
-_qcl_expr_string_alloc(const char *s)
+_qcl_expr_string_alloc(_qcl_arena *a,
+                       _qcl_slice  s)
 {
         _qcl_expr_string *expr =
-                (_qcl_expr_string *)malloc(sizeof(_qcl_expr_string));
+                (_qcl_expr_string *)_qcl_arena_alloc(a, sizeof(_qcl_expr_string));
         expr->s = s;
         expr->base = (_qcl_expr) {
                 .kind = _QCL_EXPR_KIND_STRING,
@@ -782,10 +1192,11 @@ _qcl_expr_string_alloc(const char *s)
 }
 
 static _qcl_expr_identifier *
-_qcl_expr_identifier_alloc(const char *id)
+_qcl_expr_identifier_alloc(_qcl_arena *a,
+                           _qcl_slice  id)
 {
         _qcl_expr_identifier *e =
-                (_qcl_expr_identifier *)malloc(sizeof(_qcl_expr_identifier));
+                (_qcl_expr_identifier *)_qcl_arena_alloc(a, sizeof(_qcl_expr_identifier));
         e->id = id;
         e->base = (_qcl_expr) {
                 .kind = _QCL_EXPR_KIND_IDENTIFIER,
@@ -796,11 +1207,13 @@ _qcl_expr_identifier_alloc(const char *id)
 }
 
 static _qcl_expr_list *
-_qcl_expr_list_alloc(_qcl_expr_array ar)
+_qcl_expr_list_alloc(_qcl_arena      *a,
+                     _qcl_expr_array  ar)
 {
         _qcl_expr_list *e =
-                (_qcl_expr_list *)malloc(sizeof(_qcl_expr_list));
+                (_qcl_expr_list *)_qcl_arena_alloc(a, sizeof(_qcl_expr_list));
         e->exprs = ar;
+        _qcl_array_to_arena(a, e->exprs);
         e->base = (_qcl_expr) {
                 .kind = _QCL_EXPR_KIND_LIST,
                 .loc  = {0},
@@ -810,10 +1223,11 @@ _qcl_expr_list_alloc(_qcl_expr_array ar)
 }
 
 static _qcl_expr_bool *
-_qcl_expr_bool_alloc(int b)
+_qcl_expr_bool_alloc(_qcl_arena *a,
+                     int         b)
 {
         _qcl_expr_bool *e =
-                (_qcl_expr_bool *)malloc(sizeof(_qcl_expr_bool));
+                (_qcl_expr_bool *)_qcl_arena_alloc(a, sizeof(_qcl_expr_bool));
         e->b = b;
         e->base = (_qcl_expr) {
                 .kind = _QCL_EXPR_KIND_BOOL,
@@ -824,10 +1238,12 @@ _qcl_expr_bool_alloc(int b)
 }
 
 static _qcl_expr_unary *
-_qcl_expr_unary_alloc(const char *op, _qcl_expr *rhs)
+_qcl_expr_unary_alloc(_qcl_arena *a,
+                      const char *op,
+                      _qcl_expr  *rhs)
 {
         _qcl_expr_unary *e =
-                (_qcl_expr_unary *)malloc(sizeof(_qcl_expr_unary));
+                (_qcl_expr_unary *)_qcl_arena_alloc(a, sizeof(_qcl_expr_unary));
         e->rhs = rhs;
         e->op  = op;
         e->base = (_qcl_expr) {
@@ -839,12 +1255,13 @@ _qcl_expr_unary_alloc(const char *op, _qcl_expr *rhs)
 }
 
 static _qcl_expr_binary *
-_qcl_expr_binary_alloc(_qcl_expr  *lhs,
+_qcl_expr_binary_alloc(_qcl_arena *a,
+                       _qcl_expr  *lhs,
                        const char *op,
                        _qcl_expr  *rhs)
 {
         _qcl_expr_binary *e =
-                (_qcl_expr_binary *)malloc(sizeof(_qcl_expr_binary));
+                (_qcl_expr_binary *)_qcl_arena_alloc(a, sizeof(_qcl_expr_binary));
         e->lhs = lhs;
         e->op  = op;
         e->rhs = rhs;
@@ -865,6 +1282,7 @@ typedef enum {
         _QCL_STMT_KIND_EXPR,
         _QCL_STMT_KIND_IF,
         _QCL_STMT_KIND_BLOCK,
+        _QCL_STMT_KIND_INCLUDE,
 } _qcl_stmt_kind;
 
 typedef struct _qcl_stmt {
@@ -877,7 +1295,7 @@ QCL_ARRAY_TYPE(_qcl_stmt *, _qcl_stmt_array);
 
 typedef struct {
         _qcl_stmt    base;
-        const char  *id;
+        _qcl_slice   id; // into the source
         _qcl_expr   *expr;
 } _qcl_stmt_assignment;
 
@@ -898,12 +1316,21 @@ typedef struct {
         _qcl_stmt *else_; // can be NULL
 } _qcl_stmt_if;
 
+typedef struct {
+        _qcl_stmt  base;
+        _qcl_slice path; // into the source, as written
+        size_t     idx;  // index in the program's includes
+} _qcl_stmt_include;
+
+QCL_ARRAY_TYPE(_qcl_stmt_include *, _qcl_include_array);
+
 static _qcl_stmt_assignment *
-_qcl_stmt_assignment_alloc(const char *id,
+_qcl_stmt_assignment_alloc(_qcl_arena *a,
+                           _qcl_slice  id,
                            _qcl_expr  *expr)
 {
         _qcl_stmt_assignment *s =
-                (_qcl_stmt_assignment *)malloc(sizeof(_qcl_stmt_assignment));
+                (_qcl_stmt_assignment *)_qcl_arena_alloc(a, sizeof(_qcl_stmt_assignment));
         s->id   = id;
         s->expr = expr;
         s->base = (_qcl_stmt) {
@@ -915,12 +1342,13 @@ _qcl_stmt_assignment_alloc(const char *id,
 }
 
 static _qcl_stmt_if *
-_qcl_stmt_if_alloc(_qcl_expr *cond,
-                   _qcl_stmt *then,
-                   _qcl_stmt *else_)
+_qcl_stmt_if_alloc(_qcl_arena *a,
+                   _qcl_expr  *cond,
+                   _qcl_stmt  *then,
+                   _qcl_stmt  *else_)
 {
         _qcl_stmt_if *s =
-                (_qcl_stmt_if *)malloc(sizeof(_qcl_stmt_if));
+                (_qcl_stmt_if *)_qcl_arena_alloc(a, sizeof(_qcl_stmt_if));
         s->cond  = cond;
         s->then  = then;
         s->else_ = else_;
@@ -933,11 +1361,13 @@ _qcl_stmt_if_alloc(_qcl_expr *cond,
 }
 
 static _qcl_stmt_block *
-_qcl_stmt_block_alloc(_qcl_stmt_array stmts)
+_qcl_stmt_block_alloc(_qcl_arena      *a,
+                      _qcl_stmt_array  stmts)
 {
         _qcl_stmt_block *s =
-                (_qcl_stmt_block *)malloc(sizeof(_qcl_stmt_block));
+                (_qcl_stmt_block *)_qcl_arena_alloc(a, sizeof(_qcl_stmt_block));
         s->stmts  = stmts;
+        _qcl_array_to_arena(a, s->stmts);
         s->base = (_qcl_stmt) {
                 .kind = _QCL_STMT_KIND_BLOCK,
                 .loc  = {0},
@@ -946,16 +1376,42 @@ _qcl_stmt_block_alloc(_qcl_stmt_array stmts)
         return s;
 }
 
+static _qcl_stmt_include *
+_qcl_stmt_include_alloc(_qcl_arena *a,
+                        _qcl_slice  path,
+                        size_t      idx)
+{
+        _qcl_stmt_include *s =
+                (_qcl_stmt_include *)_qcl_arena_alloc(a, sizeof(_qcl_stmt_include));
+        s->path = path;
+        s->idx  = idx;
+        s->base = (_qcl_stmt) {
+                .kind = _QCL_STMT_KIND_INCLUDE,
+                .loc  = {0},
+        };
+        s->base.accept = _qcl_accept_stmt_include;
+        return s;
+}
+
 // #####################
 // # PARSING           #
 // #####################
 
 typedef struct {
-        _qcl_stmt_array stmts;
+        _qcl_stmt_array    stmts;
+        _qcl_include_array includes; // every include, in source order
 } _qcl_program;
 
+static void
+_qcl_program_free(_qcl_program *p)
+{
+        qcl_array_free(p->stmts);
+        qcl_array_free(p->includes);
+}
+
 typedef struct {
         _qcl_lexer   *l;
+        _qcl_arena   *a; // AST nodes, the lexer's tarena
         _qcl_program  p;
         _qcl_err      err;
 } _qcl_parser;
@@ -972,7 +1428,7 @@ _qcl_expect(_qcl_parser *parser,
         _qcl_token *it = _qcl_lexer_next(parser->l);
         if (!it || it->ty != ty) {
                 if (it)
-                        parser->err.loc = it->loc;
+                        parser->err.loc = _qcl_lexer_errloc(parser->l, _qcl_token_loc(parser->l, it));
                 parser->err.msg = "invalid syntax";
                 return NULL;
         }
@@ -1017,43 +1473,43 @@ _qcl_parse_primary_expr(_qcl_parser *parser)
 
                 switch (hd->ty) {
                 case _QCL_TT_IDENTIFIER: {
-                        expr = (_qcl_expr *)_qcl_expr_identifier_alloc(_qcl_lexer_next(parser->l)->lx);
-                        expr->loc = hd->loc;
+                        expr = (_qcl_expr *)_qcl_expr_identifier_alloc(parser->a, _qcl_token_slice(parser->l, _qcl_lexer_next(parser->l)));
+                        expr->loc = _qcl_token_loc(parser->l, hd);
                 } break;
                 case _QCL_TT_STRING: {
-                        expr = (_qcl_expr *)_qcl_expr_string_alloc(_qcl_lexer_next(parser->l)->lx);
-                        expr->loc = hd->loc;
+                        expr = (_qcl_expr *)_qcl_expr_string_alloc(parser->a, _qcl_token_slice(parser->l, _qcl_lexer_next(parser->l)));
+                        expr->loc = _qcl_token_loc(parser->l, hd);
                 } break;
                 case _QCL_TT_LSQR: {
                         (void)_qcl_lexer_next(parser->l);
                         _qcl_expr_array exprs = _qcl_parse_comma_sep_exprs(parser);
                         if (!exprs.data) {
                                 parser->err.msg = "invalid expression list";
-                                parser->err.loc = hd->loc;
+                                parser->err.loc = _qcl_lexer_errloc(parser->l, _qcl_token_loc(parser->l, hd));
                                 return NULL;
                         }
-                        expr = (_qcl_expr *)_qcl_expr_list_alloc(exprs);
-                        expr->loc = hd->loc;
+                        expr = (_qcl_expr *)_qcl_expr_list_alloc(parser->a, exprs);
+                        expr->loc = _qcl_token_loc(parser->l, hd);
                 } break;
                 case _QCL_TT_DOLLAR: {
                         (void)_qcl_lexer_next(parser->l); // $
                         _qcl_expr *rhs = _qcl_parse_expr(parser);
                         if (!rhs) return NULL;
-                        expr = (_qcl_expr *)_qcl_expr_env_alloc(rhs);
+                        expr = (_qcl_expr *)_qcl_expr_env_alloc(parser->a, rhs);
                 } break;
                 case _QCL_TT_COLON: {
                         (void)_qcl_lexer_next(parser->l); // :
                         return expr;
                 } break;
                 case _QCL_TT_KEYWORD: {
-                        if (!strcmp(hd->lx, QCL_KWD_TRUE)) {
+                        if (_qcl_token_is(parser->l, hd, QCL_KWD_TRUE)) {
                                 (void)_qcl_lexer_next(parser->l);
-                                expr = (_qcl_expr *)_qcl_expr_bool_alloc(1);
-                                expr->loc = hd->loc;
-                        } else if (!strcmp(hd->lx, QCL_KWD_FALSE)) {
+                                expr = (_qcl_expr *)_qcl_expr_bool_alloc(parser->a, 1);
+                                expr->loc = _qcl_token_loc(parser->l, hd);
+                        } else if (_qcl_token_is(parser->l, hd, QCL_KWD_FALSE)) {
                                 (void)_qcl_lexer_next(parser->l);
-                                expr = (_qcl_expr *)_qcl_expr_bool_alloc(0);
-                                expr->loc = hd->loc;
+                                expr = (_qcl_expr *)_qcl_expr_bool_alloc(parser->a, 0);
+                                expr->loc = _qcl_token_loc(parser->l, hd);
                         } else {
                                 return expr;
                         }
@@ -1075,12 +1531,12 @@ _qcl_parse_unary_expr(_qcl_parser *parser)
                 _qcl_expr  *rhs;
 
                 loc_tok = _qcl_lexer_next(parser->l);
-                op = loc_tok->lx;
+                op = "!";
                 if (!(rhs = (_qcl_expr *)_qcl_parse_unary_expr(parser))) {
                         return NULL;
                 }
-                ((_qcl_expr *)rhs)->loc = loc_tok->loc;
-                return (_qcl_expr *)_qcl_expr_unary_alloc(op, rhs);
+                ((_qcl_expr *)rhs)->loc = _qcl_token_loc(parser->l, loc_tok);
+                return (_qcl_expr *)_qcl_expr_unary_alloc(parser->a, op, rhs);
         }
         return _qcl_parse_primary_expr(parser);
 }
@@ -1094,16 +1550,15 @@ _qcl_parse_additive_expr(_qcl_parser *parser)
         if (!(lhs = _qcl_parse_unary_expr(parser))) return NULL;
         if (!(cur = _qcl_lexer_peek(parser->l, 0))) return NULL;
         while (cur && (cur->ty == _QCL_TT_PLUS)) {
-                _qcl_token       *loc_tok;
                 const char       *op;
                 _qcl_expr        *rhs;
                 _qcl_expr_binary *bin;
 
-                loc_tok = _qcl_lexer_next(parser->l);
-                op      = loc_tok->lx;
+                (void)_qcl_lexer_next(parser->l);
+                op = "+";
 
                 if (!(rhs = _qcl_parse_unary_expr(parser))) return NULL;
-                if (!(bin = _qcl_expr_binary_alloc(lhs, op, rhs))) return NULL;
+                if (!(bin = _qcl_expr_binary_alloc(parser->a, lhs, op, rhs))) return NULL;
 
                 ((_qcl_expr *)bin)->loc = lhs->loc;
                 lhs = (_qcl_expr *)bin;
@@ -1121,17 +1576,15 @@ _qcl_parse_expr(_qcl_parser *parser)
 static _qcl_stmt_assignment *
 _qcl_parse_stmt_assignment(_qcl_parser *parser)
 {
-        const char *id;
+        _qcl_token *id;
         _qcl_expr  *expr;
 
-        if (!(id = _qcl_expect(parser, _QCL_TT_IDENTIFIER)->lx)) {
-                return NULL;
-        }
+        if (!(id = _qcl_expect(parser, _QCL_TT_IDENTIFIER))) return NULL;
         if (!(_qcl_expect(parser, _QCL_TT_EQUALS))) return NULL;
         if (!(expr = _qcl_parse_expr(parser))) return NULL;
         if (!(_qcl_expect(parser, _QCL_TT_SEMICOLON))) return NULL;
 
-        return _qcl_stmt_assignment_alloc(id, expr);
+        return _qcl_stmt_assignment_alloc(parser->a, _qcl_token_slice(parser->l, id), expr);
 }
 
 static _qcl_stmt_if *
@@ -1154,8 +1607,8 @@ _qcl_parse_stmt_if(_qcl_parser *parser)
         t1 = _qcl_lexer_peek(parser->l, 0);
         t2 = _qcl_lexer_peek(parser->l, 1);
 
-        t1_else = t1 && t1->ty == _QCL_TT_KEYWORD && !strcmp(t1->lx, QCL_KWD_ELSE);
-        t2_if   = t2 && t2->ty == _QCL_TT_KEYWORD && !strcmp(t2->lx, QCL_KWD_IF);
+        t1_else = t1 && t1->ty == _QCL_TT_KEYWORD && _qcl_token_is(parser->l, t1, QCL_KWD_ELSE);
+        t2_if   = t2 && t2->ty == _QCL_TT_KEYWORD && _qcl_token_is(parser->l, t2, QCL_KWD_IF);
 
         if (t1_else && t2_if) {
                 (void)_qcl_lexer_next(parser->l); // else
@@ -1169,7 +1622,25 @@ _qcl_parse_stmt_if(_qcl_parser *parser)
                 }
         }
 
-        return _qcl_stmt_if_alloc(e, then, else_);
+        return _qcl_stmt_if_alloc(parser->a, e, then, else_);
+}
+
+// include 'path';
+static _qcl_stmt_include *
+_qcl_parse_stmt_include(_qcl_parser *parser)
+{
+        _qcl_token        *kw = _qcl_lexer_next(parser->l); // include
+        _qcl_token        *path;
+        _qcl_stmt_include *s;
+
+        if (!(path = _qcl_expect(parser, _QCL_TT_STRING)))  return NULL;
+        if (!(_qcl_expect(parser, _QCL_TT_SEMICOLON)))      return NULL;
+
+        s = _qcl_stmt_include_alloc(parser->a, _qcl_token_slice(parser->l, path), parser->p.includes.len);
+        s->base.loc = _qcl_token_loc(parser->l, kw);
+        qcl_array_append(parser->p.includes, s);
+
+        return s;
 }
 
 static _qcl_stmt *
@@ -1177,12 +1648,15 @@ _qcl_parse_stmt_keyword(_qcl_parser *parser)
 {
         _qcl_token *hd = _qcl_lexer_peek(parser->l, 0);
 
-        if (!strcmp(hd->lx, QCL_KWD_IF)) {
+        if (_qcl_token_is(parser->l, hd, QCL_KWD_IF)) {
                 return (_qcl_stmt *)_qcl_parse_stmt_if(parser);
         }
+        if (_qcl_token_is(parser->l, hd, QCL_KWD_INCLUDE)) {
+                return (_qcl_stmt *)_qcl_parse_stmt_include(parser);
+        }
 
         parser->err.msg = "invalid keyword placement";
-        parser->err.loc = hd->loc;
+        parser->err.loc = _qcl_lexer_errloc(parser->l, _qcl_token_loc(parser->l, hd));
 
         return NULL;
 }
@@ -1199,7 +1673,10 @@ _qcl_parse_stmt_block(_qcl_parser *parser)
 
         while (_QCL_SP(parser->l, 0)->ty != _QCL_TT_RCURLY) {
                 _qcl_stmt *s = _qcl_parse_stmt(parser);
-                if (!s) return NULL;
+                if (!s) {
+                        qcl_array_free(ar);
+                        return NULL;
+                }
                 qcl_array_append(ar, s);
         }
 
@@ -1208,7 +1685,7 @@ _qcl_parse_stmt_block(_qcl_parser *parser)
                 return NULL;
         }
 
-        return _qcl_stmt_block_alloc(ar);
+        return _qcl_stmt_block_alloc(parser->a, ar);
 }
 
 static _qcl_stmt *
@@ -1231,7 +1708,7 @@ _qcl_parse_stmt(_qcl_parser *parser)
         } else if (hd->ty == _QCL_TT_LCURLY) {
                 return (_qcl_stmt *)_qcl_parse_stmt_block(parser);
         } else {
-                parser->err.loc = hd->loc;
+                parser->err.loc = _qcl_lexer_errloc(parser->l, _qcl_token_loc(parser->l, hd));
                 parser->err.msg = "invalid statement";
                 return NULL;
         }
@@ -1242,14 +1719,16 @@ _qcl_create_program(_qcl_lexer *lexer)
 {
         _qcl_parser parser = (_qcl_parser) {
                 .l = lexer,
+                .a = &lexer->tarena,
                 .p = (_qcl_program) {
-                        .stmts = qcl_array_empty(_qcl_stmt_array),
+                        .stmts    = qcl_array_empty(_qcl_stmt_array),
+                        .includes = qcl_array_empty(_qcl_include_array),
                 },
                 .err = {0},
         };
 
         while (_QCL_SP(lexer, 0)->ty != _QCL_TT_EOF) {
-                if (lexer->hd->ty == _QCL_TT_SEMICOLON) {
+                if (_qcl_lexer_peek(lexer, 0)->ty == _QCL_TT_SEMICOLON) {
                         _qcl_lexer_next(lexer);
                         continue;
                 }
@@ -1275,6 +1754,7 @@ typedef void *(*_qcl_visit_expr_binary_sig)(_qcl_visitor *v, _qcl_expr_binary *s
 typedef void *(*_qcl_visit_stmt_assignment_sig)(_qcl_visitor *v, _qcl_stmt_assignment *s);
 typedef void *(*_qcl_visit_stmt_if_sig)(_qcl_visitor *v, _qcl_stmt_if *s);
 typedef void *(*_qcl_visit_stmt_block_sig)(_qcl_visitor *v, _qcl_stmt_block *s);
+typedef void *(*_qcl_visit_stmt_include_sig)(_qcl_visitor *v, _qcl_stmt_include *s);
 
 typedef struct _qcl_visitor {
         void *context;
@@ -1292,6 +1772,7 @@ typedef struct _qcl_visitor {
         _qcl_visit_stmt_assignment_sig visit_stmt_assignment;
         _qcl_visit_stmt_if_sig         visit_stmt_if;
         _qcl_visit_stmt_block_sig      visit_stmt_block;
+        _qcl_visit_stmt_include_sig    visit_stmt_include;
 } _qcl_visitor;
 
 static _qcl_visitor *
@@ -1305,9 +1786,10 @@ _qcl_visitor_alloc(void                           *context,
                    _qcl_visit_expr_binary_sig      visit_expr_binary,
                    _qcl_visit_stmt_assignment_sig  visit_stmt_assignment,
                    _qcl_visit_stmt_if_sig          visit_stmt_if,
-                   _qcl_visit_stmt_block_sig       visit_stmt_block)
+                   _qcl_visit_stmt_block_sig       visit_stmt_block,
+                   _qcl_visit_stmt_include_sig     visit_stmt_include)
 {
-        _qcl_visitor *v = (_qcl_visitor *)malloc(sizeof(_qcl_visitor));
+        _qcl_visitor *v = (_qcl_visitor *)QCL_MALLOC(sizeof(_qcl_visitor));
 
         v->context = context;
 
@@ -1322,6 +1804,7 @@ _qcl_visitor_alloc(void                           *context,
         v->visit_stmt_assignment = visit_stmt_assignment;
         v->visit_stmt_if         = visit_stmt_if;
         v->visit_stmt_block      = visit_stmt_block;
+        v->visit_stmt_include    = visit_stmt_include;
 
         return v;
 }
@@ -1422,6 +1905,16 @@ _qcl_accept_stmt_block(_qcl_stmt    *s,
         return NULL;
 }
 
+static void *
+_qcl_accept_stmt_include(_qcl_stmt    *s,
+                         _qcl_visitor *v)
+{
+        if (v->visit_stmt_include) {
+                return v->visit_stmt_include(v, (_qcl_stmt_include *)s);
+        }
+        return NULL;
+}
+
 // ######################
 // # INTERPRETER        #
 // ######################
@@ -1451,11 +1944,7 @@ typedef struct {
         int       b;
 } qcl_value_bool;
 
-static qcl_value_string *qcl_value_string_alloc(const char *s);
-static qcl_value_list   *qcl_value_list_alloc(qcl_value_array values);
-static qcl_value_bool   *qcl_value_bool_alloc(int b);
-
-static qcl_value_bool *
+static int
 _qcl_value_istruthy(const qcl_value *v)
 {
         int b = 0;
@@ -1470,32 +1959,39 @@ _qcl_value_istruthy(const qcl_value *v)
                 assert(0 && "unimplemented");
         }
 
-        return qcl_value_bool_alloc(b);
+        return b;
 }
 
-static qcl_value *
-_qcl_value_copy(const qcl_value *v)
+// Values created by the interpreter live in its arena and are released
+// together by qcl_config_destroy(). They are never modified once
+// created, so a value can be referenced from any number of variables
+// and lists. The qcl_value_*_alloc() functions below are for callers
+// of qcl_add_value() and are owned by them.
+
+static qcl_value_string *
+_qcl_value_string_new(_qcl_arena *a,
+                      const char *s)
 {
-        if (v->kind == QCL_VALUE_KIND_STRING) {
-                return (qcl_value *)qcl_value_string_alloc(((qcl_value_string *)v)->s);
-        } else if (v->kind == QCL_VALUE_KIND_LIST) {
-                qcl_value_array ar = qcl_array_empty(qcl_value_array);
-                qcl_value_list *lst = (qcl_value_list *)v;
-                for (size_t i = 0; i < lst->values.len; ++i) {
-                        qcl_array_append(ar, _qcl_value_copy(lst->values.data[i]));
-                }
-                return (qcl_value *)qcl_value_list_alloc(ar);
-        } else if (v->kind == QCL_VALUE_KIND_BOOL) {
-                return (qcl_value *)qcl_value_bool_alloc(((qcl_value_bool *)v)->b);
-        } else {
-                assert(0 && "unimplemented");
-        }
+        qcl_value_string *v = (qcl_value_string *)_qcl_arena_alloc(a, sizeof(qcl_value_string));
+        v->s                = s;
+        v->base.kind        = QCL_VALUE_KIND_STRING;
+        return v;
+}
+
+static qcl_value_bool *
+_qcl_value_bool_new(_qcl_arena *a,
+                    int         b)
+{
+        qcl_value_bool *v = (qcl_value_bool *)_qcl_arena_alloc(a, sizeof(qcl_value_bool));
+        v->b              = b;
+        v->base.kind      = QCL_VALUE_KIND_BOOL;
+        return v;
 }
 
 static qcl_value_string *
 qcl_value_string_alloc(const char *s)
 {
-        qcl_value_string *v = (qcl_value_string *)malloc(sizeof(qcl_value_string));
+        qcl_value_string *v = (qcl_value_string *)QCL_MALLOC(sizeof(qcl_value_string));
         v->s                = s;
         v->base.kind        = QCL_VALUE_KIND_STRING;
         return v;
@@ -1504,7 +2000,7 @@ qcl_value_string_alloc(const char *s)
 static qcl_value_list *
 qcl_value_list_alloc(qcl_value_array values)
 {
-        qcl_value_list *v = (qcl_value_list *)malloc(sizeof(qcl_value_list));
+        qcl_value_list *v = (qcl_value_list *)QCL_MALLOC(sizeof(qcl_value_list));
         v->values         = values;
         v->base.kind      = QCL_VALUE_KIND_LIST;
         return v;
@@ -1513,7 +2009,7 @@ qcl_value_list_alloc(qcl_value_array values)
 static qcl_value_bool *
 qcl_value_bool_alloc(int b)
 {
-        qcl_value_bool *v = (qcl_value_bool *)malloc(sizeof(qcl_value_bool));
+        qcl_value_bool *v = (qcl_value_bool *)QCL_MALLOC(sizeof(qcl_value_bool));
         v->b              = b;
         v->base.kind      = QCL_VALUE_KIND_BOOL;
         return v;
@@ -1524,7 +2020,7 @@ QCL_MAP_TYPE(const char *, qcl_value *, symtbl);
 static unsigned
 symtbl_hash(const char **sym)
 {
-        return **sym;
+        return _qcl_strhash(*sym);
 }
 
 static int
@@ -1535,306 +2031,2346 @@ symtbl_cmp(const char **sym0,
 }
 
 typedef struct {
-        symtbl tbl;
+        symtbl     tbl;
+        _qcl_arena arena; // keys and values in `tbl`
 } _qcl_interpret_context;
 
-static void *
-_qcl_interpret_visit_stmt_assignment(_qcl_visitor         *v,
-                                     _qcl_stmt_assignment *s)
+QCL_MAP_TYPE(_qcl_slice, size_t, _qcl_idmap);
+
+static unsigned
+_qcl_idmap_hash(_qcl_slice *s)
 {
-        _qcl_interpret_context *ctx = (_qcl_interpret_context *)v->context;
-        qcl_value *value = (qcl_value *)s->expr->accept(s->expr, v);
-        symtbl_insert(&ctx->tbl, s->id, value);
-        return NULL;
+        return _qcl_strnhash(s->s, s->n);
 }
 
-static void *
-_qcl_interpret_visit_stmt_if(_qcl_visitor *v,
-                             _qcl_stmt_if *s)
+static int
+_qcl_idmap_cmp(_qcl_slice *s0, _qcl_slice *s1)
 {
-        qcl_value *e = s->cond->accept(s->cond, v);
-        qcl_value_bool *b = _qcl_value_istruthy(e);
+        return s0->n != s1->n || memcmp(s0->s, s1->s, s0->n);
+}
 
-        if (b->b) {
-                s->then->accept(s->then, v);
-        } else if (s->else_) {
-                s->else_->accept(s->else_, v);
-        }
+// ######################
+// # BYTECODE           #
+// ######################
 
-        return NULL;
+/**
+ * The program is compiled to a linear list of 32 bit instructions for
+ * a stack machine. The low 8 bits hold the opcode and the high 24 bits
+ * its argument. String constants are interned, and variables are
+ * resolved to slots at compile time, so the VM neither hashes nor
+ * allocates except for the values it creates (lists, `+` and `$`).
+ *
+ * Expressions that only involve constants are folded while compiling:
+ * each child that is a constant has emitted exactly one CONST, so a
+ * parent whose children are all constant drops those and emits a
+ * single CONST for its own value instead. An `if` on a constant only
+ * compiles the branch that is taken.
+ *
+ * Every file is compiled on its own, with slots numbered per file. An
+ * `include` becomes an INCLUDE of the included file's index among the
+ * includes of the file; both are linked to the other files of a config
+ * when it is loaded, see _qcl_linked_unit.
+ */
+
+typedef enum {
+        _QCL_OP_CONST = 0,  // push consts[arg]
+        _QCL_OP_LOAD,       // push vars[arg]
+        _QCL_OP_STORE,      // pop into vars[arg]
+        _QCL_OP_LIST,       // pop arg values, push them as a list
+        _QCL_OP_ENV,        // pop a string, push its environment variable
+        _QCL_OP_NOT,        // pop a value, push whether it is falsy
+        _QCL_OP_ADD,        // pop rhs and lhs, push lhs + rhs
+        _QCL_OP_JMP,        // jump to arg
+        _QCL_OP_JMP_FALSE,  // pop a value, jump to arg if it is falsy
+        _QCL_OP_INCLUDE,    // run the file of include arg
+        _QCL_OP_HALT,
+} _qcl_op;
+
+#define _QCL_OP_ARG_MAX ((1u << 24) - 1)
+#define _QCL_INSTR(op, arg) ((uint32_t)(op) | (uint32_t)(arg) << 8)
+#define _QCL_INSTR_OP(ins) ((_qcl_op)((ins) & 0xff))
+#define _QCL_INSTR_ARG(ins) ((ins) >> 8)
+
+// Constants 0 and 1 are always `false` and `true`.
+#define _QCL_CONST_FALSE 0
+#define _QCL_CONST_TRUE  1
+
+QCL_ARRAY_TYPE(uint32_t, _qcl_code);
+
+typedef struct {
+        _qcl_code       code;
+        qcl_value_array consts;
+        qcl_str_array   names;     // variable slot -> identifier
+        size_t          max_stack;
+} _qcl_bytecode;
+
+typedef struct {
+        _qcl_arena    *arena;   // constants and names, outlive the bytecode
+        _qcl_bytecode  bc;
+        _qcl_idmap     strs;    // string constant -> index in consts
+        _qcl_idmap     slots;   // identifier -> index in names
+        size_t         depth;   // stack depth at this point
+} _qcl_compiler;
+
+static void
+_qcl_compiler_emit(_qcl_compiler *c,
+                   _qcl_op        op,
+                   size_t         arg,
+                   long           effect)
+{
+        if (arg > _QCL_OP_ARG_MAX) {
+                fprintf(stderr, "FATAL: qcl: config is too large to compile\n");
+                exit(1);
+        }
+
+        qcl_array_append(c->bc.code, _QCL_INSTR(op, arg));
+
+        c->depth += effect;
+        if (c->depth > c->bc.max_stack) c->bc.max_stack = c->depth;
 }
 
-static void *
-_qcl_interpret_visit_stmt_block(_qcl_visitor    *v,
-                                _qcl_stmt_block *s)
+static void
+_qcl_compiler_patch(_qcl_compiler *c,
+                    size_t         at,
+                    size_t         target)
 {
-        for (size_t i = 0; i < s->stmts.len; ++i) {
-                s->stmts.data[i]->accept(s->stmts.data[i], v);
+        if (target > _QCL_OP_ARG_MAX) {
+                fprintf(stderr, "FATAL: qcl: config is too large to compile\n");
+                exit(1);
         }
-        return NULL;
+        c->bc.code.data[at] = _QCL_INSTR(_QCL_INSTR_OP(c->bc.code.data[at]), target);
 }
 
-static void *
-_qcl_interpret_visit_expr_string(_qcl_visitor     *v,
-                                 _qcl_expr_string *e)
+static size_t
+_qcl_compiler_const(_qcl_compiler *c,
+                    qcl_value     *v)
 {
-        (void)v;
-        return qcl_value_string_alloc(e->s);
+        qcl_array_append(c->bc.consts, v);
+        return c->bc.consts.len-1;
 }
 
-static void *
-_qcl_interpret_visit_expr_identifier(_qcl_visitor         *v,
-                                     _qcl_expr_identifier *e)
+// Interns `s`. This is where string literals are copied out of the
+// source, once each.
+static size_t
+_qcl_compiler_const_string(_qcl_compiler *c,
+                           _qcl_slice     s)
 {
-        _qcl_interpret_context *ctx = (_qcl_interpret_context *)v->context;
+        int               added;
+        _qcl_idmap_slot *it = _qcl_idmap_emplace(&c->strs, s, &added);
+        if (!added) return it->v;
+
+        qcl_value_string *v = _qcl_value_string_new(c->arena, _qcl_arena_strndup(c->arena, s.s, s.n));
+        it->k.s = v->s;
+        it->v   = _qcl_compiler_const(c, (qcl_value *)v);
+        return it->v;
+}
 
-        if (!symtbl_contains(&ctx->tbl, e->id)) {
-                // TODO: set error flag
-                fprintf(stderr, "variable %s is not declared\n", e->id);
-                exit(1);
+static size_t
+_qcl_compiler_slot(_qcl_compiler *c,
+                   _qcl_slice     id)
+{
+        int               added;
+        _qcl_idmap_slot *it = _qcl_idmap_emplace(&c->slots, id, &added);
+        if (!added) return it->v;
+
+        it->k.s = _qcl_arena_strndup(c->arena, id.s, id.n);
+        it->v   = c->bc.names.len;
+        qcl_array_append(c->bc.names, (char *)it->k.s);
+        return it->v;
+}
+
+// Replace the last `n` instructions, which are all CONST, with a CONST
+// of `v`.
+static qcl_value *
+_qcl_compiler_fold(_qcl_compiler *c,
+                   size_t         n,
+                   size_t         idx)
+{
+        c->bc.code.len -= n;
+        c->depth       -= n;
+        _qcl_compiler_emit(c, _QCL_OP_CONST, idx, 1);
+        return c->bc.consts.data[idx];
+}
+
+static qcl_value *
+_qcl_value_add(_qcl_arena      *a,
+               const qcl_value *lhs,
+               const qcl_value *rhs)
+{
+        if (lhs->kind == QCL_VALUE_KIND_STRING
+            && rhs->kind == QCL_VALUE_KIND_STRING) {
+                const char *l   = ((qcl_value_string *)lhs)->s;
+                const char *r   = ((qcl_value_string *)rhs)->s;
+                size_t      l_n = strlen(l);
+                size_t      r_n = strlen(r);
+
+                char *buf = (char *)_qcl_arena_alloc(a, l_n + r_n + 1);
+                memcpy(buf, l, l_n);
+                memcpy(buf + l_n, r, r_n);
+                buf[l_n + r_n] = 0;
+
+                return (qcl_value *)_qcl_value_string_new(a, buf);
+        } else if (lhs->kind == QCL_VALUE_KIND_LIST
+                   && rhs->kind == QCL_VALUE_KIND_LIST) {
+                // The elements are shared, only the spine is new.
+                const qcl_value_list *l   = (const qcl_value_list *)lhs;
+                const qcl_value_list *r   = (const qcl_value_list *)rhs;
+                size_t                n   = l->values.len + r->values.len;
+                qcl_value_list       *lst = (qcl_value_list *)_qcl_arena_alloc(a, sizeof(qcl_value_list));
+
+                lst->base.kind   = QCL_VALUE_KIND_LIST;
+                lst->values.data = (qcl_value **)_qcl_arena_alloc(a, sizeof(qcl_value *) * (n ? n : 1));
+                lst->values.len  = n;
+                lst->values.cap  = n;
+                memcpy(lst->values.data, l->values.data, sizeof(qcl_value *) * l->values.len);
+                memcpy(lst->values.data + l->values.len, r->values.data,
+                       sizeof(qcl_value *) * r->values.len);
+
+                return (qcl_value *)lst;
+        } else {
+                // Values of different kinds cannot be added.
+                return NULL;
         }
+}
+
+// A list of `n` values copied from `values`, or left for the caller
+// to fill in if it is NULL.
+static qcl_value *
+_qcl_value_list_from(_qcl_arena       *a,
+                     qcl_value *const *values,
+                     size_t            n)
+{
+        qcl_value_list *lst = (qcl_value_list *)_qcl_arena_alloc(a, sizeof(qcl_value_list));
+
+        lst->base.kind   = QCL_VALUE_KIND_LIST;
+        lst->values.data = (qcl_value **)_qcl_arena_alloc(a, sizeof(qcl_value *) * (n ? n : 1));
+        lst->values.len  = n;
+        lst->values.cap  = n;
+        if (values && n) memcpy(lst->values.data, values, sizeof(qcl_value *) * n);
+
+        return (qcl_value *)lst;
+}
+
+// The compile visitors of expressions return the value of the
+// expression if it is a constant, or NULL. Statements return NULL.
 
-        qcl_value *value = _qcl_value_copy(*(qcl_value **)symtbl_get(&ctx->tbl, e->id));
-        assert(value);
+static void *
+_qcl_compile_visit_expr_string(_qcl_visitor     *v,
+                               _qcl_expr_string *e)
+{
+        _qcl_compiler *c = (_qcl_compiler *)v->context;
+        size_t         i = _qcl_compiler_const_string(c, e->s);
+        _qcl_compiler_emit(c, _QCL_OP_CONST, i, 1);
+        return c->bc.consts.data[i];
+}
 
-        return value;
+static void *
+_qcl_compile_visit_expr_identifier(_qcl_visitor         *v,
+                                   _qcl_expr_identifier *e)
+{
+        _qcl_compiler *c = (_qcl_compiler *)v->context;
+        _qcl_compiler_emit(c, _QCL_OP_LOAD, _qcl_compiler_slot(c, e->id), 1);
+        return NULL;
 }
 
 static void *
-_qcl_interpret_visit_expr_list(_qcl_visitor   *v,
-                               _qcl_expr_list *e)
+_qcl_compile_visit_expr_list(_qcl_visitor   *v,
+                             _qcl_expr_list *e)
 {
-        qcl_value_array values = qcl_array_empty(qcl_value_array);
+        _qcl_compiler *c        = (_qcl_compiler *)v->context;
+        int            constant = 1;
 
         for (size_t i = 0; i < e->exprs.len; ++i) {
-                qcl_array_append(values, e->exprs.data[i]->accept(e->exprs.data[i], v));
+                constant &= e->exprs.data[i]->accept(e->exprs.data[i], v) != NULL;
         }
 
-        return qcl_value_list_alloc(values);
+        if (constant) {
+                // The CONST arguments are the elements, in order.
+                qcl_value_list *lst = (qcl_value_list *)_qcl_value_list_from(c->arena, NULL, e->exprs.len);
+                const uint32_t *ins = c->bc.code.data + c->bc.code.len - e->exprs.len;
+                for (size_t i = 0; i < e->exprs.len; ++i) {
+                        lst->values.data[i] = c->bc.consts.data[_QCL_INSTR_ARG(ins[i])];
+                }
+                return _qcl_compiler_fold(c, e->exprs.len, _qcl_compiler_const(c, (qcl_value *)lst));
+        }
+
+        _qcl_compiler_emit(c, _QCL_OP_LIST, e->exprs.len, 1 - (long)e->exprs.len);
+        return NULL;
 }
 
 static void *
-_qcl_interpret_visit_expr_bool(_qcl_visitor   *v,
-                               _qcl_expr_bool *e)
+_qcl_compile_visit_expr_bool(_qcl_visitor   *v,
+                             _qcl_expr_bool *e)
 {
-        (void)v;
-        return qcl_value_bool_alloc(e->b);
+        _qcl_compiler *c = (_qcl_compiler *)v->context;
+        size_t         i = e->b ? _QCL_CONST_TRUE : _QCL_CONST_FALSE;
+        _qcl_compiler_emit(c, _QCL_OP_CONST, i, 1);
+        return c->bc.consts.data[i];
 }
 
 static void *
-_qcl_interpret_visit_expr_env(_qcl_visitor   *v,
-                              _qcl_expr_env *e)
+_qcl_compile_visit_expr_env(_qcl_visitor  *v,
+                            _qcl_expr_env *e)
 {
-        qcl_value *var = e->rhs->accept(e->rhs, v);
-        assert(var->kind == QCL_VALUE_KIND_STRING);
-        char *env = getenv(((qcl_value_string *)var)->s);
-        if (env) return qcl_value_string_alloc(strdup(env));
-        return qcl_value_string_alloc("");
+        _qcl_compiler *c = (_qcl_compiler *)v->context;
+        (void)e->rhs->accept(e->rhs, v);
+        _qcl_compiler_emit(c, _QCL_OP_ENV, 0, 0);
+        return NULL;
 }
 
 static void *
-_qcl_interpret_visit_expr_unary(_qcl_visitor    *v,
-                                _qcl_expr_unary *e)
+_qcl_compile_visit_expr_unary(_qcl_visitor    *v,
+                              _qcl_expr_unary *e)
 {
+        _qcl_compiler *c = (_qcl_compiler *)v->context;
         assert(!strcmp(e->op, "!"));
+
         qcl_value *rhs = e->rhs->accept(e->rhs, v);
-        qcl_value_bool *tru = _qcl_value_istruthy(rhs);
-        tru->b = !tru->b;
-        return tru;
+        if (rhs) {
+                return _qcl_compiler_fold(c, 1, _qcl_value_istruthy(rhs)
+                                          ? _QCL_CONST_FALSE : _QCL_CONST_TRUE);
+        }
+
+        _qcl_compiler_emit(c, _QCL_OP_NOT, 0, 0);
+        return NULL;
 }
 
 static void *
-_qcl_interpret_visit_expr_binary(_qcl_visitor     *v,
-                                 _qcl_expr_binary *e)
+_qcl_compile_visit_expr_binary(_qcl_visitor     *v,
+                               _qcl_expr_binary *e)
 {
+        _qcl_compiler *c = (_qcl_compiler *)v->context;
         assert(!strcmp(e->op, "+"));
 
         qcl_value *lhs = e->lhs->accept(e->lhs, v);
         qcl_value *rhs = e->rhs->accept(e->rhs, v);
 
-        if (lhs->kind == QCL_VALUE_KIND_STRING
-            && rhs->kind == QCL_VALUE_KIND_STRING) {
-                qcl_value_string *lhs_str = (qcl_value_string *)lhs;
-                qcl_value_string *rhs_str = (qcl_value_string *)rhs;
-                size_t            lhs_n   = strlen(lhs_str->s);
-                size_t            rhs_n   = strlen(rhs_str->s);
+        qcl_value *sum;
+        if (lhs && rhs && (sum = _qcl_value_add(c->arena, lhs, rhs))) {
+                size_t idx;
+                if (sum->kind == QCL_VALUE_KIND_STRING) {
+                        const char *str = ((qcl_value_string *)sum)->s;
+                        idx = _qcl_compiler_const_string(c, (_qcl_slice) { str, strlen(str) });
+                } else {
+                        idx = _qcl_compiler_const(c, sum);
+                }
+                return _qcl_compiler_fold(c, 2, idx);
+        }
+
+        _qcl_compiler_emit(c, _QCL_OP_ADD, 0, -1);
+        return NULL;
+}
+
+static void *
+_qcl_compile_visit_stmt_assignment(_qcl_visitor         *v,
+                                   _qcl_stmt_assignment *s)
+{
+        _qcl_compiler *c = (_qcl_compiler *)v->context;
+        (void)s->expr->accept(s->expr, v);
+        _qcl_compiler_emit(c, _QCL_OP_STORE, _qcl_compiler_slot(c, s->id), -1);
+        return NULL;
+}
+
+static void *
+_qcl_compile_visit_stmt_if(_qcl_visitor *v,
+                           _qcl_stmt_if *s)
+{
+        _qcl_compiler *c    = (_qcl_compiler *)v->context;
+        qcl_value     *cond = s->cond->accept(s->cond, v);
+
+        if (cond) {
+                c->bc.code.len -= 1;
+                c->depth       -= 1;
+                if (_qcl_value_istruthy(cond)) s->then->accept(s->then, v);
+                else if (s->else_)             s->else_->accept(s->else_, v);
+                return NULL;
+        }
 
-                char *buf = (char *)malloc(lhs_n + rhs_n + 1);
-                strcpy(buf, lhs_str->s);
-                strcat(buf, rhs_str->s);
-                buf[lhs_n + rhs_n] = 0;
+        size_t jmp_else = c->bc.code.len;
+        _qcl_compiler_emit(c, _QCL_OP_JMP_FALSE, 0, -1);
+        s->then->accept(s->then, v);
 
-                return qcl_value_string_alloc(buf);
+        if (!s->else_) {
+                _qcl_compiler_patch(c, jmp_else, c->bc.code.len);
+                return NULL;
         }
-        else if (e->lhs->type->kind == QCL_VALUE_KIND_LIST
-            && e->rhs->type->kind == QCL_VALUE_KIND_LIST) {
-                assert(0);
-        } else {
-                // TODO: type check error
-                assert(0 && "wrong types unimplemented");
+
+        size_t jmp_end = c->bc.code.len;
+        _qcl_compiler_emit(c, _QCL_OP_JMP, 0, 0);
+        _qcl_compiler_patch(c, jmp_else, c->bc.code.len);
+        s->else_->accept(s->else_, v);
+        _qcl_compiler_patch(c, jmp_end, c->bc.code.len);
+
+        return NULL;
+}
+
+static void *
+_qcl_compile_visit_stmt_block(_qcl_visitor    *v,
+                              _qcl_stmt_block *s)
+{
+        for (size_t i = 0; i < s->stmts.len; ++i) {
+                s->stmts.data[i]->accept(s->stmts.data[i], v);
         }
+        return NULL;
+}
+
+static void *
+_qcl_compile_visit_stmt_include(_qcl_visitor      *v,
+                                _qcl_stmt_include *s)
+{
+        _qcl_compiler *c = (_qcl_compiler *)v->context;
+        _qcl_compiler_emit(c, _QCL_OP_INCLUDE, s->idx, 0);
+        return NULL;
 }
 
 static _qcl_visitor *
-_interpreter_visitor_alloc(_qcl_interpret_context *ctx)
-{
-        return _qcl_visitor_alloc((void *)ctx,
-                                  _qcl_interpret_visit_expr_string,
-                                  _qcl_interpret_visit_expr_identifier,
-                                  _qcl_interpret_visit_expr_list,
-                                  _qcl_interpret_visit_expr_bool,
-                                  _qcl_interpret_visit_expr_env,
-                                  _qcl_interpret_visit_expr_unary,
-                                  _qcl_interpret_visit_expr_binary,
-                                  _qcl_interpret_visit_stmt_assignment,
-                                  _qcl_interpret_visit_stmt_if,
-                                  _qcl_interpret_visit_stmt_block);
-}
-
-static _qcl_interpret_context
-_qcl_interpret(_qcl_program *p)
-{
-        _qcl_interpret_context ctx = (_qcl_interpret_context) {
-                .tbl = symtbl_create(symtbl_hash, symtbl_cmp),
+_compiler_visitor_alloc(_qcl_compiler *c)
+{
+        return _qcl_visitor_alloc((void *)c,
+                                  _qcl_compile_visit_expr_string,
+                                  _qcl_compile_visit_expr_identifier,
+                                  _qcl_compile_visit_expr_list,
+                                  _qcl_compile_visit_expr_bool,
+                                  _qcl_compile_visit_expr_env,
+                                  _qcl_compile_visit_expr_unary,
+                                  _qcl_compile_visit_expr_binary,
+                                  _qcl_compile_visit_stmt_assignment,
+                                  _qcl_compile_visit_stmt_if,
+                                  _qcl_compile_visit_stmt_block,
+                                  _qcl_compile_visit_stmt_include);
+}
+
+// Constants and names are allocated from `arena`, which must outlive
+// anything that is produced by running the bytecode.
+static _qcl_bytecode
+_qcl_compile(_qcl_program *p,
+             _qcl_arena   *arena)
+{
+        _qcl_compiler c = (_qcl_compiler) {
+                .arena = arena,
+                .bc    = (_qcl_bytecode) {
+                        .code      = qcl_array_empty(_qcl_code),
+                        .consts    = qcl_array_empty(qcl_value_array),
+                        .names     = qcl_array_empty(qcl_str_array),
+                        .max_stack = 0,
+                },
+                .strs  = _qcl_idmap_create(_qcl_idmap_hash, _qcl_idmap_cmp),
+                .slots = _qcl_idmap_create(_qcl_idmap_hash, _qcl_idmap_cmp),
+                .depth = 0,
         };
 
-        _qcl_visitor *v = _interpreter_visitor_alloc(&ctx);
+        // Most configs are a flat list of assignments.
+        _qcl_idmap_reserve(&c.strs, p->stmts.len);
+        _qcl_idmap_reserve(&c.slots, p->stmts.len);
+
+        (void)_qcl_compiler_const(&c, (qcl_value *)_qcl_value_bool_new(arena, 0));
+        (void)_qcl_compiler_const(&c, (qcl_value *)_qcl_value_bool_new(arena, 1));
+
+        _qcl_visitor *v = _compiler_visitor_alloc(&c);
 
         for (size_t i = 0; i < p->stmts.len; ++i) {
                 p->stmts.data[i]->accept(p->stmts.data[i], v);
         }
+        _qcl_compiler_emit(&c, _QCL_OP_HALT, 0, 0);
+
+        QCL_FREE(v);
+        _qcl_idmap_destroy(&c.strs);
+        _qcl_idmap_destroy(&c.slots);
 
-        return ctx;
+        return c.bc;
 }
 
-typedef struct {
-        _qcl_interpret_context interpreter;
-        _qcl_err err;
-} qcl_config;
+static void
+_qcl_bytecode_free(_qcl_bytecode *bc)
+{
+        qcl_array_free(bc->code);
+        qcl_array_free(bc->consts);
+        qcl_array_free(bc->names);
+}
 
-static qcl_config
-qcl_parse_file(const char *fp)
+static const char *
+_qcl_value_kind_name(qcl_value_kind kind)
 {
-        char         *src;
-        _qcl_lexer    lexer;
-        _qcl_parser   parser;
-        qcl_config    config;
+        switch (kind) {
+        case QCL_VALUE_KIND_STRING: return "string";
+        case QCL_VALUE_KIND_LIST:   return "list";
+        case QCL_VALUE_KIND_BOOL:   return "bool";
+        }
+        return "value";
+}
 
-        config = (qcl_config) {
-                .interpreter = {0},
-                .err = (_qcl_err) {
-                        .msg = NULL,
-                        .loc = (_qcl_loc) {0},
-                },
-        };
+// The message and the file name of `loc` are copied to `arena`, so they
+// live as long as the config. Only the first error is kept.
+static void
+_qcl_seterr(_qcl_err   *err,
+            _qcl_arena *arena,
+            _qcl_loc    loc,
+            const char *fmt,
+            ...)
+{
+        va_list ap;
+        char    buf[256];
 
-        if (!(src = _qcl_load_file(fp))) {
-                config.err.loc = (_qcl_loc) {0};
-                config.err.msg = "failed to load file";
-                return config;
+        if (err->msg) return;
+
+        va_start(ap, fmt);
+        vsnprintf(buf, sizeof(buf), fmt, ap);
+        va_end(ap);
+
+        err->msg    = _qcl_arena_strdup(arena, buf);
+        err->loc    = loc;
+        err->loc.fp = loc.fp ? _qcl_arena_strdup(arena, loc.fp) : NULL;
+}
+
+/**
+ * The compiled files of a config, linked for running. Each file keeps
+ * its own bytecode; `slots` maps its variable slots to the variables
+ * shared by all files and `incs` maps its includes to other files of
+ * the link.
+ */
+typedef struct {
+        const _qcl_bytecode *bc;
+        const size_t        *slots;
+        const size_t        *incs; // NULL if the file cannot include
+        const char          *fp;   // for errors, can be NULL
+} _qcl_linked_unit;
+
+// Run file `u` of `units`. Statements leave the stack as they found
+// it, so an included file starts on an empty stack at `stack`. Returns
+// 0 if the program has to stop.
+static int
+_qcl_exec(const _qcl_linked_unit *units,
+          size_t                  u,
+          qcl_value             **vars,
+          qcl_value             **stack,
+          _qcl_arena             *arena,
+          _qcl_err               *err)
+{
+        const _qcl_bytecode *bc    = units[u].bc;
+        const size_t        *slots = units[u].slots;
+        _qcl_loc             loc   = { .fp = units[u].fp };
+        qcl_value          **sp    = stack;
+        qcl_value    *const *k     = bc->consts.data;
+        const uint32_t      *ip    = bc->code.data;
+
+        for (;;) {
+                uint32_t ins = *ip++;
+
+                switch (_QCL_INSTR_OP(ins)) {
+                case _QCL_OP_CONST:
+                        *sp++ = k[_QCL_INSTR_ARG(ins)];
+                        break;
+                case _QCL_OP_LOAD: {
+                        qcl_value *value = vars[slots[_QCL_INSTR_ARG(ins)]];
+                        if (!value) {
+                                _qcl_seterr(err, arena, loc, "variable %s is not declared",
+                                            bc->names.data[_QCL_INSTR_ARG(ins)]);
+                                return 0;
+                        }
+                        *sp++ = value;
+                } break;
+                case _QCL_OP_STORE:
+                        vars[slots[_QCL_INSTR_ARG(ins)]] = *--sp;
+                        break;
+                case _QCL_OP_LIST: {
+                        size_t n = _QCL_INSTR_ARG(ins);
+                        sp -= n;
+                        *sp = _qcl_value_list_from(arena, sp, n);
+                        ++sp;
+                } break;
+                case _QCL_OP_ENV: {
+                        qcl_value *var = sp[-1];
+                        assert(var->kind == QCL_VALUE_KIND_STRING);
+                        char *env = getenv(((qcl_value_string *)var)->s);
+                        sp[-1] = (qcl_value *)_qcl_value_string_new(arena, env ? _qcl_arena_strdup(arena, env) : "");
+                } break;
+                case _QCL_OP_NOT:
+                        sp[-1] = k[_qcl_value_istruthy(sp[-1]) ? _QCL_CONST_FALSE : _QCL_CONST_TRUE];
+                        break;
+                case _QCL_OP_ADD: {
+                        --sp;
+                        qcl_value *sum = _qcl_value_add(arena, sp[-1], sp[0]);
+                        if (!sum) {
+                                _qcl_seterr(err, arena, loc, "cannot add a %s and a %s",
+                                            _qcl_value_kind_name(sp[-1]->kind),
+                                            _qcl_value_kind_name(sp[0]->kind));
+                                return 0;
+                        }
+                        sp[-1] = sum;
+                } break;
+                case _QCL_OP_JMP:
+                        ip = bc->code.data + _QCL_INSTR_ARG(ins);
+                        break;
+                case _QCL_OP_JMP_FALSE:
+                        if (!_qcl_value_istruthy(*--sp)) ip = bc->code.data + _QCL_INSTR_ARG(ins);
+                        break;
+                case _QCL_OP_INCLUDE:
+                        if (!units[u].incs) {
+                                _qcl_seterr(err, arena, loc, "include is not supported here");
+                                return 0;
+                        }
+                        if (!_qcl_exec(units, units[u].incs[_QCL_INSTR_ARG(ins)], vars, sp, arena, err)) {
+                                return 0;
+                        }
+                        break;
+                case _QCL_OP_HALT:
+                        return 1;
+                }
         }
+}
 
-        if ((lexer = _qcl_lex_file(fp, src)).err.msg) {
-                config.err = lexer.err;
-                return config;
+// Runs file 0 of `units` and stores every variable that was assigned
+// in a new symbol table. `names` are the `nvars` shared variables.
+// Values are allocated from `arena`. On a runtime error the program
+// stops and `err` is set.
+static symtbl
+_qcl_run_linked(const _qcl_linked_unit *units,
+                size_t                  nunits,
+                char *const            *names,
+                size_t                  nvars,
+                _qcl_arena             *arena,
+                _qcl_err               *err)
+{
+        size_t max_stack = 0;
+        for (size_t i = 0; i < nunits; ++i) {
+                if (units[i].bc->max_stack > max_stack) max_stack = units[i].bc->max_stack;
         }
 
-        if ((parser = _qcl_create_program(&lexer)).err.msg) {
-                config.err = parser.err;
-                //return config;
+        qcl_value **vars  = (qcl_value **)QCL_CALLOC(nvars + 1, sizeof(qcl_value *));
+        qcl_value **stack = (qcl_value **)QCL_MALLOC(sizeof(qcl_value *) * (max_stack + 1));
+
+        (void)_qcl_exec(units, 0, vars, stack, arena, err);
+
+        symtbl tbl = symtbl_create(symtbl_hash, symtbl_cmp);
+        symtbl_reserve(&tbl, nvars);
+        for (size_t i = 0; i < nvars; ++i) {
+                if (vars[i]) symtbl_insert(&tbl, names[i], vars[i]);
         }
 
-        config.interpreter = _qcl_interpret(&parser.p);
+        QCL_FREE(vars);
+        QCL_FREE(stack);
 
-        return config;
+        return tbl;
+}
+
+// Runs a single file that does not include others.
+static symtbl
+_qcl_run(const _qcl_bytecode *bc,
+         _qcl_arena          *arena,
+         _qcl_err            *err)
+{
+        size_t *slots = (size_t *)QCL_MALLOC(sizeof(size_t) * (bc->names.len + 1));
+        for (size_t i = 0; i < bc->names.len; ++i) slots[i] = i;
+
+        _qcl_linked_unit unit = { .bc = bc, .slots = slots, .incs = NULL, .fp = NULL };
+        symtbl tbl = _qcl_run_linked(&unit, 1, bc->names.data, bc->names.len, arena, err);
+
+        QCL_FREE(slots);
+
+        return tbl;
+}
+
+// ######################
+// # IMAGE CACHE        #
+// ######################
+
+/**
+ * A compiled config image is the interpreted symbol table written to
+ * disk in a form that can be mmap()'d and queried in place. Values are
+ * laid out as real qcl_value structs whose pointer fields hold offsets
+ * into the image. Every such field is listed in a relocation table and
+ * is rebased once when the image is mapped (MAP_PRIVATE), after which
+ * qcl_value_get() hands out pointers straight into the mapping.
+ *
+ * The image is keyed by the source path, size, mtime and a 64 bit hash
+ * of the source. If any of them differ the image is ignored. Files
+ * that were included are listed as dependencies with their size, mtime
+ * and inode, and the image is ignored as well if one of them changed.
+ */
+
+#define _QCL_IMAGE_MAGIC   "QCLIMG\0\0"
+#define _QCL_IMAGE_VERSION 2
+
+// A file a config was read from, as it was when it was read.
+typedef struct {
+        const char *path;
+        uint64_t    size;
+        uint64_t    ino;
+        int64_t     mtime_sec;
+        int64_t     mtime_nsec;
+} _qcl_dep;
+
+static _qcl_dep
+_qcl_dep_from(const char        *path,
+              const struct stat *st)
+{
+        return (_qcl_dep) {
+                .path       = path,
+                .size       = (uint64_t)st->st_size,
+                .ino        = (uint64_t)st->st_ino,
+                .mtime_sec  = (int64_t)st->st_mtim.tv_sec,
+                .mtime_nsec = (int64_t)st->st_mtim.tv_nsec,
+        };
 }
 
 static int
-qcl_ok(const qcl_config *config)
+_qcl_dep_matches(const _qcl_dep    *dep,
+                 const struct stat *st)
 {
-        return config->err.msg == NULL;
+        return dep->size       == (uint64_t)st->st_size
+                && dep->ino        == (uint64_t)st->st_ino
+                && dep->mtime_sec  == (int64_t)st->st_mtim.tv_sec
+                && dep->mtime_nsec == (int64_t)st->st_mtim.tv_nsec;
 }
 
-static const char *
-qcl_geterr(const qcl_config *config)
+static int
+_qcl_dep_changed(const _qcl_dep *dep)
 {
-        static char buf[512];
-        size_t c;
-        size_t r;
-        const char *fp;
-        const char *msg;
+        struct stat st;
+        return stat(dep->path, &st) != 0 || !_qcl_dep_matches(dep, &st);
+}
 
-        memset(buf, 0, sizeof(buf));
+typedef struct {
+        uint8_t  magic[8];
+        uint32_t version;
+        uint32_t ptr_size;
+        uint64_t total_size;
+        uint64_t src_size;
+        int64_t  src_mtime_sec;
+        int64_t  src_mtime_nsec;
+        uint64_t src_hash;
+        uint64_t path_off;
+        uint64_t slots_off;
+        uint64_t nslots;
+        uint64_t relocs_off;
+        uint64_t nrelocs;
+        uint64_t deps_off;
+        uint64_t ndeps;
+} _qcl_image_hdr;
 
-        c   = config->err.loc.c;
-        r   = config->err.loc.r;
-        fp  = config->err.loc.fp;
-        msg = config->err.msg;
+typedef struct {
+        uint64_t path_off;
+        uint64_t size;
+        uint64_t ino;
+        int64_t  mtime_sec;
+        int64_t  mtime_nsec;
+} _qcl_image_dep;
+
+typedef struct {
+        uint32_t hash;
+        uint32_t used;
+        uint64_t key_off;
+        uint64_t val_off;
+} _qcl_image_slot;
 
-        sprintf(buf, "%s:%zu:%zu: %s", fp, r, c, msg);
+typedef struct {
+        uint8_t *map;
+        size_t   len;
+} _qcl_image;
 
-        return buf;
-}
+QCL_ARRAY_TYPE(uint8_t, _qcl_bytes);
+QCL_ARRAY_TYPE(uint64_t, _qcl_u64_array);
 
-static qcl_value *
-qcl_value_get(qcl_config *config,
-              const char *var)
+typedef struct {
+        _qcl_bytes     buf;
+        _qcl_u64_array relocs;
+} _qcl_image_writer;
+
+// Reserve `n` zeroed, 8 byte aligned bytes and return their offset.
+static uint64_t
+_qcl_image_reserve(_qcl_image_writer *w, size_t n)
 {
-        if (!symtbl_contains(&config->interpreter.tbl, var)) return NULL;
-        return *(qcl_value **)symtbl_get(&config->interpreter.tbl, var);
+        size_t off = (w->buf.len + 7) & ~(size_t)7;
+        size_t end = off + n;
+
+        if (end > w->buf.cap) {
+                size_t cap = w->buf.cap ? w->buf.cap : 4096;
+                while (cap < end) cap *= 2;
+                w->buf.data = (uint8_t *)QCL_REALLOC(w->buf.data, cap);
+                w->buf.cap  = cap;
+        }
+
+        memset(w->buf.data + w->buf.len, 0, end - w->buf.len);
+        w->buf.len = end;
+
+        return off;
 }
 
+// Store `ptr_off` (an offset) in the pointer field at `field_off` and
+// record the field for relocation.
 static void
-_qcl_value_flatten(qcl_str_array   *ar,
-                   const qcl_value *value)
+_qcl_image_setptr(_qcl_image_writer *w,
+                  uint64_t           field_off,
+                  uint64_t           ptr_off)
 {
-        if (value->kind == QCL_VALUE_KIND_STRING) {
-                qcl_array_append(*ar, strdup(((qcl_value_string *)value)->s));
-                return;
-        } else if (value->kind == QCL_VALUE_KIND_BOOL) {
-                char *s = ((qcl_value_bool *)value)->b ? "true" : "false";
-                qcl_array_append(*ar, strdup(s));
-        }
+        uintptr_t v = (uintptr_t)ptr_off;
+        memcpy(w->buf.data + field_off, &v, sizeof(v));
+        qcl_array_append(w->relocs, field_off);
+}
 
-        qcl_value_list *lst = (qcl_value_list *)value;
-        for (size_t i = 0; i < lst->values.len; ++i) {
-                _qcl_value_flatten(ar, lst->values.data[i]);
-        }
+static uint64_t
+_qcl_image_put_str(_qcl_image_writer *w, const char *s)
+{
+        size_t   n   = strlen(s)+1;
+        uint64_t off = _qcl_image_reserve(w, n);
+        memcpy(w->buf.data + off, s, n);
+        return off;
 }
 
-// NOTE: The caller of this function is responsible
-//       for performing free(ar[0 .. ar.len-1]) and free(ar).
-//       It is guaranteed that the array will always be
-//       at least 1 in length and the last element in the
-//       array will be NULL.
-static char **
-qcl_value_flatten(qcl_config *config,
-                  const char *var)
+static uint64_t
+_qcl_image_put_value(_qcl_image_writer *w, const qcl_value *v)
 {
-        qcl_str_array ar = qcl_array_empty(qcl_str_array);
+        uint64_t off;
 
-        if (!symtbl_contains(&config->interpreter.tbl, var)) {
-                goto done;
-        }
+        if (v->kind == QCL_VALUE_KIND_STRING) {
+                uint64_t s = _qcl_image_put_str(w, ((qcl_value_string *)v)->s);
+                off = _qcl_image_reserve(w, sizeof(qcl_value_string));
+                ((qcl_value *)(w->buf.data + off))->kind = v->kind;
+                _qcl_image_setptr(w, off + offsetof(qcl_value_string, s), s);
+        } else if (v->kind == QCL_VALUE_KIND_BOOL) {
+                off = _qcl_image_reserve(w, sizeof(qcl_value_bool));
+                memcpy(w->buf.data + off, v, sizeof(qcl_value_bool));
+        } else if (v->kind == QCL_VALUE_KIND_LIST) {
+                const qcl_value_list *lst = (const qcl_value_list *)v;
+                size_t                n   = lst->values.len;
+                uint64_t             *els = (uint64_t *)QCL_MALLOC(sizeof(uint64_t) * (n ? n : 1));
 
-        qcl_value *value = *(qcl_value **)symtbl_get(&config->interpreter.tbl, var);
-        if (value) {
-                _qcl_value_flatten(&ar, value);
+                for (size_t i = 0; i < n; ++i) {
+                        els[i] = _qcl_image_put_value(w, lst->values.data[i]);
+                }
+
+                uint64_t data = _qcl_image_reserve(w, sizeof(qcl_value *) * n);
+                for (size_t i = 0; i < n; ++i) {
+                        _qcl_image_setptr(w, data + i*sizeof(qcl_value *), els[i]);
+                }
+                QCL_FREE(els);
+
+                off = _qcl_image_reserve(w, sizeof(qcl_value_list));
+                qcl_value_list *out = (qcl_value_list *)(w->buf.data + off);
+                out->base.kind  = v->kind;
+                out->values.len = out->values.cap = n;
+                if (n) {
+                        _qcl_image_setptr(w, off + offsetof(qcl_value_list, values)
+                                          + offsetof(qcl_value_array, data), data);
+                }
+        } else {
+                assert(0 && "unimplemented");
         }
 
- done:
-        qcl_array_append(ar, NULL);
-        return ar.data;
+        return off;
 }
 
-static void
-qcl_add_value(qcl_config *config,
-              const char *id,
-              qcl_value  *value)
+static int
+_qcl_image_write_file(const char *path, const uint8_t *data, size_t n)
+{
+        char tmp[4096];
+        int  fd;
+
+        if (snprintf(tmp, sizeof(tmp), "%s.%ld.tmp", path, (long)getpid()) >= (int)sizeof(tmp))
+                return 0;
+        if ((fd = open(tmp, O_WRONLY|O_CREAT|O_TRUNC, 0644)) == -1)
+                return 0;
+
+        size_t done = 0;
+        while (done < n) {
+                ssize_t k = write(fd, data + done, n - done);
+                if (k <= 0) {
+                        close(fd);
+                        unlink(tmp);
+                        return 0;
+                }
+                done += k;
+        }
+
+        if (close(fd) != 0 || rename(tmp, path) != 0) {
+                unlink(tmp);
+                return 0;
+        }
+
+        return 1;
+}
+
+static int
+_qcl_image_write(const symtbl      *tbl,
+                 const _qcl_dep    *deps,
+                 size_t             ndeps,
+                 const char        *src_fp,
+                 const struct stat *src_st,
+                 uint64_t           src_hash,
+                 const char        *cache_fp)
+{
+        _qcl_image_writer w = {
+                .buf    = qcl_array_empty(_qcl_bytes),
+                .relocs = qcl_array_empty(_qcl_u64_array),
+        };
+
+        size_t nslots = 8;
+        while (nslots < tbl->tbl.sz * 2) nslots *= 2;
+
+        uint64_t hdr_off   = _qcl_image_reserve(&w, sizeof(_qcl_image_hdr));
+        uint64_t path_off  = _qcl_image_put_str(&w, src_fp);
+        uint64_t slots_off = _qcl_image_reserve(&w, sizeof(_qcl_image_slot) * nslots);
+
+        for (size_t i = 0; i < tbl->tbl.cap; ++i) {
+                if (!tbl->tbl.data[i].used) continue;
+
+                const char *key     = tbl->tbl.data[i].k;
+                uint32_t    hash    = _qcl_strhash(key);
+                uint64_t    key_off = _qcl_image_put_str(&w, key);
+                uint64_t    val_off = _qcl_image_put_value(&w, tbl->tbl.data[i].v);
+
+                _qcl_image_slot *slots = (_qcl_image_slot *)(w.buf.data + slots_off);
+                size_t idx = hash & (nslots-1);
+                while (slots[idx].used) idx = (idx+1) & (nslots-1);
+                slots[idx] = (_qcl_image_slot) {
+                        .hash    = hash,
+                        .used    = 1,
+                        .key_off = key_off,
+                        .val_off = val_off,
+                };
+        }
+
+        uint64_t deps_off = _qcl_image_reserve(&w, sizeof(_qcl_image_dep) * ndeps);
+        for (size_t i = 0; i < ndeps; ++i) {
+                uint64_t path_off = _qcl_image_put_str(&w, deps[i].path);
+                _qcl_image_dep *dep = (_qcl_image_dep *)(w.buf.data + deps_off) + i;
+                *dep = (_qcl_image_dep) {
+                        .path_off   = path_off,
+                        .size       = deps[i].size,
+                        .ino        = deps[i].ino,
+                        .mtime_sec  = deps[i].mtime_sec,
+                        .mtime_nsec = deps[i].mtime_nsec,
+                };
+        }
+
+        uint64_t relocs_off = _qcl_image_reserve(&w, sizeof(uint64_t) * w.relocs.len);
+        if (w.relocs.len) {
+                memcpy(w.buf.data + relocs_off, w.relocs.data, sizeof(uint64_t) * w.relocs.len);
+        }
+
+        _qcl_image_hdr *hdr = (_qcl_image_hdr *)(w.buf.data + hdr_off);
+        memcpy(hdr->magic, _QCL_IMAGE_MAGIC, sizeof(hdr->magic));
+        hdr->version        = _QCL_IMAGE_VERSION;
+        hdr->ptr_size       = sizeof(void *);
+        hdr->total_size     = w.buf.len;
+        hdr->src_size       = src_st->st_size;
+        hdr->src_mtime_sec  = src_st->st_mtim.tv_sec;
+        hdr->src_mtime_nsec = src_st->st_mtim.tv_nsec;
+        hdr->src_hash       = src_hash;
+        hdr->path_off       = path_off;
+        hdr->slots_off      = slots_off;
+        hdr->nslots         = nslots;
+        hdr->relocs_off     = relocs_off;
+        hdr->nrelocs        = w.relocs.len;
+        hdr->deps_off       = deps_off;
+        hdr->ndeps          = ndeps;
+
+        int ok = _qcl_image_write_file(cache_fp, w.buf.data, w.buf.len);
+
+        qcl_array_free(w.buf);
+        qcl_array_free(w.relocs);
+
+        return ok;
+}
+
+// Hash the file at `fp`, as _qcl_load_file() reads it. Returns 0 on
+// failure.
+static int
+_qcl_hash_file(const char *fp, const struct stat *st, uint64_t *hash)
+{
+        _qcl_source src;
+
+        if (!_qcl_load_file(fp, &src)) return 0;
+
+        // Changed since `st`, the image would not match it anyway.
+        int ok = src.len == (size_t)st->st_size;
+        if (ok) *hash = _qcl_hash64((const uint8_t *)src.data, src.len);
+        _qcl_source_free(&src);
+
+        return ok;
+}
+
+// Whether `n` items of `size` bytes at `off` lie inside an image of
+// `total` bytes.
+static int
+_qcl_image_fits(uint64_t total,
+                uint64_t off,
+                uint64_t n,
+                uint64_t size)
+{
+        return off <= total && n <= (total - off) / size;
+}
+
+// Whether a string at `off` ends inside the image.
+static int
+_qcl_image_str_ok(const uint8_t *map,
+                  uint64_t       total,
+                  uint64_t       off)
+{
+        return off < total && memchr(map + off, '\0', total - off) != NULL;
+}
+
+#define _QCL_IMAGE_MAX_DEPTH 64
+
+// Checks the value at `off` of a relocated image and every value in
+// it. `budget` is the number of values that may still be visited, so
+// that a damaged image cannot make it go around in a cycle.
+static int
+_qcl_image_value_ok(const uint8_t *map,
+                    uint64_t       total,
+                    uint64_t       off,
+                    uint64_t      *budget,
+                    int            depth)
+{
+        if (!*budget || depth > _QCL_IMAGE_MAX_DEPTH) return 0;
+        --*budget;
+
+        if (off % sizeof(void *) || !_qcl_image_fits(total, off, 1, sizeof(qcl_value))) return 0;
+
+        const qcl_value *v = (const qcl_value *)(map + off);
+
+        if (v->kind == QCL_VALUE_KIND_STRING) {
+                if (!_qcl_image_fits(total, off, 1, sizeof(qcl_value_string))) return 0;
+                const char *str = ((const qcl_value_string *)v)->s;
+                return _qcl_image_str_ok(map, total, (uintptr_t)str - (uintptr_t)map);
+        } else if (v->kind == QCL_VALUE_KIND_BOOL) {
+                return _qcl_image_fits(total, off, 1, sizeof(qcl_value_bool));
+        } else if (v->kind == QCL_VALUE_KIND_LIST) {
+                if (!_qcl_image_fits(total, off, 1, sizeof(qcl_value_list))) return 0;
+
+                const qcl_value_array *vals = &((const qcl_value_list *)v)->values;
+                if (!vals->len) return 1;
+
+                uint64_t data = (uintptr_t)vals->data - (uintptr_t)map;
+                if (data % sizeof(void *) || !_qcl_image_fits(total, data, vals->len, sizeof(qcl_value *))) return 0;
+
+                for (size_t i = 0; i < vals->len; ++i) {
+                        uint64_t el = (uintptr_t)vals->data[i] - (uintptr_t)map;
+                        if (!_qcl_image_value_ok(map, total, el, budget, depth+1)) return 0;
+                }
+                return 1;
+        }
+
+        return 0;
+}
+
+// Checks every offset and count of the body against the size of the
+// image, so that a damaged cache is reparsed instead of read past its
+// end. The offsets in pointer fields are checked before relocation,
+// the values they lead to after it.
+static int
+_qcl_image_body_ok(const uint8_t *map)
+{
+        const _qcl_image_hdr *hdr   = (const _qcl_image_hdr *)map;
+        uint64_t              total = hdr->total_size;
+
+        if (!_qcl_image_str_ok(map, total, hdr->path_off)
+            || hdr->nslots == 0
+            || (hdr->nslots & (hdr->nslots-1))
+            || hdr->slots_off  % sizeof(uint64_t)
+            || hdr->relocs_off % sizeof(uint64_t)
+            || hdr->deps_off   % sizeof(uint64_t)
+            || !_qcl_image_fits(total, hdr->slots_off,  hdr->nslots,  sizeof(_qcl_image_slot))
+            || !_qcl_image_fits(total, hdr->relocs_off, hdr->nrelocs, sizeof(uint64_t))
+            || !_qcl_image_fits(total, hdr->deps_off,   hdr->ndeps,   sizeof(_qcl_image_dep))) {
+                return 0;
+        }
+
+        const _qcl_image_dep *deps = (const _qcl_image_dep *)(map + hdr->deps_off);
+        for (uint64_t i = 0; i < hdr->ndeps; ++i) {
+                if (!_qcl_image_str_ok(map, total, deps[i].path_off)) return 0;
+        }
+
+        // The writer puts the relocations last. A field before the body
+        // or among the relocations would change what was checked here.
+        const uint64_t *relocs = (const uint64_t *)(map + hdr->relocs_off);
+        for (uint64_t i = 0; i < hdr->nrelocs; ++i) {
+                uintptr_t v;
+                if (relocs[i] < sizeof(_qcl_image_hdr)
+                    || !_qcl_image_fits(hdr->relocs_off, relocs[i], 1, sizeof(v))) {
+                        return 0;
+                }
+                memcpy(&v, map + relocs[i], sizeof(v));
+                if (v >= total) return 0;
+        }
+
+        return 1;
+}
+
+// Checks the table of a relocated image.
+static int
+_qcl_image_slots_ok(const uint8_t *map)
+{
+        const _qcl_image_hdr  *hdr      = (const _qcl_image_hdr *)map;
+        const _qcl_image_slot *slots    = (const _qcl_image_slot *)(map + hdr->slots_off);
+        uint64_t               total    = hdr->total_size;
+        uint64_t               budget   = hdr->nslots + hdr->nrelocs;
+        int                    has_free = 0;
+
+        for (uint64_t i = 0; i < hdr->nslots; ++i) {
+                if (!slots[i].used) {
+                        has_free = 1;
+                        continue;
+                }
+                if (!_qcl_image_str_ok(map, total, slots[i].key_off)
+                    || !_qcl_image_value_ok(map, total, slots[i].val_off, &budget, 0)) {
+                        return 0;
+                }
+        }
+
+        // _qcl_image_get() probes until it finds a free slot.
+        return has_free;
+}
+
+static int
+_qcl_image_load(_qcl_image        *img,
+                const char        *src_fp,
+                const struct stat *src_st,
+                uint64_t           src_hash,
+                const char        *cache_fp)
+{
+        int         fd;
+        struct stat st;
+        uint8_t    *map;
+
+        if ((fd = open(cache_fp, O_RDONLY)) == -1) return 0;
+        if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(_qcl_image_hdr)) {
+                close(fd);
+                return 0;
+        }
+
+        map = (uint8_t *)mmap(NULL, st.st_size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED) return 0;
+
+        const _qcl_image_hdr *hdr = (const _qcl_image_hdr *)map;
+
+        if (memcmp(hdr->magic, _QCL_IMAGE_MAGIC, sizeof(hdr->magic))
+            || hdr->version        != _QCL_IMAGE_VERSION
+            || hdr->ptr_size       != sizeof(void *)
+            || hdr->total_size     != (uint64_t)st.st_size
+            || hdr->src_size       != (uint64_t)src_st->st_size
+            || hdr->src_mtime_sec  != (int64_t)src_st->st_mtim.tv_sec
+            || hdr->src_mtime_nsec != (int64_t)src_st->st_mtim.tv_nsec
+            || hdr->src_hash       != src_hash
+            || !_qcl_image_body_ok(map)
+            || strcmp((const char *)map + hdr->path_off, src_fp)) {
+                munmap(map, st.st_size);
+                return 0;
+        }
+
+        const _qcl_image_dep *deps = (const _qcl_image_dep *)(map + hdr->deps_off);
+        for (uint64_t i = 0; i < hdr->ndeps; ++i) {
+                _qcl_dep dep = {
+                        .path       = (const char *)map + deps[i].path_off,
+                        .size       = deps[i].size,
+                        .ino        = deps[i].ino,
+                        .mtime_sec  = deps[i].mtime_sec,
+                        .mtime_nsec = deps[i].mtime_nsec,
+                };
+                if (_qcl_dep_changed(&dep)) {
+                        munmap(map, st.st_size);
+                        return 0;
+                }
+        }
+
+        const uint64_t *relocs = (const uint64_t *)(map + hdr->relocs_off);
+        for (uint64_t i = 0; i < hdr->nrelocs; ++i) {
+                uintptr_t v;
+                memcpy(&v, map + relocs[i], sizeof(v));
+                v += (uintptr_t)map;
+                memcpy(map + relocs[i], &v, sizeof(v));
+        }
+
+        if (!_qcl_image_slots_ok(map)) {
+                munmap(map, st.st_size);
+                return 0;
+        }
+
+        img->map = map;
+        img->len = st.st_size;
+
+        return 1;
+}
+
+// `hash` is _qcl_strhash(var).
+static qcl_value *
+_qcl_image_get(const _qcl_image *img,
+               const char       *var,
+               uint32_t          hash)
+{
+        if (!img->map) return NULL;
+
+        const _qcl_image_hdr  *hdr   = (const _qcl_image_hdr *)img->map;
+        const _qcl_image_slot *slots = (const _qcl_image_slot *)(img->map + hdr->slots_off);
+        size_t                 mask  = hdr->nslots-1;
+
+        for (size_t idx = hash & mask; slots[idx].used; idx = (idx+1) & mask) {
+                if (slots[idx].hash == hash
+                    && !strcmp((const char *)img->map + slots[idx].key_off, var)) {
+                        return (qcl_value *)(img->map + slots[idx].val_off);
+                }
+        }
+
+        return NULL;
+}
+
+static void
+_qcl_image_unload(_qcl_image *img)
+{
+        if (img->map) munmap(img->map, img->len);
+        img->map = NULL;
+        img->len = 0;
+}
+
+// The dependencies of a loaded image, allocated from `arena`. The
+// paths point into the image.
+static _qcl_dep *
+_qcl_image_deps(const _qcl_image *img,
+                _qcl_arena       *arena,
+                size_t           *n)
+{
+        const _qcl_image_hdr *hdr  = (const _qcl_image_hdr *)img->map;
+        const _qcl_image_dep *deps = (const _qcl_image_dep *)(img->map + hdr->deps_off);
+        _qcl_dep             *out  = (_qcl_dep *)_qcl_arena_alloc(arena, sizeof(_qcl_dep) * (hdr->ndeps + 1));
+
+        for (uint64_t i = 0; i < hdr->ndeps; ++i) {
+                out[i] = (_qcl_dep) {
+                        .path       = (const char *)img->map + deps[i].path_off,
+                        .size       = deps[i].size,
+                        .ino        = deps[i].ino,
+                        .mtime_sec  = deps[i].mtime_sec,
+                        .mtime_nsec = deps[i].mtime_nsec,
+                };
+        }
+        *n = hdr->ndeps;
+
+        return out;
+}
+
+typedef struct _qcl_unit _qcl_unit;
+
+typedef struct {
+        _qcl_interpret_context interpreter;
+        _qcl_image image;
+        _qcl_err err;
+        _qcl_dep *deps;    // every file that was read, the root first
+        size_t ndeps;
+        _qcl_unit **units; // compiled files the values come from
+        size_t nunits;
+} qcl_config;
+
+// ######################
+// # INCLUDES           #
+// ######################
+
+/**
+ * `include 'path';` runs another file at that point. It shares the
+ * variables of the file that includes it, so a fragment can use what
+ * was assigned before the include and whatever it assigns is visible
+ * afterwards. Relative paths are resolved against the directory of the
+ * including file. The path must be a string literal: every included
+ * file is loaded, even in an `if` branch that is not taken, and a file
+ * that includes itself, directly or not, is an error.
+ *
+ * Files are loaded in waves, first the root, then the files it
+ * includes, then the files those include and so on. The files of a
+ * wave are lexed, parsed and compiled in parallel.
+ *
+ * The compiled form of a file, a unit, does not depend on any other
+ * file. Units are kept in a qcl_unit_cache under the real path of the
+ * file together with its size, mtime and inode, so loading a config
+ * again only recompiles the files that changed since. Units are shared
+ * with every config that was loaded from them and are reference
+ * counted, so neither the cache nor the configs have to outlive the
+ * other. A cache, and destroying configs that were loaded with it,
+ * must be used by one thread at a time. Queries do not touch it.
+ */
+
+#ifndef QCL_LOAD_THREADS
+#define QCL_LOAD_THREADS 8
+#endif
+
+typedef struct {
+        const char *fp;  // the file to open
+        _qcl_loc    loc; // of the include statement
+} _qcl_unit_include;
+
+struct _qcl_unit {
+        _qcl_dep           dep;   // the path is the real path, key of the cache
+        const char        *fp;    // as it was first included, for errors
+        _qcl_bytecode      bc;
+        _qcl_unit_include *incs;  // by index of the include in the file
+        size_t             nincs;
+        _qcl_arena         arena; // everything above and the constants
+        size_t             refs;
+};
+
+QCL_MAP_TYPE(const char *, _qcl_unit *, _qcl_unitmap);
+QCL_MAP_TYPE(const char *, size_t, _qcl_pathmap);
+
+typedef struct {
+        _qcl_unitmap units;
+} qcl_unit_cache;
+
+static qcl_unit_cache
+qcl_unit_cache_create(void)
+{
+        return (qcl_unit_cache) {
+                .units = _qcl_unitmap_create(symtbl_hash, symtbl_cmp),
+        };
+}
+
+static void
+_qcl_unit_release(_qcl_unit *u)
+{
+        if (--u->refs > 0) return;
+        _qcl_bytecode_free(&u->bc);
+        _qcl_arena_free(&u->arena);
+        QCL_FREE(u);
+}
+
+static void
+qcl_unit_cache_destroy(qcl_unit_cache *cache)
+{
+        for (size_t i = 0; i < cache->units.tbl.cap; ++i) {
+                if (cache->units.tbl.data[i].used) _qcl_unit_release(cache->units.tbl.data[i].v);
+        }
+        _qcl_unitmap_destroy(&cache->units);
+}
+
+// `path` as written in an include of the file `from`.
+static const char *
+_qcl_include_path(_qcl_arena *a,
+                  const char *from,
+                  _qcl_slice  path)
+{
+        const char *slash = strrchr(from, '/');
+        size_t      dir_n = path.n && path.s[0] == '/' ? 0 : slash ? (size_t)(slash - from) + 1 : 0;
+        char       *fp    = (char *)_qcl_arena_alloc(a, dir_n + path.n + 1);
+
+        memcpy(fp, from, dir_n);
+        memcpy(fp + dir_n, path.s, path.n);
+        fp[dir_n + path.n] = '\0';
+
+        return fp;
+}
+
+typedef struct {
+        const char  *fp;
+        const char  *rpath;
+        struct stat  st;
+        _qcl_loc     loc;  // of the include, {0} for the root
+        _qcl_unit   *unit; // always set, even on errors
+        _qcl_err     err;
+} _qcl_unit_job;
+
+// Lex, parse and compile a file. Only touches `job`, so jobs can run
+// in parallel.
+static void
+_qcl_unit_build(_qcl_unit_job *job)
+{
+        _qcl_unit   *u = (_qcl_unit *)QCL_CALLOC(1, sizeof(_qcl_unit));
+        _qcl_source  src;
+        _qcl_lexer   lexer;
+        _qcl_parser  parser;
+
+        u->refs   = 1;
+        u->dep    = _qcl_dep_from(_qcl_arena_strdup(&u->arena, job->rpath), &job->st);
+        u->fp     = _qcl_arena_strdup(&u->arena, job->fp);
+        job->unit = u;
+
+        if (!_qcl_load_file(job->rpath, &src)) {
+                job->err.msg = "failed to load file";
+                job->err.loc = job->loc;
+                return;
+        }
+
+        if ((lexer = _qcl_lex_file(u->fp, src.data, src.len)).err.msg) {
+                job->err = lexer.err;
+                goto done;
+        }
+
+        if ((parser = _qcl_create_program(&lexer)).err.msg) {
+                job->err = parser.err;
+                _qcl_program_free(&parser.p);
+                goto done;
+        }
+
+        u->nincs = parser.p.includes.len;
+        u->incs  = (_qcl_unit_include *)_qcl_arena_alloc(&u->arena, sizeof(_qcl_unit_include) * (u->nincs + 1));
+        for (size_t i = 0; i < u->nincs; ++i) {
+                const _qcl_stmt_include *inc = parser.p.includes.data[i];
+                u->incs[i] = (_qcl_unit_include) {
+                        .fp  = _qcl_include_path(&u->arena, u->fp, inc->path),
+                        .loc = _qcl_lexer_errloc(&lexer, inc->base.loc),
+                };
+        }
+
+        u->bc = _qcl_compile(&parser.p, &u->arena);
+        _qcl_program_free(&parser.p);
+
+ done:
+        // Nothing in the unit points into the source, the tokens or
+        // the AST.
+        _qcl_lexer_free(&lexer);
+        _qcl_source_free(&src);
+}
+
+#ifndef QCL_NO_THREADS
+#include <pthread.h>
+
+typedef struct {
+        _qcl_unit_job *jobs;
+        size_t         n;
+        size_t         next;
+} _qcl_unit_queue;
+
+static void *
+_qcl_unit_worker(void *arg)
+{
+        _qcl_unit_queue *q = (_qcl_unit_queue *)arg;
+        for (size_t i; (i = __atomic_fetch_add(&q->next, 1, __ATOMIC_RELAXED)) < q->n;) {
+                _qcl_unit_build(&q->jobs[i]);
+        }
+        return NULL;
+}
+#endif
+
+// Build every job, on up to QCL_LOAD_THREADS threads besides the
+// caller's. Define QCL_NO_THREADS to build them one after the other.
+static void
+_qcl_unit_build_all(_qcl_unit_job *jobs,
+                    size_t         n)
+{
+#ifndef QCL_NO_THREADS
+        _qcl_unit_queue q = { .jobs = jobs, .n = n, .next = 0 };
+        pthread_t       th[QCL_LOAD_THREADS];
+        size_t          nth = 0;
+
+        while (nth+1 < n && nth < QCL_LOAD_THREADS
+               && pthread_create(&th[nth], NULL, _qcl_unit_worker, &q) == 0) {
+                ++nth;
+        }
+        (void)_qcl_unit_worker(&q);
+        for (size_t i = 0; i < nth; ++i) pthread_join(th[i], NULL);
+#else
+        for (size_t i = 0; i < n; ++i) _qcl_unit_build(&jobs[i]);
+#endif
+}
+
+// An include that is waiting to be loaded.
+typedef struct {
+        const char *fp;
+        _qcl_loc    loc;  // of the include, {0} for the root
+        size_t      from; // index of the including unit, SIZE_MAX for the root
+        size_t      inc;  // which of its includes
+} _qcl_pending;
+
+QCL_ARRAY_TYPE(_qcl_pending, _qcl_pending_array);
+QCL_ARRAY_TYPE(_qcl_unit *, _qcl_unit_array);
+QCL_ARRAY_TYPE(size_t *, _qcl_index_table);
+QCL_ARRAY_TYPE(_qcl_unit_job, _qcl_unit_job_array);
+
+// Depth first search for an include that leads back to a file that is
+// still being included. Returns the include as unit and index.
+static int
+_qcl_find_cycle(_qcl_unit *const *units,
+                size_t    *const *incs,
+                uint8_t          *state, // 0 new, 1 being included, 2 done
+                size_t            u,
+                size_t           *at_unit,
+                size_t           *at_inc)
+{
+        state[u] = 1;
+        for (size_t i = 0; i < units[u]->nincs; ++i) {
+                size_t v = incs[u][i];
+                if (state[v] == 1) {
+                        *at_unit = u;
+                        *at_inc  = i;
+                        return 1;
+                }
+                if (state[v] == 0 && _qcl_find_cycle(units, incs, state, v, at_unit, at_inc)) {
+                        return 1;
+                }
+        }
+        state[u] = 2;
+        return 0;
+}
+
+// Load `fp` and everything it includes into `config`, using and
+// updating `cache`.
+static void
+_qcl_load(qcl_config     *config,
+          const char     *fp,
+          qcl_unit_cache *cache)
+{
+        _qcl_arena          *arena   = &config->interpreter.arena;
+        _qcl_unit_array      units   = qcl_array_empty(_qcl_unit_array);
+        _qcl_index_table     incs    = qcl_array_empty(_qcl_index_table);
+        _qcl_pending_array   pending = qcl_array_empty(_qcl_pending_array);
+        _qcl_pending_array   next    = qcl_array_empty(_qcl_pending_array);
+        _qcl_unit_job_array  jobs    = qcl_array_empty(_qcl_unit_job_array);
+        qcl_str_array        rpaths  = qcl_array_empty(qcl_str_array);
+        _qcl_pathmap         seen    = _qcl_pathmap_create(symtbl_hash, symtbl_cmp);
+
+        qcl_array_append(pending, ((_qcl_pending) { .fp = fp, .loc = {0}, .from = SIZE_MAX, .inc = 0 }));
+
+        while (pending.len > 0) {
+                qcl_array_clear(jobs);
+                qcl_array_clear(next);
+
+                size_t first = units.len;
+
+                for (size_t i = 0; i < pending.len; ++i) {
+                        const _qcl_pending *p = &pending.data[i];
+                        struct stat         st;
+                        char               *rpath = realpath(p->fp, NULL);
+
+                        if (!rpath || stat(rpath, &st) != 0) {
+                                free(rpath);
+                                if (p->from == SIZE_MAX) _qcl_seterr(&config->err, arena, p->loc, "failed to load file");
+                                else                     _qcl_seterr(&config->err, arena, p->loc, "cannot include %s", p->fp);
+                                goto done;
+                        }
+                        qcl_array_append(rpaths, rpath);
+
+                        size_t *idx = _qcl_pathmap_get(&seen, rpath);
+                        size_t  u   = idx ? *idx : units.len;
+
+                        if (p->from != SIZE_MAX) incs.data[p->from][p->inc] = u;
+                        if (idx) continue;
+
+                        _qcl_pathmap_insert(&seen, rpath, u);
+
+                        _qcl_unit **cached = _qcl_unitmap_get(&cache->units, rpath);
+                        if (cached && _qcl_dep_matches(&(*cached)->dep, &st)) {
+                                ++(*cached)->refs;
+                                qcl_array_append(units, *cached);
+                                continue;
+                        }
+
+                        qcl_array_append(units, NULL);
+                        qcl_array_append(jobs, ((_qcl_unit_job) {
+                                .fp    = p->fp,
+                                .rpath = rpath,
+                                .st    = st,
+                                .loc   = p->loc,
+                                .unit  = NULL,
+                                .err   = {0},
+                        }));
+                }
+
+                _qcl_unit_build_all(jobs.data, jobs.len);
+
+                // Jobs were added in the order of their units.
+                for (size_t i = 0, j = first; i < jobs.len; ++i, ++j) {
+                        while (units.data[j]) ++j;
+                        units.data[j] = jobs.data[i].unit;
+
+                        if (jobs.data[i].err.msg) {
+                                _qcl_seterr(&config->err, arena, jobs.data[i].err.loc, "%s", jobs.data[i].err.msg);
+                                continue;
+                        }
+
+                        // The key of a replaced unit lives in its arena.
+                        int                added;
+                        _qcl_unitmap_slot *slot = _qcl_unitmap_emplace(&cache->units, units.data[j]->dep.path, &added);
+                        if (!added) _qcl_unit_release(slot->v);
+                        slot->k = units.data[j]->dep.path;
+                        slot->v = units.data[j];
+                        ++units.data[j]->refs;
+                }
+                if (config->err.msg) goto done;
+
+                for (size_t u = first; u < units.len; ++u) {
+                        size_t *ix = (size_t *)QCL_MALLOC(sizeof(size_t) * (units.data[u]->nincs + 1));
+                        qcl_array_append(incs, ix);
+                        for (size_t i = 0; i < units.data[u]->nincs; ++i) {
+                                qcl_array_append(next, ((_qcl_pending) {
+                                        .fp   = units.data[u]->incs[i].fp,
+                                        .loc  = units.data[u]->incs[i].loc,
+                                        .from = u,
+                                        .inc  = i,
+                                }));
+                        }
+                }
+
+                _qcl_pending_array tmp = pending;
+                pending = next;
+                next    = tmp;
+        }
+
+        {
+                uint8_t *state = (uint8_t *)QCL_CALLOC(units.len, 1);
+                size_t   at_unit, at_inc;
+                if (_qcl_find_cycle(units.data, incs.data, state, 0, &at_unit, &at_inc)) {
+                        const _qcl_unit_include *inc = &units.data[at_unit]->incs[at_inc];
+                        _qcl_seterr(&config->err, arena, inc->loc, "include cycle through %s", inc->fp);
+                }
+                QCL_FREE(state);
+                if (config->err.msg) goto done;
+        }
+
+        {
+                // One variable for every distinct name across the files.
+                _qcl_idmap        vars   = _qcl_idmap_create(_qcl_idmap_hash, _qcl_idmap_cmp);
+                qcl_str_array     names  = qcl_array_empty(qcl_str_array);
+                _qcl_linked_unit *linked = (_qcl_linked_unit *)QCL_MALLOC(sizeof(_qcl_linked_unit) * units.len);
+
+                for (size_t u = 0; u < units.len; ++u) {
+                        const _qcl_bytecode *bc    = &units.data[u]->bc;
+                        size_t              *slots = (size_t *)QCL_MALLOC(sizeof(size_t) * (bc->names.len + 1));
+
+                        for (size_t i = 0; i < bc->names.len; ++i) {
+                                int              added;
+                                _qcl_slice       name = { bc->names.data[i], strlen(bc->names.data[i]) };
+                                _qcl_idmap_slot *it   = _qcl_idmap_emplace(&vars, name, &added);
+                                if (added) {
+                                        it->v = names.len;
+                                        qcl_array_append(names, bc->names.data[i]);
+                                }
+                                slots[i] = it->v;
+                        }
+
+                        linked[u] = (_qcl_linked_unit) {
+                                .bc    = bc,
+                                .slots = slots,
+                                .incs  = incs.data[u],
+                                .fp    = units.data[u]->fp,
+                        };
+                }
+
+                config->interpreter.tbl = _qcl_run_linked(linked, units.len, names.data, names.len,
+                                                          arena, &config->err);
+
+                for (size_t u = 0; u < units.len; ++u) QCL_FREE((void *)linked[u].slots);
+                QCL_FREE(linked);
+                qcl_array_free(names);
+                _qcl_idmap_destroy(&vars);
+        }
+
+        config->ndeps = units.len;
+        config->deps  = (_qcl_dep *)_qcl_arena_alloc(arena, sizeof(_qcl_dep) * (units.len + 1));
+        for (size_t u = 0; u < units.len; ++u) {
+                config->deps[u] = units.data[u]->dep;
+        }
+
+        // The config keeps the references to its units.
+        config->units  = units.data;
+        config->nunits = units.len;
+        units          = qcl_array_empty(_qcl_unit_array);
+
+ done:
+        for (size_t u = 0; u < units.len; ++u) {
+                if (units.data[u]) _qcl_unit_release(units.data[u]);
+        }
+        qcl_array_free(units);
+        for (size_t i = 0; i < incs.len; ++i) QCL_FREE(incs.data[i]);
+        qcl_array_free(incs);
+        qcl_array_free(pending);
+        qcl_array_free(next);
+        qcl_array_free(jobs);
+        for (size_t i = 0; i < rpaths.len; ++i) free(rpaths.data[i]);
+        qcl_array_free(rpaths);
+        _qcl_pathmap_destroy(&seen);
+}
+
+static qcl_config qcl_parse_file_units(const char *fp, const char *cache_fp, qcl_unit_cache *units);
+
+static qcl_config
+qcl_parse_file(const char *fp)
+{
+        return qcl_parse_file_units(fp, NULL, NULL);
+}
+
+static int
+qcl_ok(const qcl_config *config)
+{
+        return config->err.msg == NULL;
+}
+
+static const char *
+qcl_geterr(const qcl_config *config)
+{
+        static char buf[512];
+        size_t c;
+        size_t r;
+        const char *fp;
+        const char *msg;
+
+        memset(buf, 0, sizeof(buf));
+
+        c   = config->err.loc.c;
+        r   = config->err.loc.r;
+        fp  = config->err.loc.fp;
+        msg = config->err.msg;
+
+        // Runtime errors only know the file they happened in.
+        if (fp && r) snprintf(buf, sizeof(buf), "%s:%zu:%zu: %s", fp, r, c, msg);
+        else if (fp) snprintf(buf, sizeof(buf), "%s: %s", fp, msg);
+        else         snprintf(buf, sizeof(buf), "%s", msg);
+
+        return buf;
+}
+
+static qcl_value *
+qcl_value_get(qcl_config *config,
+              const char *var)
+{
+        unsigned    hash  = _qcl_strhash(var);
+        qcl_value **value = symtbl_get_hashed(&config->interpreter.tbl, var, hash);
+        if (value) return *value;
+        return _qcl_image_get(&config->image, var, hash);
+}
+
+// ######################
+// # KEYS               #
+// ######################
+
+/**
+ * A qcl_key is a variable path that has been checked and hashed once,
+ * so looking it up is a single probe of the symbol table (or image)
+ * without touching the characters of the path again unless the slot
+ * matches. Keys hold no reference to a config and are immutable, so
+ * one key can be used with any number of configs from any thread.
+ */
+
+typedef struct {
+        const char *path; // NULL if the path is not valid
+        size_t      len;
+        unsigned    hash;
+} qcl_key;
+
+// Whether the `n` bytes at `s` are an identifier or a dotted path of
+// identifiers, i.e. something that can be assigned to.
+static int
+_qcl_is_path(const char *s,
+             size_t      n)
+{
+        if (n == 0 || _qcl_is_kw(s, n)) return 0;
+
+        size_t i = 0;
+        for (;;) {
+                if (i >= n || _qcl_cc_tbl[(uint8_t)s[i]] != _QCL_CC_IDENT) return 0;
+                while (i < n && _qcl_ident_tbl[(uint8_t)s[i]]) ++i;
+                if (i == n) return 1;
+                if (s[i++] != '.') return 0;
+        }
+}
+
+static qcl_key
+qcl_key_resolve(const char *path)
+{
+        size_t n = strlen(path);
+
+        if (!_qcl_is_path(path, n)) return (qcl_key) {0};
+
+        return (qcl_key) {
+                .path = path,
+                .len  = n,
+                .hash = _qcl_strhash(path),
+        };
+}
+
+static const qcl_value *
+qcl_key_value(qcl_config    *config,
+              const qcl_key *key)
+{
+        if (!key->path) return NULL;
+
+        qcl_value **value = symtbl_get_hashed(&config->interpreter.tbl, key->path, key->hash);
+        if (value) return *value;
+        return _qcl_image_get(&config->image, key->path, key->hash);
+}
+
+static const char *
+qcl_value_as_string(const qcl_value *v)
+{
+        if (!v || v->kind != QCL_VALUE_KIND_STRING) return NULL;
+        return ((const qcl_value_string *)v)->s;
+}
+
+static int
+qcl_value_as_bool(const qcl_value *v,
+                  int             *b)
+{
+        if (!v || v->kind != QCL_VALUE_KIND_BOOL) return 0;
+        *b = ((const qcl_value_bool *)v)->b;
+        return 1;
+}
+
+static size_t
+qcl_value_list_len(const qcl_value *v)
+{
+        if (!v || v->kind != QCL_VALUE_KIND_LIST) return 0;
+        return ((const qcl_value_list *)v)->values.len;
+}
+
+static const qcl_value *
+qcl_value_list_at(const qcl_value *v,
+                  size_t           i)
+{
+        if (i >= qcl_value_list_len(v)) return NULL;
+        return ((const qcl_value_list *)v)->values.data[i];
+}
+
+static const char *
+qcl_key_string(qcl_config    *config,
+               const qcl_key *key)
+{
+        return qcl_value_as_string(qcl_key_value(config, key));
+}
+
+static int
+qcl_key_bool(qcl_config    *config,
+             const qcl_key *key,
+             int           *b)
+{
+        return qcl_value_as_bool(qcl_key_value(config, key), b);
+}
+
+static const qcl_value *
+qcl_key_list(qcl_config    *config,
+             const qcl_key *key)
+{
+        const qcl_value *v = qcl_key_value(config, key);
+        return v && v->kind == QCL_VALUE_KIND_LIST ? v : NULL;
+}
+
+static void
+_qcl_value_flatten(qcl_str_array   *ar,
+                   const qcl_value *value)
+{
+        if (value->kind == QCL_VALUE_KIND_STRING) {
+                qcl_array_append(*ar, strdup(((qcl_value_string *)value)->s));
+                return;
+        } else if (value->kind == QCL_VALUE_KIND_BOOL) {
+                char *s = ((qcl_value_bool *)value)->b ? "true" : "false";
+                qcl_array_append(*ar, strdup(s));
+                return;
+        }
+
+        qcl_value_list *lst = (qcl_value_list *)value;
+        for (size_t i = 0; i < lst->values.len; ++i) {
+                _qcl_value_flatten(ar, lst->values.data[i]);
+        }
+}
+
+// NOTE: The caller of this function is responsible
+//       for performing free(ar[0 .. ar.len-1]) and free(ar).
+//       It is guaranteed that the array will always be
+//       at least 1 in length and the last element in the
+//       array will be NULL.
+static char **
+qcl_value_flatten(qcl_config *config,
+                  const char *var)
+{
+        qcl_str_array ar = qcl_array_empty(qcl_str_array);
+
+        qcl_value *value = qcl_value_get(config, var);
+        if (value) {
+                _qcl_value_flatten(&ar, value);
+        }
+
+        qcl_array_append(ar, NULL);
+        return ar.data;
+}
+
+#ifndef QCL_VALUE_ITER_DEPTH
+#define QCL_VALUE_ITER_DEPTH 32
+#endif
+
+// Walks the same leaves as qcl_value_flatten() without allocating.
+// Lists nested deeper than QCL_VALUE_ITER_DEPTH are not supported.
+typedef struct {
+        const qcl_value_list *lst;
+        size_t                i;
+} _qcl_value_iter_frame;
+
+typedef struct {
+        const qcl_value       *leaf; // set until the first call to next()
+        _qcl_value_iter_frame  stack[QCL_VALUE_ITER_DEPTH];
+        size_t                 depth;
+} qcl_value_iter;
+
+static qcl_value_iter
+qcl_value_iter_begin(qcl_config *config,
+                     const char *var)
+{
+        qcl_value_iter   it;
+        const qcl_value *value = qcl_value_get(config, var);
+
+        it.leaf  = NULL;
+        it.depth = 0;
+
+        if (value && value->kind == QCL_VALUE_KIND_LIST) {
+                it.stack[0].lst = (const qcl_value_list *)value;
+                it.stack[0].i   = 0;
+                it.depth        = 1;
+        } else {
+                it.leaf = value;
+        }
+
+        return it;
+}
+
+// Returns the next string, or NULL when done. The string is borrowed
+// from `config` and is valid until it is destroyed.
+static const char *
+qcl_value_iter_next(qcl_value_iter *it)
+{
+        const qcl_value *v = it->leaf;
+        it->leaf = NULL;
+
+        while (!v && it->depth > 0) {
+                _qcl_value_iter_frame *top = &it->stack[it->depth-1];
+
+                if (top->i == top->lst->values.len) {
+                        --it->depth;
+                        continue;
+                }
+
+                v = top->lst->values.data[top->i++];
+                if (v->kind == QCL_VALUE_KIND_LIST) {
+                        assert(it->depth < QCL_VALUE_ITER_DEPTH);
+                        it->stack[it->depth].lst = (const qcl_value_list *)v;
+                        it->stack[it->depth].i   = 0;
+                        ++it->depth;
+                        v = NULL;
+                }
+        }
+
+        if (!v)                             return NULL;
+        if (v->kind == QCL_VALUE_KIND_BOOL) return ((const qcl_value_bool *)v)->b ? "true" : "false";
+        return ((const qcl_value_string *)v)->s;
+}
+
+static void
+qcl_add_value(qcl_config *config,
+              const char *id,
+              qcl_value  *value)
 {
         symtbl_insert(&config->interpreter.tbl, id, value);
 }
 
+static qcl_config
+qcl_parse_file_cached(const char *fp,
+                      const char *cache_fp)
+{
+        return qcl_parse_file_units(fp, cache_fp, NULL);
+}
+
+static qcl_config
+qcl_parse_file_units(const char     *fp,
+                     const char     *cache_fp,
+                     qcl_unit_cache *units)
+{
+        struct stat    st;
+        uint64_t       hash;
+        int            image = cache_fp && stat(fp, &st) == 0 && _qcl_hash_file(fp, &st, &hash);
+        qcl_unit_cache tmp;
+        qcl_config     config;
+
+        memset(&config, 0, sizeof(config));
+
+        if (image && _qcl_image_load(&config.image, fp, &st, hash, cache_fp)) {
+                config.interpreter.tbl = symtbl_create(symtbl_hash, symtbl_cmp);
+                config.deps = _qcl_image_deps(&config.image, &config.interpreter.arena, &config.ndeps);
+                return config;
+        }
+
+        if (!units) {
+                tmp   = qcl_unit_cache_create();
+                units = &tmp;
+        }
+
+        _qcl_load(&config, fp, units);
+
+        if (image && qcl_ok(&config)) {
+                (void)_qcl_image_write(&config.interpreter.tbl, config.deps, config.ndeps,
+                                       fp, &st, hash, cache_fp);
+        }
+
+        if (units == &tmp) qcl_unit_cache_destroy(&tmp);
+
+        return config;
+}
+
+// Whether any file `config` was read from has changed or is gone.
+static int
+qcl_config_changed(const qcl_config *config)
+{
+        for (size_t i = 0; i < config->ndeps; ++i) {
+                if (_qcl_dep_changed(&config->deps[i])) return 1;
+        }
+        return 0;
+}
+
+// The real path of the `i`th file `config` was read from, or NULL.
+static const char *
+qcl_config_file(const qcl_config *config,
+                size_t            i)
+{
+        return i < config->ndeps ? config->deps[i].path : NULL;
+}
+
+static void
+qcl_config_destroy(qcl_config *config)
+{
+        for (size_t i = 0; i < config->nunits; ++i) {
+                _qcl_unit_release(config->units[i]);
+        }
+        QCL_FREE(config->units);
+        symtbl_destroy(&config->interpreter.tbl);
+        _qcl_arena_free(&config->interpreter.arena);
+        _qcl_image_unload(&config->image);
+        memset(config, 0, sizeof(*config));
+}
+
+// ######################
+// # WRITER             #
+// ######################
+
+/**
+ * Appending writer for simple `id = 'value';` assignments.
+ *
+ * Assignments are queued with qcl_writer_set_string() and written by
+ * qcl_writer_flush() as a single O_APPEND write() followed by
+ * fdatasync(), so adding an assignment is O(1) in the size of the file
+ * and a crash can at worst lose the batch being written, never the
+ * existing contents. Since later assignments override earlier ones the
+ * file itself acts as the journal. qcl_writer_compact() drops the
+ * overridden assignments by writing a temporary file and rename()ing
+ * it over the original.
+ *
+ * All writers serialize on flock() of a `<fp>.lock` file next to the
+ * config. The config itself cannot be locked, because compaction
+ * replaces its inode.
+ */
+
+#define QCL_WRITER_COMPACT_THRESHOLD 64
+
+typedef struct {
+        char          *fp;
+        qcl_str_array  pending;
+} qcl_writer;
+
+static int
+_qcl_writer_lock(const char *fp)
+{
+        char lock_fp[4096];
+        int  fd;
+
+        if (snprintf(lock_fp, sizeof(lock_fp), "%s.lock", fp) >= (int)sizeof(lock_fp))
+                return -1;
+        if ((fd = open(lock_fp, O_RDWR|O_CREAT|O_CLOEXEC, 0644)) == -1)
+                return -1;
+
+        while (flock(fd, LOCK_EX) != 0) {
+                if (errno != EINTR) {
+                        close(fd);
+                        return -1;
+                }
+        }
+
+        return fd;
+}
+
+static void
+_qcl_writer_unlock(int fd)
+{
+        (void)flock(fd, LOCK_UN);
+        close(fd);
+}
+
+static int
+_qcl_write_all(int fd, const char *buf, size_t n)
+{
+        while (n > 0) {
+                ssize_t k = write(fd, buf, n);
+                if (k == -1 && errno == EINTR) continue;
+                if (k <= 0) return 0;
+                buf += k, n -= k;
+        }
+        return 1;
+}
+
+static qcl_writer
+qcl_writer_create(const char *fp)
+{
+        // Write through symlinks, compaction must not replace the link.
+        char *real = realpath(fp, NULL);
+        return (qcl_writer) {
+                .fp      = real ? real : strdup(fp),
+                .pending = qcl_array_empty(qcl_str_array),
+        };
+}
+
+static void
+qcl_writer_destroy(qcl_writer *w)
+{
+        for (size_t i = 0; i < w->pending.len; ++i) {
+                QCL_FREE(w->pending.data[i]);
+        }
+        qcl_array_free(w->pending);
+        QCL_FREE(w->fp);
+        w->fp = NULL;
+}
+
+// Queue `id = 'value';`. Returns 0 if `id` is not a valid variable path
+// or `value` cannot be quoted (it contains both kinds of quotes).
+static int
+qcl_writer_set_string(qcl_writer *w,
+                      const char *id,
+                      const char *value)
+{
+        size_t id_n = strlen(id);
+        char   quote;
+
+        if (!_qcl_is_path(id, id_n)) return 0;
+
+        if      (!strchr(value, '\'')) quote = '\'';
+        else if (!strchr(value, '"'))  quote = '"';
+        else                           return 0;
+
+        size_t n    = id_n + strlen(value) + 8;
+        char  *line = (char *)QCL_MALLOC(n);
+        snprintf(line, n, "%s = %c%s%c;", id, quote, value, quote);
+        qcl_array_append(w->pending, line);
+
+        return 1;
+}
+
+// Append all queued assignments. Returns the number of assignments
+// written or -1 on failure, in which case they stay queued.
+static int
+qcl_writer_flush(qcl_writer *w)
+{
+        if (w->pending.len == 0) return 0;
+
+        size_t n = 2;
+        for (size_t i = 0; i < w->pending.len; ++i) {
+                n += strlen(w->pending.data[i]) + 1;
+        }
+
+        char  *buf = (char *)QCL_MALLOC(n);
+        size_t len = 0;
+        int    lock, fd, ok = 0;
+
+        if ((lock = _qcl_writer_lock(w->fp)) == -1) {
+                QCL_FREE(buf);
+                return -1;
+        }
+
+        if ((fd = open(w->fp, O_RDWR|O_APPEND|O_CREAT|O_CLOEXEC, 0644)) == -1) {
+                goto done;
+        }
+
+        // Do not glue the first assignment onto an unterminated last
+        // line, it might be a comment.
+        struct stat st;
+        char        last;
+        if (fstat(fd, &st) == 0 && st.st_size > 0
+            && pread(fd, &last, 1, st.st_size-1) == 1 && last != '\n') {
+                buf[len++] = '\n';
+        }
+
+        for (size_t i = 0; i < w->pending.len; ++i) {
+                size_t k = strlen(w->pending.data[i]);
+                memcpy(buf+len, w->pending.data[i], k);
+                len += k;
+                buf[len++] = '\n';
+        }
+
+        ok = _qcl_write_all(fd, buf, len) && fdatasync(fd) == 0;
+        close(fd);
+
+ done:
+        _qcl_writer_unlock(lock);
+        QCL_FREE(buf);
+
+        if (!ok) return -1;
+
+        int written = (int)w->pending.len;
+        for (size_t i = 0; i < w->pending.len; ++i) {
+                QCL_FREE(w->pending.data[i]);
+        }
+        qcl_array_clear(w->pending);
+
+        return written;
+}
+
+typedef struct {
+        _qcl_slice  id;
+        size_t      start;
+        size_t      end;
+        int         drop;
+} _qcl_assign_span;
+
+QCL_ARRAY_TYPE(_qcl_assign_span, _qcl_assign_span_array);
+
+static int
+_qcl_fsync_parent(const char *fp)
+{
+        char        dir[4096];
+        const char *slash = strrchr(fp, '/');
+        int         fd, ok;
+
+        if (!slash) snprintf(dir, sizeof(dir), ".");
+        else        snprintf(dir, sizeof(dir), "%.*s", (int)(slash - fp) ? (int)(slash - fp) : 1, fp);
+
+        if ((fd = open(dir, O_RDONLY|O_DIRECTORY|O_CLOEXEC)) == -1) return 0;
+        ok = fsync(fd) == 0;
+        close(fd);
+        return ok;
+}
+
+// Rewrite the file at `fp` without top-level assignments that are
+// overridden by a later top-level assignment to the same, otherwise
+// unreferenced, variable. Returns the number of assignments dropped or
+// -1 on failure. The file is left untouched unless something is
+// dropped.
+static int
+qcl_writer_compact(const char *fp)
+{
+        int                     lock;
+        int                     dropped = -1;
+        _qcl_source             src     = {0};
+        char                   *out     = NULL;
+        _qcl_lexer              lexer;
+        _qcl_parser             parser;
+        _qcl_assign_span_array  spans   = qcl_array_empty(_qcl_assign_span_array);
+        _qcl_idmap              last    = _qcl_idmap_create(_qcl_idmap_hash, _qcl_idmap_cmp);
+        _qcl_idmap              refs    = _qcl_idmap_create(_qcl_idmap_hash, _qcl_idmap_cmp);
+
+        memset(&lexer, 0, sizeof(lexer));
+
+        if ((lock = _qcl_writer_lock(fp)) == -1) goto cleanup;
+        if (!_qcl_load_file(fp, &src))           goto unlock;
+
+        // Only compact files that are valid as they are.
+        if ((lexer = _qcl_lex_file(fp, src.data, src.len)).err.msg) goto unlock;
+
+        parser = _qcl_create_program(&lexer);
+        _qcl_program_free(&parser.p);
+        if (parser.err.msg) goto unlock;
+
+        // The EOF token ends every statement, so t+1 is always valid.
+        // An included file may read any variable assigned before the
+        // include, so those assignments are all kept.
+        size_t      depth   = 0;
+        size_t      inc_end = 0;
+        _qcl_token *prev    = NULL;
+        for (_qcl_token *t = lexer.toks.data; t->ty != _QCL_TT_EOF; prev = t, ++t) {
+                if (t->ty == _QCL_TT_LCURLY) ++depth;
+                if (t->ty == _QCL_TT_RCURLY) --depth;
+                if (t->ty == _QCL_TT_KEYWORD && _qcl_token_is(&lexer, t, QCL_KWD_INCLUDE)) inc_end = t->off;
+                if (t->ty != _QCL_TT_IDENTIFIER) continue;
+
+                int stmt_start = !prev
+                        || prev->ty == _QCL_TT_SEMICOLON
+                        || prev->ty == _QCL_TT_RCURLY;
+
+                if (depth == 0 && stmt_start && t[1].ty == _QCL_TT_EQUALS) {
+                        _qcl_token *semi = t+1;
+                        while (semi->ty != _QCL_TT_SEMICOLON) ++semi;
+                        qcl_array_append(spans, ((_qcl_assign_span) {
+                                .id    = _qcl_token_slice(&lexer, t),
+                                .start = t->off,
+                                .end   = semi->off + 1,
+                                .drop  = 0,
+                        }));
+                        _qcl_idmap_insert(&last, _qcl_token_slice(&lexer, t), spans.len-1);
+                        continue;
+                }
+
+                if (t[1].ty != _QCL_TT_EQUALS) {
+                        _qcl_idmap_insert(&refs, _qcl_token_slice(&lexer, t), 1);
+                }
+        }
+
+        dropped = 0;
+        for (size_t i = 0; i < spans.len; ++i) {
+                if (*_qcl_idmap_get(&last, spans.data[i].id) != i
+                    && !_qcl_idmap_contains(&refs, spans.data[i].id)
+                    && spans.data[i].start >= inc_end) {
+                        spans.data[i].drop = 1;
+                        ++dropped;
+                }
+        }
+
+        if (dropped == 0) goto unlock;
+
+        size_t src_n = src.len, out_n = 0, at = 0;
+        out = (char *)QCL_MALLOC(src_n + 1);
+        for (size_t i = 0; i < spans.len; ++i) {
+                if (!spans.data[i].drop) continue;
+                memcpy(out+out_n, src.data+at, spans.data[i].start - at);
+                out_n += spans.data[i].start - at;
+                at = spans.data[i].end;
+                // Remove the line too if the assignment was all of it.
+                if ((out_n == 0 || out[out_n-1] == '\n') && src.data[at] == '\n') ++at;
+        }
+        memcpy(out+out_n, src.data+at, src_n - at);
+        out_n += src_n - at;
+        out[out_n] = 0;
+
+        {
+                // Never replace the config with something that does not parse.
+                _qcl_lexer check = _qcl_lex_file(fp, out, out_n);
+                int bad = check.err.msg != NULL;
+                if (!bad) {
+                        _qcl_parser cp = _qcl_create_program(&check);
+                        bad = cp.err.msg != NULL;
+                        _qcl_program_free(&cp.p);
+                }
+                _qcl_lexer_free(&check);
+                if (bad) {
+                        dropped = -1;
+                        goto unlock;
+                }
+        }
+
+        char        tmp[4096];
+        struct stat st;
+        int         fd;
+
+        if (snprintf(tmp, sizeof(tmp), "%s.compact.tmp", fp) >= (int)sizeof(tmp)
+            || stat(fp, &st) != 0
+            || (fd = open(tmp, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, st.st_mode & 07777)) == -1) {
+                dropped = -1;
+                goto unlock;
+        }
+
+        if (!_qcl_write_all(fd, out, out_n) || fsync(fd) != 0) {
+                close(fd);
+                unlink(tmp);
+                dropped = -1;
+                goto unlock;
+        }
+        close(fd);
+
+        if (rename(tmp, fp) != 0) {
+                unlink(tmp);
+                dropped = -1;
+                goto unlock;
+        }
+        (void)_qcl_fsync_parent(fp);
+
+ unlock:
+        _qcl_writer_unlock(lock);
+ cleanup:
+        _qcl_lexer_free(&lexer);
+        _qcl_idmap_destroy(&last);
+        _qcl_idmap_destroy(&refs);
+        qcl_array_free(spans);
+        _qcl_source_free(&src);
+        QCL_FREE(out);
+
+        return dropped;
+}
+
 #endif // QCL_IMPL
 
 #endif // QCL_INCLUDED_H
@@ -0,0 +1,166 @@
+#include "trace.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+int         g_trace      = 0;
+trace_frame g_trace_last = {0};
+
+const char *g_trace_phases[TRACE_PHASES] = {
+        [TRACE_FRAME]  = "frame",
+        [TRACE_SCAN]   = "scan",
+        [TRACE_SORT]   = "sort",
+        [TRACE_STAT]   = "stat",
+        [TRACE_OWNER]  = "owner",
+        [TRACE_RENDER] = "render",
+        [TRACE_FILEOP] = "fileop",
+        [TRACE_RELOAD] = "reload",
+};
+
+static struct {
+        FILE        *fp;
+        uint64_t     t0;   // trace timestamps are relative to this
+        pid_t        pid;
+        trace_frame  cur;  // of the UI thread
+        uint64_t     key;  // when the last key was read, 0 if it was drawn
+} g_tr = {0};
+
+static _Thread_local int   t_ui  = 0;
+static _Thread_local pid_t t_tid = 0;
+
+uint64_t
+trace_now(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec + 1;
+}
+
+// Paths may hold anything but NUL.
+static void
+put_json(FILE       *fp,
+         const char *s)
+{
+        fputc('"', fp);
+        for (; *s; ++s) {
+                unsigned char c = (unsigned char)*s;
+                if (c == '"' || c == '\\') fprintf(fp, "\\%c", c);
+                else if (c < 0x20)         fprintf(fp, "\\u%04x", c);
+                else                       fputc(c, fp);
+        }
+        fputc('"', fp);
+}
+
+// A single event is written with the FILE locked, so that spans from
+// other threads do not interleave.
+static void
+write_event(const char *name,
+            const char *cat,
+            const char *arg,
+            uint64_t    t0,
+            uint64_t    t1)
+{
+        if (!t_tid) t_tid = (pid_t)syscall(SYS_gettid);
+
+        flockfile(g_tr.fp);
+        fputs("{\"name\":", g_tr.fp);
+        put_json(g_tr.fp, name);
+        fprintf(g_tr.fp, ",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d",
+                cat, (t0 - g_tr.t0) / 1e3, (t1 - t0) / 1e3, (int)g_tr.pid, (int)t_tid);
+        if (arg) {
+                fputs(",\"args\":{\"arg\":", g_tr.fp);
+                put_json(g_tr.fp, arg);
+                fputc('}', g_tr.fp);
+        }
+        fputs("},\n", g_tr.fp);
+        funlockfile(g_tr.fp);
+}
+
+void
+trace_span(trace_phase  phase,
+           const char  *name,
+           const char  *arg,
+           uint64_t     t0)
+{
+        uint64_t t1 = trace_now();
+
+        if (t_ui) g_tr.cur.ns[phase] += t1 - t0;
+        if (g_tr.fp) write_event(name ? name : g_trace_phases[phase], g_trace_phases[phase], arg, t0, t1);
+}
+
+void
+trace_syscalls(uint64_t n)
+{
+        if (t_ui) g_tr.cur.syscalls += n;
+}
+
+void
+trace_init(void)
+{
+        t_ui = 1;
+}
+
+// The array is left open, the trace viewers accept that, and so a trace
+// is still readable if ie dies.
+int
+trace_open(const char *path)
+{
+        if (!(g_tr.fp = fopen(path, "w"))) return 0;
+
+        g_tr.t0  = trace_now();
+        g_tr.pid = getpid();
+        fputs("[\n", g_tr.fp);
+        g_trace |= TRACE_FILE;
+
+        return 1;
+}
+
+void
+trace_close(void)
+{
+        if (!g_tr.fp) return;
+
+        g_trace &= ~TRACE_FILE;
+        fclose(g_tr.fp);
+        g_tr.fp = NULL;
+}
+
+void
+trace_hud(int on)
+{
+        if (on) g_trace |= TRACE_HUD;
+        else    g_trace &= ~TRACE_HUD;
+
+        memset(&g_tr.cur, 0, sizeof(g_tr.cur));
+        memset(&g_trace_last, 0, sizeof(g_trace_last));
+        g_tr.key = 0;
+}
+
+void
+trace_key(void)
+{
+        if (g_trace && !g_tr.key) g_tr.key = trace_now();
+}
+
+void
+trace_frame_end(uint64_t t0)
+{
+        if (!t0) return;
+
+        trace_span(TRACE_FRAME, NULL, NULL, t0);
+
+        uint64_t t1 = trace_now();
+        g_tr.cur.latency_ns = g_tr.key ? t1 - g_tr.key : 0;
+        g_tr.key            = 0;
+
+        if (g_tr.fp) {
+                fprintf(g_tr.fp, "{\"name\":\"syscalls\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":%d,\"args\":{\"n\":%llu}},\n",
+                        (t1 - g_tr.t0) / 1e3, (int)g_tr.pid, (unsigned long long)g_tr.cur.syscalls);
+        }
+
+        g_trace_last = g_tr.cur;
+        memset(&g_tr.cur, 0, sizeof(g_tr.cur));
+}